@@ -0,0 +1,766 @@
+// Regression benchmarks for the route planner, on Google Benchmark. Run
+//   pune_metro_bench --benchmark_out=results.json --benchmark_out_format=json
+// (or build the run_benchmarks target) and compare two result files with
+// Google Benchmark's tools/compare.py. --benchmark_filter=<regex> selects
+// benchmarks by name, e.g. 'synthetic/1k' or '^pune/'.
+//
+// Every network is built once, on first use, and the random queries come
+// from fixed seeds, so two runs measure the same work.
+#include <benchmark/benchmark.h>
+
+#include <map>
+
+#include "pune_metro.h"
+
+namespace {
+
+enum class Engine { DIJKSTRA, BIDIRECTIONAL, ASTAR, ROUTE_TABLES, HIERARCHY };
+
+const char* engine_name(Engine engine) {
+    switch (engine) {
+        case Engine::DIJKSTRA: return "dijkstra";
+        case Engine::BIDIRECTIONAL: return "bidirectional";
+        case Engine::ASTAR: return "astar";
+        case Engine::ROUTE_TABLES: return "tables";
+        case Engine::HIERARCHY: return "hierarchy";
+    }
+    return "?";
+}
+
+// The built-in network, with route tables or hierarchies when the engine
+// needs them.
+MetroSystem& pune(Engine engine = Engine::ASTAR) {
+    static MetroSystem plain;
+    static MetroSystem tables;
+    static MetroSystem hierarchies;
+    static std::once_flag built;
+    std::call_once(built, [] {
+        tables.precompute_routes();
+        hierarchies.build_hierarchies();
+    });
+    if (engine == Engine::ROUTE_TABLES) return tables;
+    if (engine == Engine::HIERARCHY) return hierarchies;
+    return plain;
+}
+
+// A synthetic grid; with `parallel` > 1, 64 lines running in bundles of
+// that many over the same segments.
+MetroSystem& synthetic(int stations, int parallel = 1) {
+    static std::map<std::pair<int, int>, std::unique_ptr<MetroSystem>> built;
+    auto& system = built[{stations, parallel}];
+    if (!system) {
+        std::istringstream csv(parallel > 1 ? synthetic_network(stations, 64, 7, 0, parallel)
+                                            : synthetic_network(stations, 48, 7));
+        system = std::make_unique<MetroSystem>(csv);
+    }
+    return *system;
+}
+
+// A synthetic grid with trains every 6 minutes, for journey planning.
+MetroSystem& timetabled(int stations) {
+    static std::map<int, std::unique_ptr<MetroSystem>> built;
+    auto& system = built[stations];
+    if (!system) {
+        std::istringstream csv(synthetic_network(stations, 48, 7, 6));
+        system = std::make_unique<MetroSystem>(csv);
+    }
+    return *system;
+}
+
+std::vector<std::pair<int, int>> random_pairs(const MetroSystem& system, size_t count,
+                                              unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> station(
+        0, static_cast<int>(system.network().station_count()) - 1);
+    std::vector<std::pair<int, int>> pairs(count);
+    for (auto& pair : pairs) pair = {station(rng), station(rng)};
+    return pairs;
+}
+
+// Every ordered pair of stations, one route each.
+void pune_all_pairs(benchmark::State& state, bool minimize_time, Engine engine) {
+    const MetroSystem& system = pune(engine);
+    auto algorithm = engine == Engine::DIJKSTRA      ? MetroSystem::SearchAlgorithm::DIJKSTRA
+                     : engine == Engine::BIDIRECTIONAL ? MetroSystem::SearchAlgorithm::BIDIRECTIONAL
+                                                       : MetroSystem::SearchAlgorithm::ASTAR;
+    int n = static_cast<int>(system.network().station_count());
+    auto& ws = MetroSystem::thread_workspace();
+    for (auto _ : state) {
+        for (int s = 0; s < n; ++s) {
+            for (int t = 0; t < n; ++t) {
+                auto route = system.find_optimal_path(StationId(s), StationId(t), minimize_time,
+                                                      ws, algorithm);
+                benchmark::DoNotOptimize(route.total_time);
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * n * n);
+}
+
+// One random point-to-point query per iteration, with the default search.
+void synthetic_query(benchmark::State& state, int stations, bool minimize_time) {
+    const MetroSystem& system = synthetic(stations);
+    auto pairs = random_pairs(system, 1024, 17);
+    auto& ws = MetroSystem::thread_workspace();
+    uint64_t relaxations = ws.relaxations;
+    size_t next = 0;
+    for (auto _ : state) {
+        auto [s, t] = pairs[next++ % pairs.size()];
+        auto route = system.find_optimal_path(StationId(s), StationId(t), minimize_time, ws);
+        benchmark::DoNotOptimize(route.total_time);
+    }
+    state.counters["relaxations"] = benchmark::Counter(
+        static_cast<double>(ws.relaxations - relaxations), benchmark::Counter::kAvgIterations);
+    state.counters["stations"] = static_cast<double>(system.network().station_count());
+}
+
+// One random time query per iteration with the given priority queue
+// forced; pushes and stale pops are counted per query.
+void queue_query(benchmark::State& state, MetroSystem& system, SearchQueue::Kind kind) {
+    auto pairs = random_pairs(system, 1024, 17);
+    auto& ws = MetroSystem::thread_workspace();
+    system.set_queue_kind(kind);
+    uint64_t pushes = ws.queue.pushes, pops = ws.queue.pops, settled = 0;
+    size_t next = 0;
+    for (auto _ : state) {
+        auto [s, t] = pairs[next++ % pairs.size()];
+        auto route = system.find_optimal_path(StationId(s), StationId(t), true, ws);
+        benchmark::DoNotOptimize(route.total_time);
+        if (s != t) settled += ws.settled.size();
+    }
+    system.reset_queue_kind();
+    state.counters["pushes"] = benchmark::Counter(
+        static_cast<double>(ws.queue.pushes - pushes), benchmark::Counter::kAvgIterations);
+    state.counters["stale_pops"] = benchmark::Counter(
+        static_cast<double>(ws.queue.pops - pops - settled), benchmark::Counter::kAvgIterations);
+}
+
+// One random time query per iteration, relaxing segments one or four at a
+// time.
+void relaxation_query(benchmark::State& state, MetroSystem& system, bool vector) {
+    if (vector && !SIMD_RELAXATION) {
+        state.SkipWithError("not built for AVX2 (PUNE_METRO_NATIVE)");
+        return;
+    }
+    auto pairs = random_pairs(system, 1024, 17);
+    auto& ws = MetroSystem::thread_workspace();
+    bool chosen = system.uses_vector_relaxation();
+    system.set_vector_relaxation(vector);
+    size_t next = 0;
+    for (auto _ : state) {
+        auto [s, t] = pairs[next++ % pairs.size()];
+        auto route = system.find_optimal_path(StationId(s), StationId(t), true, ws);
+        benchmark::DoNotOptimize(route.total_time);
+    }
+    system.set_vector_relaxation(chosen);
+}
+
+// One query per iteration from a Zipf-distributed replay (exponent 1.1
+// over `distinct` pairs) through a route cache of `entries` results that
+// persists across iterations.
+void cached_query(benchmark::State& state, MetroSystem& system, size_t distinct, size_t entries) {
+    auto queries = zipf_queries(static_cast<int>(system.network().station_count()), distinct,
+                                1 << 16, 1.1, 37);
+    auto& ws = MetroSystem::thread_workspace();
+    system.enable_route_cache(entries);
+    size_t next = 0;
+    for (auto _ : state) {
+        auto [s, t] = queries[next++ % queries.size()];
+        auto route = system.find_optimal_path(StationId(s), StationId(t), true, ws);
+        benchmark::DoNotOptimize(route.total_time);
+    }
+    if (entries > 0) state.counters["hit_rate"] = system.cache()->stats().hit_rate();
+    system.enable_route_cache(0);
+}
+
+// One isochrone with 10, 20 and 30 minute rings per iteration, from
+// random origins.
+void isochrone_query(benchmark::State& state, const MetroSystem& system) {
+    auto origins = random_pairs(system, 1024, 31);
+    const std::vector<double> budgets = {10, 20, 30};
+    size_t next = 0, reached = 0;
+    for (auto _ : state) {
+        StationId origin(origins[next++ % origins.size()].first);
+        auto isochrone = system.isochrone(ArrayView<StationId>(&origin, 1), budgets);
+        reached += isochrone.stations.size();
+    }
+    state.counters["stations"] = benchmark::Counter(static_cast<double>(reached), 
+                                                    benchmark::Counter::kAvgIterations);
+}
+
+// Up to k alternatives for one random time query per iteration, with the
+// routes found per query.
+void alternatives_query(benchmark::State& state, const MetroSystem& system, size_t k) {
+    auto pairs = random_pairs(system, 1024, 23);
+    auto& fwd = MetroSystem::thread_workspace();
+    auto& bwd = MetroSystem::thread_backward_workspace();
+    size_t next = 0, found = 0;
+    for (auto _ : state) {
+        auto [s, t] = pairs[next++ % pairs.size()];
+        found += system.find_alternative_routes(StationId(s), StationId(t), k, true, fwd, bwd)
+                     .size();
+    }
+    state.counters["routes"] = benchmark::Counter(static_cast<double>(found),
+                                                  benchmark::Counter::kAvgIterations);
+}
+
+// One Pareto search per iteration, with the labels it creates and settles
+// and the trade-offs it finds.
+void pareto_query(benchmark::State& state, const MetroSystem& system) {
+    auto pairs = random_pairs(system, 1024, 29);
+    auto& ws = MetroSystem::thread_pareto_workspace();
+    uint64_t settled = ws.settled;
+    size_t next = 0, routes = 0, labels = 0, truncated = 0;
+    for (auto _ : state) {
+        auto [s, t] = pairs[next++ % pairs.size()];
+        routes += system.find_pareto_routes(StationId(s), StationId(t), ws).size();
+        labels += ws.labels.size();
+        truncated += ws.truncated;
+    }
+    auto per_query = [&](double total) {
+        return benchmark::Counter(total, benchmark::Counter::kAvgIterations);
+    };
+    state.counters["routes"] = per_query(static_cast<double>(routes));
+    state.counters["labels"] = per_query(static_cast<double>(labels));
+    state.counters["settled"] = per_query(static_cast<double>(ws.settled - settled));
+    state.counters["truncated"] = static_cast<double>(truncated);
+}
+
+// One timetabled journey per iteration between random stations at random
+// times of day, with the connections scanned per query.
+void journey_query(benchmark::State& state, const MetroSystem& system, bool arrive) {
+    auto pairs = random_pairs(system, 1024, 23);
+    std::mt19937 rng(23);
+    std::uniform_int_distribution<uint32_t> clock(5 * 3600, 23 * 3600);
+    std::vector<uint32_t> times(pairs.size());
+    for (auto& time : times) time = clock(rng);
+    
+    auto& ws = MetroSystem::thread_journey_workspace();
+    uint64_t scanned = ws.scanned;
+    size_t next = 0, found = 0;
+    for (auto _ : state) {
+        size_t i = next++ % pairs.size();
+        StationId s(pairs[i].first), t(pairs[i].second);
+        auto journey = arrive ? system.arrive_by(s, t, times[i], ws) 
+                              : system.depart_at(s, t, times[i], ws);
+        found += journey.found;
+    }
+    state.counters["scanned"] = benchmark::Counter(static_cast<double>(ws.scanned - scanned),
+                                                   benchmark::Counter::kAvgIterations);
+    state.counters["found"] = benchmark::Counter(static_cast<double>(found),
+                                                 benchmark::Counter::kAvgIterations);
+}
+
+// A route matrix between `size` random sources and `size` random targets.
+void matrix_query(benchmark::State& state, const MetroSystem& system, size_t size) {
+    auto pairs = random_pairs(system, size, 13);
+    std::vector<StationId> sources, targets;
+    for (auto [s, t] : pairs) {
+        sources.emplace_back(s);
+        targets.emplace_back(t);
+    }
+    for (auto _ : state) {
+        auto matrix = system.many_to_many(sources, targets, true);
+        benchmark::DoNotOptimize(matrix.cost.data());
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(size * size));
+}
+
+// Route tables (both cost modes, on the worker pool) or hierarchies built
+// from scratch, with the memory they take.
+void precompute(benchmark::State& state, MetroSystem& system, bool hierarchy) {
+    size_t bytes = 0;
+    for (auto _ : state) {
+        if (hierarchy) {
+            system.build_hierarchies();
+        } else {
+            system.precompute_routes();
+        }
+        
+        state.PauseTiming();
+        bytes = 0;
+        for (bool minimize_time : {true, false}) {
+            bytes += hierarchy ? system.hierarchy(minimize_time)->memory_bytes()
+                               : system.precomputed_routes(minimize_time)->memory_bytes();
+        }
+        system.drop_hierarchies();  // only the modes without one are built
+        system.drop_precomputed_routes();
+        state.ResumeTiming();
+    }
+    state.counters["bytes"] = static_cast<double>(bytes);
+}
+
+// find_paths_batch over a fixed set of random queries on the worker pool.
+void batch_throughput(benchmark::State& state, MetroSystem& system, size_t query_count) {
+    auto pairs = random_pairs(system, query_count, 11);
+    std::vector<MetroSystem::StationQuery> queries(query_count);
+    for (size_t i = 0; i < query_count; ++i) {
+        queries[i] = {StationId(pairs[i].first), StationId(pairs[i].second), i % 2 == 0};
+    }
+    system.set_thread_count(static_cast<unsigned>(state.range(0)));
+    for (auto _ : state) {
+        auto results = system.find_paths_batch(ArrayView<MetroSystem::StationQuery>(queries));
+        benchmark::DoNotOptimize(results.data());
+    }
+    system.set_thread_count(std::max(1u, std::thread::hardware_concurrency()));
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(query_count));
+}
+
+// Random queries from a file piped through the batch front end into
+// /dev/null, in one output format.
+void batch_output(benchmark::State& state, const MetroSystem& system, BatchRunner::Format format,
+                  size_t count) {
+    const auto& graph = system.network();
+    auto path = (std::filesystem::temp_directory_path() /
+                 ("pune_metro_bench_" + std::to_string(getpid()) + ".queries")).string();
+    {
+        std::ofstream queries(path);
+        for (auto [s, t] : random_pairs(system, count, 37)) {
+            queries << graph.name(s) << "," << graph.name(t) << (s % 2 ? ",distance\n" : "\n");
+        }
+    }
+    
+    int null_fd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+    size_t bytes = 0;
+    for (auto _ : state) {
+        int in_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        bytes += BatchRunner(system, format).run(in_fd, null_fd).bytes;
+        ::close(in_fd);
+    }
+    ::close(null_fd);
+    std::filesystem::remove(path);
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(count));
+    state.SetBytesProcessed(static_cast<int64_t>(bytes));
+}
+
+// `clients` connections to a server on a Unix socket, each sending
+// `requests` random route requests per iteration and keeping up to
+// `depth` of them in flight: depth 1 is a closed loop of interactive
+// clients, a large depth a pipelining backend. The server's latency
+// percentiles are in microseconds.
+void server_requests(benchmark::State& state, const MetroSystem& system, size_t clients,
+                     size_t requests, size_t depth) {
+    QueryServer::raise_descriptor_limit();
+    auto path = (std::filesystem::temp_directory_path() /
+                 ("pune_metro_bench_" + std::to_string(getpid()) + ".sock")).string();
+    LiveNetwork live(std::shared_ptr<const MetroSystem>(&system, [](const MetroSystem*) {}));
+    QueryServer server(live);
+    server.listen_unix(path);
+    std::thread loop([&] { server.run(); });
+    
+    const auto& graph = system.network();
+    std::vector<std::string> lines;
+    for (auto [s, t] : random_pairs(system, requests, 31)) {
+        std::string line = "{\"id\":" + std::to_string(lines.size()) + ",\"from\":";
+        JsonFields::append_string(line, graph.name(s));
+        line += ",\"to\":";
+        JsonFields::append_string(line, graph.name(t));
+        line += lines.size() % 2 ? "}\n" : ",\"mode\":\"distance\"}\n";
+        lines.push_back(std::move(line));
+    }
+    
+    struct Client {
+        int fd;
+        size_t sent = 0;
+        size_t answered = 0;
+    };
+    std::vector<Client> connected;
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    for (size_t c = 0; c < clients; ++c) {
+        int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+            throw std::system_error(errno, std::generic_category(), "bench client connect");
+        }
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = c;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+        connected.push_back({fd});
+    }
+    
+    std::string batch;
+    auto top_up = [&](Client& client) {
+        batch.clear();
+        for (; client.sent < requests && client.sent - client.answered < depth; ++client.sent) {
+            batch += lines[client.sent];
+        }
+        for (size_t done = 0; done < batch.size();) {
+            ssize_t n = ::send(client.fd, batch.data() + done, batch.size() - done, MSG_NOSIGNAL);
+            if (n < 0) throw std::system_error(errno, std::generic_category(), "bench client send");
+            done += static_cast<size_t>(n);
+        }
+    };
+    
+    std::vector<char> buffer(64 * 1024);
+    epoll_event events[256];
+    size_t bytes = 0;
+    for (auto _ : state) {
+        for (auto& client : connected) {
+            client.sent = client.answered = 0;
+            top_up(client);
+        }
+        for (size_t remaining = clients * requests; remaining > 0;) {
+            int ready = epoll_wait(epoll_fd, events, 256, 10000);
+            if (ready <= 0) throw std::runtime_error("bench server stopped answering");
+            for (int i = 0; i < ready; ++i) {
+                Client& client = connected[events[i].data.u64];
+                ssize_t n = ::recv(client.fd, buffer.data(), buffer.size(), 0);
+                if (n <= 0) throw std::runtime_error("bench server closed a connection");
+                bytes += static_cast<size_t>(n);
+                auto answers = static_cast<size_t>(std::count(buffer.data(), buffer.data() + n, '\n'));
+                client.answered += answers;
+                remaining -= answers;
+                top_up(client);
+            }
+        }
+    }
+    
+    for (const auto& client : connected) ::close(client.fd);
+    ::close(epoll_fd);
+    server.stop();
+    loop.join();
+    
+    const auto& latency = server.latency();
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(clients * requests));
+    state.SetBytesProcessed(static_cast<int64_t>(bytes));
+    state.counters["p50_us"] = static_cast<double>(latency.percentile(0.5));
+    state.counters["p99_us"] = static_cast<double>(latency.percentile(0.99));
+}
+
+// One random segment closure, delay or restoration applied to a live
+// network per iteration while another thread keeps querying it in batches
+// of 256. `queries` is the query rate sustained during the updates;
+// route tables are repaired when `system` has them.
+void live_updates(benchmark::State& state, std::shared_ptr<MetroSystem> system) {
+    LiveNetwork live(system);
+    const auto& graph = system->network();
+    std::atomic<bool> updating{true};
+    std::atomic<size_t> answered{0};
+    std::thread querier([&] {
+        std::mt19937 rng(41);
+        std::uniform_int_distribution<int> station(0, static_cast<int>(graph.station_count()) - 1);
+        std::vector<MetroSystem::StationQuery> batch(256);
+        while (updating) {
+            for (auto& query : batch) {
+                query = {StationId(station(rng)), StationId(station(rng)), rng() % 2 == 0};
+            }
+            auto routes = live.snapshot()->find_paths_batch(
+                ArrayView<MetroSystem::StationQuery>(batch));
+            benchmark::DoNotOptimize(routes.data());
+            answered += batch.size();
+        }
+    });
+    
+    std::mt19937 rng(43);
+    std::uniform_int_distribution<uint32_t> edge(0, graph.edge_count() - 1);
+    size_t repaired = 0;
+    for (auto _ : state) {
+        uint32_t e = edge(rng);
+        StationId from(static_cast<int>(
+            std::upper_bound(graph.offsets.begin(), graph.offsets.end(), e) - graph.offsets.begin() - 1));
+        StationId to(static_cast<int>(graph.edge_to[e]));
+        int line = graph.edge_line[e];
+        NetworkUpdate update;
+        switch (rng() % 3) {
+            case 0: update.close_segment(from, to, line); break;
+            case 1: update.delay_segment(from, to, 1 + rng() % 10, line); break;
+            default: update.restore_segment(from, to, line); break;
+        }
+        auto report = live.apply(update);
+        repaired += report.repaired_sources[0] + report.repaired_sources[1];
+    }
+    updating = false;
+    querier.join();
+    
+    state.counters["repaired"] = benchmark::Counter(static_cast<double>(repaired),
+                                                    benchmark::Counter::kAvgIterations);
+    state.counters["queries"] = benchmark::Counter(static_cast<double>(answered.load()),
+                                                   benchmark::Counter::kIsRate);
+}
+
+// One exact name lookup per iteration, of random station names.
+void station_lookup(benchmark::State& state, const MetroSystem& system) {
+    auto stations = system.all_stations();
+    std::vector<std::string_view> names;
+    for (auto pair : random_pairs(system, 4096, 43)) {
+        names.push_back(system.station_name(stations[pair.first]));
+    }
+    size_t next = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(system.station_id(names[next++ % names.size()]));
+    }
+}
+
+// One keystroke of an autocomplete per iteration: every prefix of random
+// station names, every other name with a typo.
+void autocomplete(benchmark::State& state, const MetroSystem& system) {
+    const auto& graph = system.network();
+    std::mt19937 rng(29);
+    std::uniform_int_distribution<uint32_t> station(
+        0, static_cast<uint32_t>(graph.station_count()) - 1);
+    std::vector<std::string> keystrokes;
+    for (int i = 0; i < 200; ++i) {
+        std::string name(graph.name(station(rng)));
+        if (i % 2 == 1 && name.size() > 4) name.erase(name.size() / 2, 1);
+        for (size_t typed = 1; typed <= name.size(); ++typed) {
+            keystrokes.push_back(name.substr(0, typed));
+        }
+    }
+
+    system.name_index();  // built on first use; not part of the keystrokes
+    std::vector<StationNameIndex::Match> matches;
+    size_t next = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+            system.search_stations(keystrokes[next++ % keystrokes.size()], 10, matches));
+    }
+}
+
+void startup_builtin(benchmark::State& state) {
+    for (auto _ : state) {
+        MetroSystem built;
+        benchmark::DoNotOptimize(built.network().station_count());
+    }
+}
+
+// Parse and freeze a network description held in memory.
+void startup_csv(benchmark::State& state, int stations) {
+    std::string csv = synthetic_network(stations, 48, 7);
+    for (auto _ : state) {
+        std::istringstream in(csv);
+        MetroSystem loaded(in);
+        benchmark::DoNotOptimize(loaded.network().station_count());
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(csv.size()));
+}
+
+// Map a saved network image with the given checks.
+void startup_image(benchmark::State& state, const MetroSystem& system, const std::string& label,
+                   NetworkImage::Checks checks) {
+    std::string path = (std::filesystem::temp_directory_path() /
+                        ("pune_metro_bench_" + label + ".pmi")).string();
+    system.save_network(path);
+    for (auto _ : state) {
+        MetroSystem loaded(path, checks);
+        benchmark::DoNotOptimize(loaded.network().station_count());
+    }
+    state.SetBytesProcessed(state.iterations() *
+                            static_cast<int64_t>(std::filesystem::file_size(path)));
+    std::filesystem::remove(path);
+}
+
+void register_benchmarks() {
+    using benchmark::RegisterBenchmark;
+
+    for (bool minimize_time : {true, false}) {
+        for (Engine engine : {Engine::DIJKSTRA, Engine::BIDIRECTIONAL, Engine::ASTAR,
+                              Engine::ROUTE_TABLES, Engine::HIERARCHY}) {
+            std::string name = std::string("pune/all_pairs/") +
+                               (minimize_time ? "time/" : "distance/") + engine_name(engine);
+            RegisterBenchmark(name.c_str(), pune_all_pairs, minimize_time, engine)
+                ->Unit(benchmark::kMicrosecond);
+        }
+    }
+
+    for (auto [stations, label] : {std::pair{1000, "1k"}, {10000, "10k"}, {100000, "100k"}}) {
+        for (bool minimize_time : {true, false}) {
+            std::string name = std::string("synthetic/") + label + "/query/" +
+                               (minimize_time ? "time" : "distance");
+            RegisterBenchmark(name.c_str(), synthetic_query, stations, minimize_time)
+                ->Unit(benchmark::kMicrosecond);
+        }
+    }
+
+    for (auto [kind, kind_label] : {std::pair{SearchQueue::Kind::BINARY_HEAP, "binary"},
+                                     {SearchQueue::Kind::DARY_HEAP, "dary"},
+                                     {SearchQueue::Kind::RADIX_HEAP, "radix"}}) {
+        RegisterBenchmark((std::string("queue/pune/") + kind_label).c_str(),
+                          [kind = kind](benchmark::State& state) {
+            queue_query(state, pune(), kind);
+        })->Unit(benchmark::kMicrosecond);
+        for (auto [stations, label] : {std::pair{1000, "1k"}, {10000, "10k"}, {100000, "100k"}}) {
+            RegisterBenchmark((std::string("queue/synthetic/") + label + "/" + kind_label).c_str(),
+                              [kind = kind, stations = stations](benchmark::State& state) {
+                queue_query(state, synthetic(stations), kind);
+            })->Unit(benchmark::kMicrosecond);
+        }
+    }
+    
+    for (bool vector : {false, true}) {
+        const char* mode = vector ? "vector" : "scalar";
+        RegisterBenchmark((std::string("relax/pune/") + mode).c_str(), 
+                          [vector](benchmark::State& state) {
+            relaxation_query(state, pune(), vector);
+        })->Unit(benchmark::kMicrosecond);
+        for (int parallel : {1, 4, 8}) {
+            std::string name = "relax/synthetic/10k/" + std::to_string(2 * parallel) + 
+                               "_lines/" + mode;
+            RegisterBenchmark(name.c_str(), [vector, parallel](benchmark::State& state) {
+                relaxation_query(state, synthetic(10000, parallel), vector);
+            })->Unit(benchmark::kMicrosecond);
+        }
+    }
+    
+    for (size_t entries : {0, 256, 4096}) {
+        RegisterBenchmark(("cache/zipf/pune/" + std::to_string(entries)).c_str(),
+                          [entries](benchmark::State& state) {
+            cached_query(state, pune(), 2000, entries);
+        })->Unit(benchmark::kMicrosecond);
+        RegisterBenchmark(("cache/zipf/synthetic/10k/" + std::to_string(entries)).c_str(),
+                          [entries](benchmark::State& state) {
+            cached_query(state, synthetic(10000), 100000, entries);
+        })->Unit(benchmark::kMicrosecond);
+    }
+    
+    RegisterBenchmark("isochrone/pune", [](benchmark::State& state) {
+        isochrone_query(state, pune());
+    })->Unit(benchmark::kMicrosecond);
+    RegisterBenchmark("isochrone/synthetic/10k", [](benchmark::State& state) {
+        isochrone_query(state, synthetic(10000));
+    })->Unit(benchmark::kMicrosecond);
+    RegisterBenchmark("isochrone/pune/all_stations", [](benchmark::State& state) {
+        const std::vector<double> budgets = {10, 20, 30};
+        for (auto _ : state) benchmark::DoNotOptimize(pune().reach_counts(budgets).count.data());
+    })->Unit(benchmark::kMicrosecond);
+    
+    RegisterBenchmark("analytics/pune/betweenness", [](benchmark::State& state) {
+        for (auto _ : state) benchmark::DoNotOptimize(pune().betweenness().assigned);
+    })->Unit(benchmark::kMillisecond);
+    RegisterBenchmark("analytics/synthetic/10k/betweenness_64", [](benchmark::State& state) {
+        for (auto _ : state) benchmark::DoNotOptimize(synthetic(10000).betweenness(64).assigned);
+    })->Unit(benchmark::kMillisecond);
+    
+    for (size_t k : {2, 5}) {
+        std::string suffix = "/k" + std::to_string(k);
+        RegisterBenchmark(("alternatives/pune" + suffix).c_str(), [k](benchmark::State& state) {
+            alternatives_query(state, pune(), k);
+        })->Unit(benchmark::kMicrosecond);
+        RegisterBenchmark(("alternatives/synthetic/2.5k" + suffix).c_str(),
+                          [k](benchmark::State& state) {
+            alternatives_query(state, synthetic(2500), k);
+        })->Unit(benchmark::kMicrosecond);
+    }
+    
+    RegisterBenchmark("pareto/pune", [](benchmark::State& state) {
+        pareto_query(state, pune());
+    })->Unit(benchmark::kMicrosecond);
+    RegisterBenchmark("pareto/synthetic/2.5k", [](benchmark::State& state) {
+        pareto_query(state, synthetic(2500));
+    })->Unit(benchmark::kMicrosecond);
+    
+    for (bool arrive : {false, true}) {
+        const char* kind = arrive ? "arrive_by" : "depart_at";
+        RegisterBenchmark((std::string("timetable/pune/") + kind).c_str(),
+                          [arrive](benchmark::State& state) {
+            journey_query(state, pune(), arrive);
+        })->Unit(benchmark::kMicrosecond);
+        RegisterBenchmark((std::string("timetable/synthetic/2.5k/") + kind).c_str(),
+                          [arrive](benchmark::State& state) {
+            journey_query(state, timetabled(2500), arrive);
+        })->Unit(benchmark::kMicrosecond);
+    }
+    
+    RegisterBenchmark("matrix/pune", [](benchmark::State& state) {
+        matrix_query(state, pune(), 46);
+    })->Unit(benchmark::kMicrosecond);
+    RegisterBenchmark("matrix/synthetic/2.5k", [](benchmark::State& state) {
+        matrix_query(state, synthetic(2500), 1000);
+    })->UseRealTime()->Unit(benchmark::kMillisecond);
+    
+    for (bool hierarchy : {false, true}) {
+        const char* kind = hierarchy ? "/hierarchy" : "/tables";
+        RegisterBenchmark((std::string("precompute/pune") + kind).c_str(),
+                          [hierarchy](benchmark::State& state) {
+            precompute(state, pune(), hierarchy);
+        })->UseRealTime()->Unit(benchmark::kMillisecond);
+    }
+    RegisterBenchmark("precompute/synthetic/2.5k/hierarchy", [](benchmark::State& state) {
+        precompute(state, synthetic(2500), true);
+    })->Unit(benchmark::kMillisecond);
+    
+    RegisterBenchmark("live/pune/tables", [](benchmark::State& state) {
+        static auto system = [] {
+            auto built = std::make_shared<MetroSystem>();
+            built->precompute_routes();
+            return built;
+        }();
+        live_updates(state, system);
+    })->UseRealTime()->Unit(benchmark::kMicrosecond);
+    RegisterBenchmark("live/synthetic/2.5k/search", [](benchmark::State& state) {
+        static auto system = [] {
+            std::istringstream csv(synthetic_network(2500, 48, 7));
+            return std::make_shared<MetroSystem>(csv);
+        }();
+        live_updates(state, system);
+    })->UseRealTime()->Unit(benchmark::kMicrosecond);
+    
+    for (auto [clients, depth] : {std::pair<size_t, size_t>{1000, 1}, {1000, 20}}) {
+        std::string name = "server/pune/" + std::to_string(clients) + "_clients/" + 
+                           std::to_string(depth) + "_in_flight";
+        RegisterBenchmark(name.c_str(), [clients = clients, depth = depth](benchmark::State& state) {
+            server_requests(state, pune(), clients, 20, depth);
+        })->UseRealTime()->Unit(benchmark::kMillisecond);
+    }
+    
+    for (auto format : {BatchRunner::Format::JSON, BatchRunner::Format::BINARY}) {
+        std::string name = std::string("batch_output/pune/") + 
+                           (format == BatchRunner::Format::JSON ? "json" : "binary");
+        RegisterBenchmark(name.c_str(), [format](benchmark::State& state) {
+            batch_output(state, pune(), format, 100000);
+        })->UseRealTime()->Unit(benchmark::kMillisecond);
+    }
+    
+    RegisterBenchmark("batch/pune", [](benchmark::State& state) {
+        batch_throughput(state, pune(), 4096);
+    })->RangeMultiplier(2)->Range(1, 8)->UseRealTime()->Unit(benchmark::kMillisecond);
+    RegisterBenchmark("batch/synthetic/10k", [](benchmark::State& state) {
+        batch_throughput(state, synthetic(10000), 64);
+    })->RangeMultiplier(2)->Range(1, 8)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+    RegisterBenchmark("names/pune/resolve", [](benchmark::State& state) {
+        station_lookup(state, pune());
+    });
+    RegisterBenchmark("names/synthetic/10k/resolve", [](benchmark::State& state) {
+        station_lookup(state, synthetic(10000));
+    });
+    RegisterBenchmark("names/pune/autocomplete", [](benchmark::State& state) {
+        autocomplete(state, pune());
+    });
+    RegisterBenchmark("names/synthetic/10k/autocomplete", [](benchmark::State& state) {
+        autocomplete(state, synthetic(10000));
+    });
+    RegisterBenchmark("names/synthetic/100k/autocomplete", [](benchmark::State& state) {
+        autocomplete(state, synthetic(100000));
+    });
+
+    RegisterBenchmark("startup/builtin", startup_builtin)->Unit(benchmark::kMicrosecond);
+    RegisterBenchmark("startup/csv/10k", startup_csv, 10000)->Unit(benchmark::kMillisecond);
+    using Checks = NetworkImage::Checks;
+    for (Checks checks : {Checks::TRUSTED, Checks::STRUCTURE, Checks::CHECKSUM}) {
+        std::string suffix = checks == Checks::TRUSTED    ? "/trusted"
+                             : checks == Checks::CHECKSUM ? "/verified"
+                                                          : "";
+        RegisterBenchmark(("startup/image/pune_tables" + suffix).c_str(),
+                          [checks](benchmark::State& state) {
+            startup_image(state, pune(Engine::ROUTE_TABLES), "pune_tables", checks);
+        })->Unit(benchmark::kMicrosecond);
+        RegisterBenchmark(("startup/image/synthetic/10k" + suffix).c_str(),
+                          [checks](benchmark::State& state) {
+            startup_image(state, synthetic(10000), "synthetic_10k", checks);
+        })->Unit(benchmark::kMicrosecond);
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    register_benchmarks();
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
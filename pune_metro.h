@@ -0,0 +1,7355 @@
+// Route planning engine for the Pune Metro and networks like it: the
+// frozen network snapshot and its binary image, MetroSystem and its
+// searches, live updates, and the server and batch front ends. Header-only;
+// pune_metro.cpp adds the menu and main().
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <queue>
+#include <limits>
+#include <algorithm>
+#include <numeric>
+#include <memory>
+#include <utility>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <cstdint>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <stdexcept>
+#include <string_view>
+#include <fstream>
+#include <cstring>
+#include <filesystem>
+#include <charconv>
+#include <cctype>
+#include <cmath>
+#include <random>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <system_error>
+#include <csignal>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+// Build with -DPUNE_METRO_METRICS=1 to count what every search does and
+// time every query (see EngineMetrics). Off by default, when the hooks
+// compile to nothing.
+#ifndef PUNE_METRO_METRICS
+#define PUNE_METRO_METRICS 0
+#endif
+
+// Searches relax the segments out of a station four at a time when the
+// compiler targets AVX2 (-mavx2 or -march=native, the CMake option
+// PUNE_METRO_NATIVE), and one at a time otherwise.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+constexpr double INF = std::numeric_limits<double>::infinity();
+
+// Lines are numbered densely in the order they are declared.
+using LineId = uint8_t;
+using LineMask = uint64_t;
+
+constexpr int MAX_LINES = 64;
+
+// Station as handed out by name lookups and listings: its dense index in
+// the frozen network, wrapped so that it cannot be mixed up with a line or
+// a count. index() is the int the search functions take. A default or
+// failed lookup gives an invalid ID; MetroSystem::valid() also checks that
+// an ID made from an int is within the network.
+class StationId {
+public:
+    constexpr StationId() = default;
+    constexpr explicit StationId(int index) 
+        : value(index < 0 ? NONE : static_cast<uint32_t>(index)) {}
+    
+    constexpr bool valid() const { return value != NONE; }
+    constexpr int index() const { return static_cast<int>(value); }
+    
+    friend constexpr bool operator==(StationId a, StationId b) { return a.value == b.value; }
+    friend constexpr bool operator!=(StationId a, StationId b) { return a.value != b.value; }
+
+private:
+    static constexpr uint32_t NONE = 0xFFFFFFFF;
+    uint32_t value = NONE;
+};
+
+constexpr bool METRICS_ENABLED = PUNE_METRO_METRICS != 0;
+
+#if defined(__AVX2__)
+constexpr bool SIMD_RELAXATION = true;
+#else
+constexpr bool SIMD_RELAXATION = false;
+#endif
+
+struct Edge {
+    int to;
+    double distance;
+    double time;
+    LineId line;
+    
+    Edge(int to, double dist, LineId line_id, double speed_kmh = 35.0) 
+        : to(to), distance(dist), time((dist / speed_kmh) * 60), line(line_id) {}
+};
+
+constexpr LineMask line_bit(LineId line) {
+    return LineMask(1) << static_cast<int>(line);
+}
+
+struct Station {
+    std::string name;
+    LineMask lines;
+    bool is_interchange;
+    double latitude;
+    double longitude;
+    
+    Station(const std::string& n) 
+        : name(n), lines(0), is_interchange(false), latitude(NAN), longitude(NAN) {}
+    
+    bool on_line(LineId line) const { return lines & line_bit(line); }
+    
+    void add_line(LineId line) {
+        lines |= line_bit(line);
+        is_interchange = (lines & (lines - 1)) != 0;
+    }
+};
+
+// Read-only window onto an array owned elsewhere: a vector kept alive by
+// the enclosing snapshot, or a section of a memory-mapped network image.
+template <typename T>
+class ArrayView {
+public:
+    ArrayView() = default;
+    ArrayView(const T* data, size_t size) : ptr(data), len(size) {}
+    ArrayView(const std::vector<T>& v) : ptr(v.data()), len(v.size()) {}
+    
+    const T& operator[](size_t i) const { return ptr[i]; }
+    const T* data() const { return ptr; }
+    size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+    const T* begin() const { return ptr; }
+    const T* end() const { return ptr + len; }
+    
+private:
+    const T* ptr = nullptr;
+    size_t len = 0;
+};
+
+// Ticket price of one line: `boarding` when a journey boards it from
+// another fare group (or starts on it), plus `per_km` for every kilometre
+// ridden. Changing between lines of the same group needs no new ticket.
+struct LineFare {
+    float boarding;
+    float per_km;
+    uint32_t fare_group;
+};
+
+// Frozen, query-side view of the network in compressed sparse row form.
+// The edges of station i are [offsets[i], offsets[i + 1]) in the parallel
+// edge arrays, so a relaxation touches only the fields it needs. Station
+// names live in one character pool; name_order lists station indices in
+// name order for lookups and listings. `storage` keeps the arrays alive.
+struct NetworkGraph {
+    ArrayView<uint32_t> offsets;
+    ArrayView<uint32_t> edge_to;
+    ArrayView<float> edge_time;
+    ArrayView<float> edge_distance;
+    ArrayView<uint8_t> edge_line;
+    ArrayView<LineMask> station_lines;
+    ArrayView<uint32_t> name_offsets;
+    ArrayView<char> name_chars;
+    ArrayView<uint32_t> name_order;
+    ArrayView<uint32_t> line_name_offsets;
+    ArrayView<char> line_name_chars;
+    ArrayView<uint32_t> line_badge_offsets;
+    ArrayView<char> line_badge_chars;
+    ArrayView<float> station_lat;
+    ArrayView<float> station_lon;
+    ArrayView<LineFare> line_fares;  // per line; empty if the network has no fares
+    uint32_t line_count = 0;
+    // Local equirectangular projection and, per cost mode (time, distance),
+    // the smallest segment cost per straight-line kilometre. All zero when
+    // stations have no coordinates.
+    float km_per_degree_lat = 0;
+    float km_per_degree_lon = 0;
+    float min_cost_per_km[2] = {0, 0};
+    std::shared_ptr<const void> storage;
+    
+    size_t station_count() const { return station_lines.size(); }
+    size_t edge_count() const { return edge_to.size(); }
+    
+    std::string_view name(int station) const {
+        return std::string_view(name_chars.data() + name_offsets[station],
+                                name_offsets[station + 1] - name_offsets[station]);
+    }
+    
+    std::string_view line_name(LineId line) const {
+        return std::string_view(line_name_chars.data() + line_name_offsets[line],
+                                line_name_offsets[line + 1] - line_name_offsets[line]);
+    }
+    
+    std::string_view line_badge(LineId line) const {
+        return std::string_view(line_badge_chars.data() + line_badge_offsets[line],
+                                line_badge_offsets[line + 1] - line_badge_offsets[line]);
+    }
+    
+    double straight_line_km(int a, int b) const {
+        double dy = (station_lat[a] - station_lat[b]) * km_per_degree_lat;
+        double dx = (station_lon[a] - station_lon[b]) * km_per_degree_lon;
+        return std::sqrt(dx * dx + dy * dy);
+    }
+    
+    // Fill the projection and the per-kilometre cost bounds from the
+    // station coordinates and segment weights, or clear them if any station
+    // lacks coordinates. Scaling each bound down slightly keeps it below
+    // every segment's cost despite float rounding.
+    void calibrate_geometry() {
+        km_per_degree_lat = km_per_degree_lon = 0;
+        min_cost_per_km[0] = min_cost_per_km[1] = 0;
+        if (station_lat.empty() || station_lat.size() != station_count()) return;
+        
+        double lat_sum = 0;
+        for (size_t i = 0; i < station_count(); ++i) {
+            if (std::isnan(station_lat[i]) || std::isnan(station_lon[i])) return;
+            lat_sum += station_lat[i];
+        }
+        
+        const double pi = 3.14159265358979323846;
+        km_per_degree_lat = 110.574f;
+        km_per_degree_lon = static_cast<float>(
+            111.320 * std::cos(lat_sum / station_count() * pi / 180.0));
+        
+        double per_km[2] = {INF, INF};
+        for (size_t from = 0; from < station_count(); ++from) {
+            for (uint32_t e = offsets[from]; e < offsets[from + 1]; ++e) {
+                double km = straight_line_km(static_cast<int>(from), edge_to[e]);
+                if (km <= 0) continue;
+                per_km[0] = std::min(per_km[0], edge_time[e] / km);
+                per_km[1] = std::min(per_km[1], edge_distance[e] / km);
+            }
+        }
+        for (int mode = 0; mode < 2; ++mode) {
+            min_cost_per_km[mode] = per_km[mode] == INF ? 0.0f 
+                                                        : static_cast<float>(per_km[mode] * 0.999);
+        }
+    }
+    
+    size_t memory_bytes() const {
+        return (offsets.size() + edge_to.size() + name_offsets.size() + name_order.size() +
+                line_name_offsets.size() + line_badge_offsets.size()) * sizeof(uint32_t) +
+               (edge_time.size() + edge_distance.size()) * sizeof(float) +
+               edge_line.size() + station_lines.size() * sizeof(LineMask) +
+               name_chars.size() + line_name_chars.size() + line_badge_chars.size() +
+               (station_lat.size() + station_lon.size()) * sizeof(float) +
+               line_fares.size() * sizeof(LineFare);
+    }
+    
+    // Index of the station with exactly this name, or -1.
+    int find_station(std::string_view station_name) const {
+        auto it = std::lower_bound(name_order.begin(), name_order.end(), station_name,
+            [&](uint32_t idx, std::string_view key) { return name(idx) < key; });
+        if (it == name_order.end() || name(*it) != station_name) return -1;
+        return static_cast<int>(*it);
+    }
+    
+    // Index of the edge from -> to on the given line, or -1 if there is none.
+    int find_edge(int from, int to, LineId line) const {
+        for (uint32_t e = offsets[from]; e < offsets[from + 1]; ++e) {
+            if (edge_to[e] == static_cast<uint32_t>(to) && 
+                edge_line[e] == static_cast<uint8_t>(line)) {
+                return static_cast<int>(e);
+            }
+        }
+        return -1;
+    }
+};
+
+// Owning arrays behind a NetworkGraph that was built in memory.
+struct NetworkGraphBuffers {
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> edge_to;
+    std::vector<float> edge_time;
+    std::vector<float> edge_distance;
+    std::vector<uint8_t> edge_line;
+    std::vector<LineMask> station_lines;
+    std::vector<uint32_t> name_offsets;
+    std::vector<char> name_chars;
+    std::vector<uint32_t> name_order;
+    std::vector<uint32_t> line_name_offsets;
+    std::vector<char> line_name_chars;
+    std::vector<uint32_t> line_badge_offsets;
+    std::vector<char> line_badge_chars;
+    std::vector<float> station_lat;
+    std::vector<float> station_lon;
+    std::vector<LineFare> line_fares;
+    
+    static NetworkGraph adopt(std::shared_ptr<NetworkGraphBuffers> buffers, uint32_t line_count) {
+        NetworkGraph graph;
+        graph.offsets = buffers->offsets;
+        graph.edge_to = buffers->edge_to;
+        graph.edge_time = buffers->edge_time;
+        graph.edge_distance = buffers->edge_distance;
+        graph.edge_line = buffers->edge_line;
+        graph.station_lines = buffers->station_lines;
+        graph.name_offsets = buffers->name_offsets;
+        graph.name_chars = buffers->name_chars;
+        graph.name_order = buffers->name_order;
+        graph.line_name_offsets = buffers->line_name_offsets;
+        graph.line_name_chars = buffers->line_name_chars;
+        graph.line_badge_offsets = buffers->line_badge_offsets;
+        graph.line_badge_chars = buffers->line_badge_chars;
+        graph.station_lat = buffers->station_lat;
+        graph.station_lon = buffers->station_lon;
+        graph.line_fares = buffers->line_fares;
+        graph.line_count = line_count;
+        graph.storage = std::move(buffers);
+        graph.calibrate_geometry();
+        return graph;
+    }
+};
+
+// All-pairs answers for one cost mode, filled by precompute_routes().
+// For every source the line-aware search tree is stored per
+// (station, line) state as a predecessor station and line, which is
+// enough to unroll any route; the route totals are stored per pair.
+struct RouteTable {
+    constexpr static uint16_t NO_STATION = 0xFFFF;
+    constexpr static uint8_t NO_LINE = 0xFF;
+    
+    size_t stations = 0;
+    size_t lines = 0;
+    ArrayView<uint16_t> parent;
+    ArrayView<uint8_t> parent_line;
+    ArrayView<uint8_t> best_line;
+    ArrayView<float> distance;
+    ArrayView<float> time;
+    ArrayView<uint8_t> interchanges;
+    std::shared_ptr<const void> storage;
+    
+    size_t pair(int source, int target) const {
+        return static_cast<size_t>(source) * stations + target;
+    }
+    
+    size_t state(int source, int station, LineId line) const {
+        return (static_cast<size_t>(source) * stations + station) * lines + 
+               static_cast<size_t>(line);
+    }
+    
+    size_t memory_bytes() const {
+        return parent.size() * sizeof(uint16_t) + parent_line.size() + 
+               best_line.size() + interchanges.size() +
+               (distance.size() + time.size()) * sizeof(float);
+    }
+};
+
+// Owning arrays behind a RouteTable that was computed in memory.
+struct RouteTableBuffers {
+    std::vector<uint16_t> parent;
+    std::vector<uint8_t> parent_line;
+    std::vector<uint8_t> best_line;
+    std::vector<float> distance;
+    std::vector<float> time;
+    std::vector<uint8_t> interchanges;
+    
+    RouteTableBuffers(size_t stations, size_t lines)
+        : parent(stations * stations * lines, RouteTable::NO_STATION),
+          parent_line(stations * stations * lines, RouteTable::NO_LINE),
+          best_line(stations * stations, RouteTable::NO_LINE),
+          distance(stations * stations, 0.0f),
+          time(stations * stations, 0.0f),
+          interchanges(stations * stations, 0) {}
+    
+    // Copy of an existing table, to be repaired row by row.
+    explicit RouteTableBuffers(const RouteTable& table)
+        : parent(table.parent.begin(), table.parent.end()),
+          parent_line(table.parent_line.begin(), table.parent_line.end()),
+          best_line(table.best_line.begin(), table.best_line.end()),
+          distance(table.distance.begin(), table.distance.end()),
+          time(table.time.begin(), table.time.end()),
+          interchanges(table.interchanges.begin(), table.interchanges.end()) {}
+    
+    // Reset the row of one source to "nothing reachable".
+    void clear_source(int source, size_t stations, size_t lines) {
+        size_t pairs = static_cast<size_t>(source) * stations, states = pairs * lines;
+        std::fill_n(parent.begin() + states, stations * lines, RouteTable::NO_STATION);
+        std::fill_n(parent_line.begin() + states, stations * lines, RouteTable::NO_LINE);
+        std::fill_n(best_line.begin() + pairs, stations, RouteTable::NO_LINE);
+        std::fill_n(distance.begin() + pairs, stations, 0.0f);
+        std::fill_n(time.begin() + pairs, stations, 0.0f);
+        std::fill_n(interchanges.begin() + pairs, stations, 0);
+    }
+    
+    static RouteTable adopt(std::shared_ptr<RouteTableBuffers> buffers, 
+                            size_t stations, size_t lines) {
+        RouteTable table;
+        table.stations = stations;
+        table.lines = lines;
+        table.parent = buffers->parent;
+        table.parent_line = buffers->parent_line;
+        table.best_line = buffers->best_line;
+        table.distance = buffers->distance;
+        table.time = buffers->time;
+        table.interchanges = buffers->interchanges;
+        table.storage = std::move(buffers);
+        return table;
+    }
+};
+
+// Contraction hierarchy over the line-expanded network for one cost mode,
+// built by HierarchyBuilder. Its nodes are the (station, line) states: the
+// states of station s are [station_states[s], station_states[s + 1]), one
+// per line serving s, in line order. Riding a segment and changing line
+// are both undirected arcs, so the upward graph stores each arc once, at
+// its lower-ranked end. A shortcut records the node it bypasses; the two
+// arcs it stands for are stored at that node.
+struct ContractionHierarchy {
+    constexpr static uint32_t NO_NODE = 0xFFFFFFFF;
+    
+    ArrayView<uint32_t> station_states;
+    ArrayView<uint32_t> state_station;
+    ArrayView<uint8_t> state_line;
+    ArrayView<uint32_t> up_offsets;
+    ArrayView<uint32_t> up_to;
+    ArrayView<double> up_cost;
+    ArrayView<uint32_t> up_middle;
+    std::shared_ptr<const void> storage;
+    
+    size_t node_count() const { return state_station.size(); }
+    size_t arc_count() const { return up_to.size(); }
+    
+    // Index of the arc joining two adjacent nodes, stored at whichever of
+    // them ranks lower, or -1.
+    int find_arc(uint32_t a, uint32_t b) const {
+        for (uint32_t from : {a, b}) {
+            uint32_t to = from == a ? b : a;
+            for (uint32_t e = up_offsets[from]; e < up_offsets[from + 1]; ++e) {
+                if (up_to[e] == to) return static_cast<int>(e);
+            }
+        }
+        return -1;
+    }
+    
+    size_t memory_bytes() const {
+        return (station_states.size() + state_station.size() + up_offsets.size() + 
+                up_to.size() + up_middle.size()) * sizeof(uint32_t) +
+               state_line.size() + up_cost.size() * sizeof(double);
+    }
+};
+
+// Owning arrays behind a ContractionHierarchy that was built in memory.
+struct ContractionHierarchyBuffers {
+    std::vector<uint32_t> station_states;
+    std::vector<uint32_t> state_station;
+    std::vector<uint8_t> state_line;
+    std::vector<uint32_t> up_offsets;
+    std::vector<uint32_t> up_to;
+    std::vector<double> up_cost;
+    std::vector<uint32_t> up_middle;
+    
+    static ContractionHierarchy adopt(std::shared_ptr<ContractionHierarchyBuffers> buffers) {
+        ContractionHierarchy hierarchy;
+        hierarchy.station_states = buffers->station_states;
+        hierarchy.state_station = buffers->state_station;
+        hierarchy.state_line = buffers->state_line;
+        hierarchy.up_offsets = buffers->up_offsets;
+        hierarchy.up_to = buffers->up_to;
+        hierarchy.up_cost = buffers->up_cost;
+        hierarchy.up_middle = buffers->up_middle;
+        hierarchy.storage = std::move(buffers);
+        return hierarchy;
+    }
+};
+
+// Contracts the line-expanded network for one cost mode. Nodes are taken
+// in order of priority (shortcuts added minus arcs removed, plus how many
+// neighbours are already contracted), re-evaluated lazily when a node
+// reaches the front of the queue. Contracting a node joins each pair of its
+// neighbours with a shortcut unless a bounded witness search finds a path
+// that is no longer; cutting that search short only adds shortcuts, so
+// queries stay exact.
+class HierarchyBuilder {
+public:
+    HierarchyBuilder(const NetworkGraph& graph, const float* weight, double penalty) {
+        size_t n = graph.station_count();
+        buffers = std::make_shared<ContractionHierarchyBuffers>();
+        buffers->station_states.reserve(n + 1);
+        buffers->station_states.push_back(0);
+        for (size_t s = 0; s < n; ++s) {
+            for (LineMask rest = graph.station_lines[s]; rest; rest &= rest - 1) {
+                buffers->state_station.push_back(static_cast<uint32_t>(s));
+                buffers->state_line.push_back(static_cast<uint8_t>(__builtin_ctzll(rest)));
+            }
+            buffers->station_states.push_back(
+                static_cast<uint32_t>(buffers->state_station.size()));
+        }
+        
+        size_t nodes = buffers->state_station.size();
+        adjacent.resize(nodes);
+        contracted_neighbours.assign(nodes, 0);
+        priority.assign(nodes, 0);
+        witness_cost.resize(nodes);
+        witness_stamp.assign(nodes, 0);
+        target_stamp.assign(nodes, 0);
+        
+        auto state = [&](size_t station, LineId line) {
+            LineMask below = graph.station_lines[station] & (line_bit(line) - 1);
+            return buffers->station_states[station] + 
+                   static_cast<uint32_t>(__builtin_popcountll(below));
+        };
+        
+        for (size_t s = 0; s < n; ++s) {
+            for (uint32_t e = graph.offsets[s]; e < graph.offsets[s + 1]; ++e) {
+                if (graph.edge_to[e] == s || !std::isfinite(weight[e])) continue;
+                auto line = static_cast<LineId>(graph.edge_line[e]);
+                connect(state(s, line), state(graph.edge_to[e], line), weight[e],
+                        ContractionHierarchy::NO_NODE);
+            }
+            for (uint32_t a = buffers->station_states[s]; a < buffers->station_states[s + 1]; ++a) {
+                for (uint32_t b = a + 1; b < buffers->station_states[s + 1]; ++b) {
+                    connect(a, b, penalty, ContractionHierarchy::NO_NODE);
+                }
+            }
+        }
+    }
+    
+    ContractionHierarchy build() {
+        using Entry = std::pair<int, uint32_t>;
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+        size_t nodes = adjacent.size();
+        for (uint32_t v = 0; v < nodes; ++v) {
+            priority[v] = evaluate(v);
+            queue.push({priority[v], v});
+        }
+        
+        std::vector<std::vector<Neighbour>> upward(nodes);
+        while (!queue.empty()) {
+            uint32_t v = queue.top().second;
+            queue.pop();
+            
+            priority[v] = evaluate(v);
+            if (!queue.empty() && priority[v] > queue.top().first) {
+                queue.push({priority[v], v});
+                continue;
+            }
+            
+            contract(v, false);
+            for (const Neighbour& next : adjacent[v]) {
+                auto& list = adjacent[next.node];
+                list.erase(std::find_if(list.begin(), list.end(), 
+                    [&](const Neighbour& back) { return back.node == v; }));
+                ++contracted_neighbours[next.node];
+            }
+            upward[v] = std::move(adjacent[v]);
+        }
+        
+        buffers->up_offsets.reserve(nodes + 1);
+        buffers->up_offsets.push_back(0);
+        for (uint32_t v = 0; v < nodes; ++v) {
+            for (const Neighbour& next : upward[v]) {
+                buffers->up_to.push_back(next.node);
+                buffers->up_cost.push_back(next.cost);
+                buffers->up_middle.push_back(next.middle);
+            }
+            buffers->up_offsets.push_back(static_cast<uint32_t>(buffers->up_to.size()));
+        }
+        return ContractionHierarchyBuffers::adopt(std::move(buffers));
+    }
+
+private:
+    // Witness searches settle at most this many nodes when a node is
+    // contracted, and fewer when only estimating its priority.
+    constexpr static size_t WITNESS_SETTLE_LIMIT = 256;
+    constexpr static size_t ESTIMATE_SETTLE_LIMIT = 32;
+    
+    // An arc as seen from one end; both ends keep a copy.
+    struct Neighbour {
+        uint32_t node;
+        uint32_t middle;
+        double cost;
+    };
+    
+    std::shared_ptr<ContractionHierarchyBuffers> buffers;
+    std::vector<std::vector<Neighbour>> adjacent;
+    std::vector<int> contracted_neighbours;
+    std::vector<int> priority;
+    std::vector<double> witness_cost;
+    std::vector<uint32_t> witness_stamp;
+    std::vector<uint32_t> target_stamp;
+    std::vector<std::pair<double, uint32_t>> witness_heap;
+    uint32_t witness_generation = 0;
+    
+    // Join a and b with an arc of the given cost, or lower the cost of the
+    // arc already joining them. Only the cheapest arc between two nodes is
+    // kept, which is what lets a shortcut be unpacked from its middle node.
+    void connect(uint32_t a, uint32_t b, double cost, uint32_t middle) {
+        for (Neighbour& next : adjacent[a]) {
+            if (next.node != b) continue;
+            if (cost < next.cost) {
+                next = {b, middle, cost};
+                for (Neighbour& back : adjacent[b]) {
+                    if (back.node == a) back = {a, middle, cost};
+                }
+            }
+            return;
+        }
+        adjacent[a].push_back({b, middle, cost});
+        adjacent[b].push_back({a, middle, cost});
+    }
+    
+    double witness_at(uint32_t v) const {
+        return witness_stamp[v] == witness_generation ? witness_cost[v] : INF;
+    }
+    
+    // Dijkstra from source over the uncontracted nodes other than skip,
+    // until every node in targets is settled, past `limit` or after
+    // settle_limit settled nodes.
+    void witness_search(uint32_t source, uint32_t skip, double limit,
+                        const Neighbour* targets, size_t target_count, size_t settle_limit) {
+        if (++witness_generation == 0) {
+            std::fill(witness_stamp.begin(), witness_stamp.end(), 0);
+            std::fill(target_stamp.begin(), target_stamp.end(), 0);
+            witness_generation = 1;
+        }
+        for (size_t i = 0; i < target_count; ++i) target_stamp[targets[i].node] = witness_generation;
+        
+        auto later = std::greater<std::pair<double, uint32_t>>();
+        witness_heap.clear();
+        witness_heap.push_back({0.0, source});
+        witness_stamp[source] = witness_generation;
+        witness_cost[source] = 0.0;
+        
+        for (size_t settled = 0; !witness_heap.empty() && settled < settle_limit; ) {
+            std::pop_heap(witness_heap.begin(), witness_heap.end(), later);
+            auto [cost, v] = witness_heap.back();
+            witness_heap.pop_back();
+            if (cost > witness_at(v)) continue;
+            if (cost > limit) break;
+            ++settled;
+            if (target_stamp[v] == witness_generation && --target_count == 0) break;
+            
+            for (const Neighbour& next : adjacent[v]) {
+                if (next.node == skip) continue;
+                double next_cost = cost + next.cost;
+                if (next_cost < witness_at(next.node)) {
+                    witness_stamp[next.node] = witness_generation;
+                    witness_cost[next.node] = next_cost;
+                    witness_heap.push_back({next_cost, next.node});
+                    std::push_heap(witness_heap.begin(), witness_heap.end(), later);
+                }
+            }
+        }
+    }
+    
+    // Shortcuts needed to contract v; added to the graph unless simulating.
+    // Adding shortcuts never touches v's own list.
+    int contract(uint32_t v, bool simulate) {
+        const auto& around = adjacent[v];
+        int shortcuts = 0;
+        for (size_t i = 0; i + 1 < around.size(); ++i) {
+            double longest = 0;
+            for (size_t j = i + 1; j < around.size(); ++j) {
+                longest = std::max(longest, around[j].cost);
+            }
+            
+            witness_search(around[i].node, v, around[i].cost + longest, 
+                           around.data() + i + 1, around.size() - i - 1,
+                           simulate ? ESTIMATE_SETTLE_LIMIT : WITNESS_SETTLE_LIMIT);
+            for (size_t j = i + 1; j < around.size(); ++j) {
+                double through = around[i].cost + around[j].cost;
+                if (witness_at(around[j].node) <= through) continue;
+                ++shortcuts;
+                if (!simulate) connect(around[i].node, around[j].node, through, v);
+            }
+        }
+        return shortcuts;
+    }
+    
+    int evaluate(uint32_t v) {
+        return contract(v, true) - static_cast<int>(adjacent[v].size()) + 
+               contracted_neighbours[v];
+    }
+};
+
+// One line's service pattern: between `start` and `end` (seconds after
+// midnight) a train leaves each end of the line every `headway` seconds.
+struct ServiceBand {
+    LineId line;
+    uint32_t start;
+    uint32_t end;
+    uint32_t headway;
+};
+
+// One train running between two adjacent stations.
+struct Connection {
+    uint32_t departure;
+    uint32_t arrival;
+    uint32_t from;
+    uint32_t to;
+    uint32_t trip;
+};
+
+// Every train of a service day as elementary connections, sorted by
+// departure time for Connection Scan queries; by_arrival lists the same
+// connections in arrival order for arrive-by queries. Times are seconds
+// after midnight and may run past 24:00. Changing trains anywhere but at
+// the origin takes at least transfer_seconds.
+struct Timetable {
+    ArrayView<Connection> connections;
+    ArrayView<uint32_t> by_arrival;
+    ArrayView<uint8_t> trip_line;
+    uint32_t transfer_seconds = 0;
+    std::shared_ptr<const void> storage;
+    
+    size_t trip_count() const { return trip_line.size(); }
+    
+    // Index of the first connection departing at or after `time`.
+    size_t first_departure(uint32_t time) const {
+        return std::lower_bound(connections.begin(), connections.end(), time,
+            [](const Connection& c, uint32_t t) { return c.departure < t; }) - connections.begin();
+    }
+    
+    // Number of connections arriving at or before `time`.
+    size_t arrived_by(uint32_t time) const {
+        return std::upper_bound(by_arrival.begin(), by_arrival.end(), time,
+            [&](uint32_t t, uint32_t c) { return t < connections[c].arrival; }) - by_arrival.begin();
+    }
+    
+    size_t memory_bytes() const {
+        return connections.size() * sizeof(Connection) + 
+               by_arrival.size() * sizeof(uint32_t) + trip_line.size();
+    }
+};
+
+// Owning arrays behind a Timetable that was generated in memory.
+struct TimetableBuffers {
+    std::vector<Connection> connections;
+    std::vector<uint32_t> by_arrival;
+    std::vector<uint8_t> trip_line;
+    
+    static Timetable adopt(std::shared_ptr<TimetableBuffers> buffers, uint32_t transfer_seconds) {
+        Timetable timetable;
+        timetable.connections = buffers->connections;
+        timetable.by_arrival = buffers->by_arrival;
+        timetable.trip_line = buffers->trip_line;
+        timetable.transfer_seconds = transfer_seconds;
+        timetable.storage = std::move(buffers);
+        return timetable;
+    }
+    
+    // Expand service bands into trips. Each line is split into unbranched
+    // runs of segments; every departure of a band sends one train along
+    // each run in each direction, taking the segment's time between
+    // stations and `dwell` seconds at each intermediate stop.
+    static std::shared_ptr<TimetableBuffers> generate(const NetworkGraph& graph,
+                                                      const std::vector<ServiceBand>& services,
+                                                      uint32_t dwell) {
+        auto buffers = std::make_shared<TimetableBuffers>();
+        std::vector<Run> runs[MAX_LINES];
+        for (uint32_t l = 0; l < graph.line_count; ++l) {
+            runs[l] = line_runs(graph, static_cast<LineId>(l));
+        }
+        
+        for (const ServiceBand& band : services) {
+            for (uint32_t t = band.start; t < band.end; t += band.headway) {
+                for (const Run& run : runs[band.line]) {
+                    size_t hops = run.seconds.size();
+                    for (bool reverse : {false, true}) {
+                        auto trip = static_cast<uint32_t>(buffers->trip_line.size());
+                        buffers->trip_line.push_back(band.line);
+                        uint32_t time = t;
+                        for (size_t i = 0; i < hops; ++i) {
+                            size_t hop = reverse ? hops - 1 - i : i;
+                            uint32_t from = run.stations[reverse ? hop + 1 : hop];
+                            uint32_t to = run.stations[reverse ? hop : hop + 1];
+                            buffers->connections.push_back(
+                                {time, time + run.seconds[hop], from, to, trip});
+                            time += run.seconds[hop] + dwell;
+                        }
+                    }
+                }
+            }
+        }
+        
+        sort_connections(*buffers);
+        return buffers;
+    }
+    
+    // The planned timetable on a network whose segment times have moved
+    // from `planned` to `graph`. A train delayed on a segment runs that
+    // much later from there on. One that reaches a closed segment stops
+    // short, and the rest of its run beyond the closure becomes a trip of
+    // its own, so no journey rides through.
+    static std::shared_ptr<TimetableBuffers> reschedule(const Timetable& timetable,
+                                                        const NetworkGraph& planned,
+                                                        const NetworkGraph& graph) {
+        auto buffers = std::make_shared<TimetableBuffers>();
+        buffers->trip_line.assign(timetable.trip_line.begin(), timetable.trip_line.end());
+        size_t trips = timetable.trip_count();
+        std::vector<uint32_t> trip(trips);  // current trip of each planned one
+        std::iota(trip.begin(), trip.end(), 0u);
+        std::vector<uint32_t> late(trips, 0);
+        std::vector<uint8_t> cut(trips, 0);
+        
+        // Connections are in departure order, so each trip's in running order.
+        for (const Connection& c : timetable.connections) {
+            auto line = static_cast<LineId>(timetable.trip_line[c.trip]);
+            int e = graph.find_edge(static_cast<int>(c.from), static_cast<int>(c.to), line);
+            uint32_t delay = 0;
+            if (e >= 0) {
+                float now = graph.edge_time[e], before = planned.edge_time[e];
+                if (now == std::numeric_limits<float>::infinity()) {
+                    cut[c.trip] = 1;
+                    continue;
+                }
+                if (now > before) delay = static_cast<uint32_t>(std::lround((now - before) * 60.0));
+            }
+            if (cut[c.trip]) {
+                cut[c.trip] = 0;
+                trip[c.trip] = static_cast<uint32_t>(buffers->trip_line.size());
+                buffers->trip_line.push_back(line);
+            }
+            
+            Connection moved = c;
+            moved.trip = trip[c.trip];
+            moved.departure += late[c.trip];
+            late[c.trip] += delay;
+            moved.arrival += late[c.trip];
+            buffers->connections.push_back(moved);
+        }
+        sort_connections(*buffers);
+        return buffers;
+    }
+
+private:
+    static void sort_connections(TimetableBuffers& buffers) {
+        auto& connections = buffers.connections;
+        std::sort(connections.begin(), connections.end(), 
+            [](const Connection& a, const Connection& b) {
+                if (a.departure != b.departure) return a.departure < b.departure;
+                return a.arrival < b.arrival;
+            });
+        buffers.by_arrival.resize(connections.size());
+        for (size_t i = 0; i < connections.size(); ++i) {
+            buffers.by_arrival[i] = static_cast<uint32_t>(i);
+        }
+        std::sort(buffers.by_arrival.begin(), buffers.by_arrival.end(),
+            [&](uint32_t a, uint32_t b) {
+                if (connections[a].arrival != connections[b].arrival) {
+                    return connections[a].arrival < connections[b].arrival;
+                }
+                return connections[a].departure < connections[b].departure;
+            });
+    }
+    
+    // Stations along an unbranched stretch of a line and the running time
+    // in seconds between each pair of neighbours.
+    struct Run {
+        std::vector<uint32_t> stations;
+        std::vector<uint32_t> seconds;
+    };
+    
+    // Split a line's segments into maximal unbranched runs. Runs start at
+    // stations where the line ends or branches; what is left over are loops.
+    static std::vector<Run> line_runs(const NetworkGraph& graph, LineId line) {
+        size_t n = graph.station_count();
+        std::vector<uint8_t> degree(n, 0);
+        std::vector<uint8_t> used(graph.edge_count(), 0);
+        for (size_t s = 0; s < n; ++s) {
+            for (uint32_t e = graph.offsets[s]; e < graph.offsets[s + 1]; ++e) {
+                if (graph.edge_line[e] == line && degree[s] < 255) ++degree[s];
+            }
+        }
+        
+        std::vector<Run> runs;
+        auto walk = [&](uint32_t station, uint32_t e) {
+            Run run;
+            run.stations.push_back(station);
+            while (true) {
+                uint32_t next = graph.edge_to[e];
+                used[e] = 1;
+                int back = graph.find_edge(static_cast<int>(next), static_cast<int>(station), line);
+                if (back >= 0) used[back] = 1;
+                run.stations.push_back(next);
+                run.seconds.push_back(static_cast<uint32_t>(
+                    std::max(1L, std::lround(graph.edge_time[e] * 60.0))));
+                station = next;
+                if (degree[station] != 2) break;
+                
+                uint32_t follow = graph.offsets[station + 1];
+                for (uint32_t f = graph.offsets[station]; f < graph.offsets[station + 1]; ++f) {
+                    if (graph.edge_line[f] == line && !used[f]) follow = f;
+                }
+                if (follow == graph.offsets[station + 1]) break;
+                e = follow;
+            }
+            runs.push_back(std::move(run));
+        };
+        
+        for (int pass = 0; pass < 2; ++pass) {
+            for (uint32_t s = 0; s < n; ++s) {
+                if (pass == 0 && degree[s] == 2) continue;
+                for (uint32_t e = graph.offsets[s]; e < graph.offsets[s + 1]; ++e) {
+                    if (graph.edge_line[e] == line && !used[e]) walk(s, e);
+                }
+            }
+        }
+        return runs;
+    }
+};
+
+// Station-name lookup for autocomplete. Names are normalised once (ASCII
+// lower case, runs of punctuation and spaces folded to one space) into a
+// character pool. Prefix matches come from two sorted arrays of name and
+// word starts, substring and typo-tolerant matches from a trigram index,
+// and substrings of queries too short for a trigram from lists of the
+// names holding each character and character pair. Every posting list is
+// in name order, so a scan stops as soon as `limit` matches are certain.
+// A query uses per-thread scratch space, so it allocates nothing beyond
+// its results.
+class StationNameIndex {
+public:
+    // Lower tiers are better matches.
+    enum Tier : uint32_t { EXACT = 0, NAME_PREFIX, WORD_PREFIX, SUBSTRING, FUZZY };
+    
+    struct Match {
+        int station;
+        uint32_t tier;  // FUZZY + edits for typo-tolerant matches
+    };
+    
+    explicit StationNameIndex(const NetworkGraph& graph) {
+        auto n = static_cast<uint32_t>(graph.station_count());
+        std::string normalised;
+        name_offsets.reserve(n + 1);
+        name_offsets.push_back(0);
+        for (uint32_t s = 0; s < n; ++s) {
+            normalise(graph.name(s), normalised);
+            chars.append(normalised);
+            name_offsets.push_back(static_cast<uint32_t>(chars.size()));
+        }
+        
+        for (uint32_t s = 0; s < n; ++s) {
+            std::string_view name = normalised_name(s);
+            for (uint32_t at = 0; at < name.size(); ++at) {
+                if (at == 0) {
+                    names.push_back({s, 0});
+                } else if (name[at - 1] == ' ') {
+                    words.push_back({s, at});
+                }
+            }
+        }
+        std::sort(names.begin(), names.end(), [this](const Start& a, const Start& b) {
+            std::string_view x = suffix(a), y = suffix(b);
+            return x != y ? x < y : a.station < b.station;
+        });
+        rank.resize(n);
+        for (uint32_t r = 0; r < n; ++r) rank[names[r].station] = r;
+        std::sort(words.begin(), words.end(), [this](const Start& a, const Start& b) {
+            std::string_view x = suffix(a), y = suffix(b);
+            return x != y ? x < y : rank[a.station] < rank[b.station];
+        });
+        
+        std::vector<std::pair<uint32_t, uint32_t>> grams, pairs;  // (key, rank)
+        for (uint32_t s = 0; s < n; ++s) {
+            std::string_view name = normalised_name(s);
+            for (size_t i = 0; i < name.size(); ++i) {
+                if (i + 3 <= name.size()) grams.emplace_back(trigram(name.data() + i), rank[s]);
+                pairs.emplace_back(short_gram(name.substr(i, 1)), rank[s]);
+                if (i + 2 <= name.size()) pairs.emplace_back(short_gram(name.substr(i, 2)), rank[s]);
+            }
+        }
+        build_postings(grams, gram_keys, gram_offsets, postings);
+        build_postings(pairs, short_keys, short_offsets, short_postings);
+    }
+    
+    // Up to `limit` matches for `query`, best first: the exact name, names
+    // starting with the query, names with a later word starting with it,
+    // names containing it, and, only when nothing else matched, names within
+    // one edit (two for queries of eight characters or more) of a part of
+    // the name. Fuzzy matching needs at least four characters.
+    size_t search(std::string_view query, size_t limit, std::vector<Match>& out) const {
+        out.clear();
+        Scratch& scratch = thread_scratch();
+        normalise(query, scratch.query);
+        std::string_view q = scratch.query;
+        if (limit == 0 || q.empty()) return 0;
+        
+        out.reserve(limit);
+        scratch.begin(rank.size());
+        scan_prefix(names, q, limit, out, scratch);
+        scan_prefix(words, q, limit, out, scratch);
+        if (q.size() < 3) {
+            if (out.size() < limit) scan_names(q, limit, out, scratch);
+            return out.size();
+        }
+        
+        scratch.grams.clear();
+        for (size_t i = 0; i + 3 <= q.size(); ++i) scratch.grams.push_back(trigram(q.data() + i));
+        std::sort(scratch.grams.begin(), scratch.grams.end());
+        scratch.grams.erase(std::unique(scratch.grams.begin(), scratch.grams.end()), 
+                            scratch.grams.end());
+        
+        if (out.size() < limit) scan_substring(q, limit, out, scratch);
+        if (out.empty() && q.size() >= 4) scan_fuzzy(q, limit, out, scratch);
+        return out.size();
+    }
+    
+    std::string_view normalised_name(uint32_t station) const {
+        return std::string_view(chars).substr(name_offsets[station], 
+                                              name_offsets[station + 1] - name_offsets[station]);
+    }
+    
+    size_t memory_bytes() const {
+        return chars.size() + name_offsets.size() * sizeof(uint32_t) + 
+               (names.size() + words.size()) * sizeof(Start) + rank.size() * sizeof(uint32_t) +
+               (gram_keys.size() + gram_offsets.size() + postings.size() + 
+                short_keys.size() + short_offsets.size() + short_postings.size()) * sizeof(uint32_t);
+    }
+    
+    static void normalise(std::string_view text, std::string& out) {
+        out.clear();
+        bool gap = false;
+        for (char c : text) {
+            auto byte = static_cast<unsigned char>(c);
+            if (byte >= 0x80 || std::isalnum(byte)) {
+                if (gap && !out.empty()) out.push_back(' ');
+                out.push_back(static_cast<char>(std::tolower(byte)));
+                gap = false;
+            } else {
+                gap = true;
+            }
+        }
+    }
+
+private:
+    struct Start {
+        uint32_t station;
+        uint32_t offset;
+    };
+    
+    // Per-thread query state; `seen` and `shared` are stamped per query.
+    struct Scratch {
+        std::string query;
+        std::vector<uint32_t> grams;
+        std::vector<uint32_t> stamp;
+        std::vector<uint32_t> shared;
+        std::vector<uint32_t> candidates;
+        uint64_t peq[256] = {};
+        uint32_t generation = 0;
+        
+        void begin(size_t station_count) {
+            if (stamp.size() < station_count) {
+                stamp.resize(station_count, 0);
+                shared.resize(station_count);
+            }
+            if (++generation == 0) {
+                std::fill(stamp.begin(), stamp.end(), 0);
+                generation = 1;
+            }
+        }
+        
+        bool seen(uint32_t station) const { return stamp[station] == generation; }
+        void mark(uint32_t station) { stamp[station] = generation; }
+    };
+    
+    std::string chars;
+    std::vector<uint32_t> name_offsets;
+    std::vector<Start> names;  // every name, sorted by normalised text
+    std::vector<Start> words;  // every later word start, sorted by text from there on
+    std::vector<uint32_t> rank;  // station -> position in `names`
+    std::vector<uint32_t> gram_keys;
+    std::vector<uint32_t> gram_offsets;
+    std::vector<uint32_t> postings;  // stations per trigram, in name order
+    std::vector<uint32_t> short_keys;
+    std::vector<uint32_t> short_offsets;
+    std::vector<uint32_t> short_postings;  // stations per character and pair, in name order
+    
+    // Trigrams in more names than this are looked up for each fuzzy
+    // candidate rather than scanned for candidates.
+    constexpr static size_t COMMON_GRAM = 1024;
+    // Fuzzy candidates checked with an edit distance, or `limit` if more.
+    constexpr static size_t FUZZY_CHECKS = 128;
+    
+    static Scratch& thread_scratch() {
+        thread_local Scratch scratch;
+        return scratch;
+    }
+    
+    static uint32_t trigram(const char* text) {
+        return static_cast<uint32_t>(static_cast<unsigned char>(text[0])) << 16 |
+               static_cast<uint32_t>(static_cast<unsigned char>(text[1])) << 8 |
+               static_cast<unsigned char>(text[2]);
+    }
+    
+    // One character, or two, as a key that cannot collide: names hold no
+    // NUL bytes.
+    static uint32_t short_gram(std::string_view text) {
+        return static_cast<uint32_t>(static_cast<unsigned char>(text[0])) << 8 |
+               (text.size() > 1 ? static_cast<unsigned char>(text[1]) : 0);
+    }
+    
+    // CSR posting lists from (key, rank) pairs; the lists hold stations.
+    void build_postings(std::vector<std::pair<uint32_t, uint32_t>>& entries, 
+                        std::vector<uint32_t>& keys, std::vector<uint32_t>& offsets,
+                        std::vector<uint32_t>& lists) const {
+        std::sort(entries.begin(), entries.end());
+        entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+        lists.reserve(entries.size());
+        for (const auto& [key, position] : entries) {
+            if (keys.empty() || keys.back() != key) {
+                keys.push_back(key);
+                offsets.push_back(static_cast<uint32_t>(lists.size()));
+            }
+            lists.push_back(names[position].station);
+        }
+        offsets.push_back(static_cast<uint32_t>(lists.size()));
+    }
+    
+    std::string_view suffix(const Start& start) const {
+        return normalised_name(start.station).substr(start.offset);
+    }
+    
+    static ArrayView<uint32_t> find_list(const std::vector<uint32_t>& keys, 
+                                         const std::vector<uint32_t>& offsets,
+                                         const std::vector<uint32_t>& lists, uint32_t key) {
+        auto it = std::lower_bound(keys.begin(), keys.end(), key);
+        if (it == keys.end() || *it != key) return {};
+        size_t k = static_cast<size_t>(it - keys.begin());
+        return {lists.data() + offsets[k], offsets[k + 1] - offsets[k]};
+    }
+    
+    ArrayView<uint32_t> posting_list(uint32_t gram) const {
+        return find_list(gram_keys, gram_offsets, postings, gram);
+    }
+    
+    bool listed(ArrayView<uint32_t> list, uint32_t station) const {
+        return std::binary_search(list.begin(), list.end(), station, 
+            [this](uint32_t a, uint32_t b) { return rank[a] < rank[b]; });
+    }
+    
+    void scan_prefix(const std::vector<Start>& starts, std::string_view q, size_t limit,
+                     std::vector<Match>& out, Scratch& scratch) const {
+        auto it = std::lower_bound(starts.begin(), starts.end(), q, 
+            [this](const Start& start, std::string_view key) { return suffix(start) < key; });
+        for (; it != starts.end() && out.size() < limit; ++it) {
+            std::string_view text = suffix(*it);
+            if (text.compare(0, q.size(), q) != 0) break;
+            if (scratch.seen(it->station)) continue;
+            scratch.mark(it->station);
+            uint32_t tier = it->offset > 0 ? WORD_PREFIX : text.size() == q.size() ? EXACT : NAME_PREFIX;
+            out.push_back({static_cast<int>(it->station), tier});
+        }
+    }
+    
+    // Keep `out` sorted by tier, then alphabetically, and at most `limit` long.
+    void offer(uint32_t station, uint32_t tier, size_t limit, std::vector<Match>& out) const {
+        auto worse = [this, tier, station](const Match& m) {
+            return m.tier != tier ? m.tier > tier : rank[m.station] > rank[station];
+        };
+        auto at = std::find_if(out.begin(), out.end(), worse);
+        if (at == out.end() && out.size() == limit) return;
+        if (out.size() == limit) out.pop_back();
+        out.insert(at, {static_cast<int>(station), tier});
+    }
+    
+    // Stations in every posting list of the query's trigrams, confirmed by
+    // a substring search on the name. The shortest list is walked in name
+    // order until `out` is full of matches at least this good.
+    void scan_substring(std::string_view q, size_t limit, std::vector<Match>& out, 
+                        Scratch& scratch) const {
+        ArrayView<uint32_t> shortest;
+        for (uint32_t gram : scratch.grams) {
+            ArrayView<uint32_t> list = posting_list(gram);
+            if (list.empty()) return;
+            if (shortest.empty() || list.size() < shortest.size()) shortest = list;
+        }
+        for (uint32_t station : shortest) {
+            if (out.size() == limit && out.back().tier <= SUBSTRING) return;
+            if (scratch.seen(station)) continue;
+            bool everywhere = std::all_of(scratch.grams.begin(), scratch.grams.end(), 
+                [&](uint32_t gram) { return listed(posting_list(gram), station); });
+            if (everywhere && normalised_name(station).find(q) != std::string_view::npos) {
+                scratch.mark(station);
+                offer(station, SUBSTRING, limit, out);
+            }
+        }
+    }
+    
+    // Names containing a query too short to have trigrams, from the list
+    // for its character or character pair: no name needs checking, and the
+    // list is in name order, so the first unseen ones are the matches.
+    void scan_names(std::string_view q, size_t limit, std::vector<Match>& out, 
+                    Scratch& scratch) const {
+        for (uint32_t station : find_list(short_keys, short_offsets, short_postings, short_gram(q))) {
+            if (out.size() == limit) return;
+            if (scratch.seen(station)) continue;
+            scratch.mark(station);
+            out.push_back({static_cast<int>(station), SUBSTRING});
+        }
+    }
+    
+    // One edit changes at most three trigrams, so a name within `budget`
+    // edits shares all but 3 * budget of the query's trigrams. Candidates
+    // come from the posting lists of the query's rarer trigrams; a trigram
+    // in more than COMMON_GRAM names is taken to be in every candidate
+    // rather than scanned, as it would visit most of a large network and
+    // tells few names apart. The candidates sharing the most trigrams are
+    // checked first, at most max(limit, FUZZY_CHECKS) of them, with an edit
+    // distance that lets the query start and end anywhere in the name;
+    // checking stops once no candidate left could make the cut.
+    void scan_fuzzy(std::string_view q, size_t limit, std::vector<Match>& out, 
+                    Scratch& scratch) const {
+        if (q.size() > 64) return;
+        uint32_t budget = q.size() >= 8 ? 2 : 1;
+        auto total = static_cast<uint32_t>(scratch.grams.size());
+        uint32_t needed = total > 3 * budget ? total - 3 * budget : 1;
+        
+        ArrayView<uint32_t> shortest_common;
+        uint32_t common = 0;
+        auto& candidates = scratch.candidates;
+        candidates.clear();
+        auto add = [&](uint32_t station) {
+            if (scratch.seen(station)) return;
+            scratch.mark(station);
+            scratch.shared[station] = 0;
+            candidates.push_back(station);
+        };
+        for (uint32_t gram : scratch.grams) {
+            ArrayView<uint32_t> list = posting_list(gram);
+            if (list.size() > COMMON_GRAM) {
+                ++common;
+                if (shortest_common.empty() || list.size() < shortest_common.size()) {
+                    shortest_common = list;
+                }
+                continue;
+            }
+            for (uint32_t station : list) {
+                add(station);
+                ++scratch.shared[station];
+            }
+        }
+        size_t checks = std::max(limit, FUZZY_CHECKS);
+        // Only common trigrams: the first names of the shortest list stand in.
+        if (candidates.empty()) {
+            for (size_t i = 0; i < shortest_common.size() && i < checks; ++i) {
+                add(shortest_common[i]);
+            }
+        }
+        
+        size_t kept = 0;
+        for (uint32_t station : candidates) {
+            scratch.shared[station] += common;  // at most
+            if (scratch.shared[station] >= needed) candidates[kept++] = station;
+        }
+        candidates.resize(kept);
+        checks = std::min(checks, kept);
+        std::partial_sort(candidates.begin(), candidates.begin() + checks, candidates.end(),
+            [&](uint32_t a, uint32_t b) {
+                if (scratch.shared[a] != scratch.shared[b]) return scratch.shared[a] > scratch.shared[b];
+                return rank[a] < rank[b];
+            });
+        
+        for (char c : q) scratch.peq[static_cast<unsigned char>(c)] = 0;
+        for (size_t i = 0; i < q.size(); ++i) {
+            scratch.peq[static_cast<unsigned char>(q[i])] |= uint64_t(1) << i;
+        }
+        for (size_t i = 0; i < checks; ++i) {
+            uint32_t station = candidates[i];
+            uint32_t fewest = (total - scratch.shared[station] + 2) / 3;  // edits, at least
+            if (out.size() == limit && out.back().tier < FUZZY + fewest) break;
+            uint32_t edits = infix_distance(q.size(), normalised_name(station), scratch.peq);
+            if (edits <= budget) offer(station, FUZZY + edits, limit, out);
+        }
+        for (char c : q) scratch.peq[static_cast<unsigned char>(c)] = 0;
+    }
+    
+    // Fewest edits turning a query of m <= 64 characters into some substring
+    // of `text`, with Myers' bit-parallel edit distance: `peq` holds, for
+    // every byte, the mask of query positions where it occurs, and each
+    // text character updates a whole column of the dynamic programme in a
+    // few word operations.
+    static uint32_t infix_distance(size_t m, std::string_view text, const uint64_t* peq) {
+        uint64_t positive = ~uint64_t(0), negative = 0;
+        uint64_t last = uint64_t(1) << (m - 1);
+        auto score = static_cast<uint32_t>(m), best = score;
+        for (char c : text) {
+            uint64_t eq = peq[static_cast<unsigned char>(c)];
+            uint64_t xv = eq | negative;
+            uint64_t xh = (((eq & positive) + positive) ^ positive) | eq;
+            uint64_t up = negative | ~(xh | positive);
+            uint64_t down = positive & xh;
+            if (up & last) {
+                ++score;
+            } else if (down & last) {
+                --score;
+            }
+            up <<= 1;
+            down <<= 1;
+            positive = down | ~(xv | up);
+            negative = up & xv;
+            best = std::min(best, score);
+        }
+        return best;
+    }
+};
+
+// Station listings: every station in name order, and the stations of each
+// line in name order, as one array per line in the manner of CSR.
+class StationLists {
+public:
+    explicit StationLists(const NetworkGraph& graph) {
+        by_name.reserve(graph.station_count());
+        for (uint32_t station : graph.name_order) by_name.emplace_back(static_cast<int>(station));
+        
+        line_offsets.assign(graph.line_count + 1, 0);
+        for (LineMask lines : graph.station_lines) {
+            for (LineMask rest = lines; rest; rest &= rest - 1) ++line_offsets[__builtin_ctzll(rest) + 1];
+        }
+        for (size_t l = 0; l < graph.line_count; ++l) line_offsets[l + 1] += line_offsets[l];
+        
+        by_line.resize(line_offsets.back());
+        std::vector<uint32_t> next(line_offsets.begin(), line_offsets.end() - 1);
+        for (StationId station : by_name) {
+            LineMask lines = graph.station_lines[station.index()];
+            for (LineMask rest = lines; rest; rest &= rest - 1) {
+                by_line[next[__builtin_ctzll(rest)]++] = station;
+            }
+        }
+    }
+    
+    ArrayView<StationId> all() const { return by_name; }
+    
+    ArrayView<StationId> on_line(LineId line) const {
+        return ArrayView<StationId>(by_line.data() + line_offsets[line], 
+                                    line_offsets[line + 1] - line_offsets[line]);
+    }
+
+private:
+    std::vector<StationId> by_name;
+    std::vector<uint32_t> line_offsets;
+    std::vector<StationId> by_line;
+};
+
+// Read-only private mapping of a whole file, unmapped on destruction.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open network image '" + path + "'");
+        }
+        
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+            ::close(fd);
+            throw std::runtime_error("cannot read network image '" + path + "'");
+        }
+        
+        len = static_cast<size_t>(st.st_size);
+        void* mapped = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            throw std::runtime_error("cannot map network image '" + path + "'");
+        }
+        base = static_cast<const unsigned char*>(mapped);
+    }
+    
+    ~MappedFile() {
+        if (base) ::munmap(const_cast<unsigned char*>(base), len);
+    }
+    
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    const unsigned char* data() const { return base; }
+    size_t size() const { return len; }
+    
+private:
+    const unsigned char* base = nullptr;
+    size_t len = 0;
+};
+
+// Versioned binary image of a frozen network and, optionally, its
+// timetable, route tables and contraction hierarchies. The file is a
+// header, a section table and 64-byte aligned sections that hold the
+// NetworkGraph / RouteTable arrays verbatim, so loading is an mmap plus
+// checks: nothing is parsed or copied. How much is checked is up to the
+// caller (see Checks): by default every index the arrays hold, so that a
+// damaged or crafted file is rejected rather than read out of bounds.
+class NetworkImage {
+public:
+    constexpr static char MAGIC[8] = {'P', 'M', 'E', 'T', 'R', 'O', '\r', '\n'};
+    constexpr static uint32_t VERSION = 2;
+    constexpr static uint32_t ENDIAN_TAG = 0x01020304;
+    constexpr static size_t ALIGNMENT = 64;
+    
+    // What load() checks beyond the header and the section table, which
+    // are always checked. STRUCTURE reads every index in the arrays, one
+    // pass over nearly every page of the file: on a 10k-station image
+    // that is milliseconds against microseconds for the mmap alone.
+    // CHECKSUM also hashes every byte (FNV-1a over everything after the
+    // header). TRUSTED skips both, for images this program wrote and
+    // nothing else can have changed; a damaged one is then read out of
+    // bounds.
+    enum class Checks : uint8_t { TRUSTED, STRUCTURE, CHECKSUM };
+    
+    enum SectionId : uint32_t {
+        OFFSETS = 1,
+        EDGE_TO,
+        EDGE_TIME,
+        EDGE_DISTANCE,
+        EDGE_LINE,
+        STATION_LINES,
+        NAME_OFFSETS,
+        NAME_CHARS,
+        NAME_ORDER,
+        LINE_NAME_OFFSETS,
+        LINE_NAME_CHARS,
+        LINE_BADGE_OFFSETS,
+        LINE_BADGE_CHARS,
+        STATION_LAT,
+        STATION_LON,
+        GEOMETRY,
+        TIMETABLE_CONNECTIONS,
+        TIMETABLE_BY_ARRIVAL,
+        TIMETABLE_TRIP_LINE,
+        TIMETABLE_TRANSFER,
+        LINE_FARES,
+        // Route table sections: ROUTES_TIME/ROUTES_DISTANCE + field.
+        ROUTES_TIME = 0x100,
+        ROUTES_DISTANCE = 0x200,
+        // Contraction hierarchy sections: HIERARCHY_TIME/HIERARCHY_DISTANCE + field.
+        HIERARCHY_TIME = 0x300,
+        HIERARCHY_DISTANCE = 0x400,
+    };
+    
+    enum RouteField : uint32_t {
+        ROUTE_PARENT,
+        ROUTE_PARENT_LINE,
+        ROUTE_BEST_LINE,
+        ROUTE_DISTANCE,
+        ROUTE_TIME,
+        ROUTE_INTERCHANGES,
+        ROUTE_FIELD_COUNT
+    };
+    
+    enum HierarchyField : uint32_t {
+        HIERARCHY_STATION_STATES,
+        HIERARCHY_STATE_STATION,
+        HIERARCHY_STATE_LINE,
+        HIERARCHY_UP_OFFSETS,
+        HIERARCHY_UP_TO,
+        HIERARCHY_UP_COST,
+        HIERARCHY_UP_MIDDLE,
+        HIERARCHY_FIELD_COUNT
+    };
+    
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t endian_tag;
+        uint32_t station_count;
+        uint32_t edge_count;
+        uint32_t line_count;
+        uint32_t section_count;
+        uint64_t file_size;
+        uint64_t checksum;
+    };
+    
+    struct Section {
+        uint32_t id;
+        uint32_t element_size;
+        uint64_t offset;
+        uint64_t bytes;
+    };
+    
+    NetworkGraph graph;
+    std::unique_ptr<Timetable> timetable;
+    std::unique_ptr<RouteTable> routes[2];
+    std::unique_ptr<ContractionHierarchy> hierarchies[2];
+    
+    static uint64_t checksum(const unsigned char* data, size_t size) {
+        uint64_t hash = 1469598103934665603ull;
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ data[i]) * 1099511628211ull;
+        }
+        return hash;
+    }
+    
+    static void save(const std::string& path, const NetworkGraph& graph, const Timetable* timetable,
+                     const RouteTable* time_routes, const RouteTable* distance_routes,
+                     const ContractionHierarchy* time_hierarchy = nullptr,
+                     const ContractionHierarchy* distance_hierarchy = nullptr) {
+        std::vector<Section> sections;
+        std::vector<const void*> payloads;
+        uint64_t offset = 0;
+        
+        auto add = [&](uint32_t id, const auto& view) {
+            using T = std::decay_t<decltype(view[0])>;
+            sections.push_back({id, static_cast<uint32_t>(sizeof(T)), 0, 
+                                view.size() * sizeof(T)});
+            payloads.push_back(view.data());
+        };
+        
+        add(OFFSETS, graph.offsets);
+        add(EDGE_TO, graph.edge_to);
+        add(EDGE_TIME, graph.edge_time);
+        add(EDGE_DISTANCE, graph.edge_distance);
+        add(EDGE_LINE, graph.edge_line);
+        add(STATION_LINES, graph.station_lines);
+        add(NAME_OFFSETS, graph.name_offsets);
+        add(NAME_CHARS, graph.name_chars);
+        add(NAME_ORDER, graph.name_order);
+        add(LINE_NAME_OFFSETS, graph.line_name_offsets);
+        add(LINE_NAME_CHARS, graph.line_name_chars);
+        add(LINE_BADGE_OFFSETS, graph.line_badge_offsets);
+        add(LINE_BADGE_CHARS, graph.line_badge_chars);
+        
+        const float geometry[4] = {graph.km_per_degree_lat, graph.km_per_degree_lon,
+                                   graph.min_cost_per_km[0], graph.min_cost_per_km[1]};
+        if (!graph.station_lat.empty()) {
+            add(STATION_LAT, graph.station_lat);
+            add(STATION_LON, graph.station_lon);
+            add(GEOMETRY, ArrayView<float>(geometry, 4));
+        }
+        if (!graph.line_fares.empty()) add(LINE_FARES, graph.line_fares);
+        
+        if (timetable) {
+            add(TIMETABLE_CONNECTIONS, timetable->connections);
+            add(TIMETABLE_BY_ARRIVAL, timetable->by_arrival);
+            add(TIMETABLE_TRIP_LINE, timetable->trip_line);
+            add(TIMETABLE_TRANSFER, ArrayView<uint32_t>(&timetable->transfer_seconds, 1));
+        }
+        
+        const RouteTable* tables[2] = {time_routes, distance_routes};
+        for (int mode = 0; mode < 2; ++mode) {
+            if (!tables[mode]) continue;
+            uint32_t base = mode == 0 ? ROUTES_TIME : ROUTES_DISTANCE;
+            add(base + ROUTE_PARENT, tables[mode]->parent);
+            add(base + ROUTE_PARENT_LINE, tables[mode]->parent_line);
+            add(base + ROUTE_BEST_LINE, tables[mode]->best_line);
+            add(base + ROUTE_DISTANCE, tables[mode]->distance);
+            add(base + ROUTE_TIME, tables[mode]->time);
+            add(base + ROUTE_INTERCHANGES, tables[mode]->interchanges);
+        }
+        
+        const ContractionHierarchy* hierarchies[2] = {time_hierarchy, distance_hierarchy};
+        for (int mode = 0; mode < 2; ++mode) {
+            if (!hierarchies[mode]) continue;
+            uint32_t base = mode == 0 ? HIERARCHY_TIME : HIERARCHY_DISTANCE;
+            add(base + HIERARCHY_STATION_STATES, hierarchies[mode]->station_states);
+            add(base + HIERARCHY_STATE_STATION, hierarchies[mode]->state_station);
+            add(base + HIERARCHY_STATE_LINE, hierarchies[mode]->state_line);
+            add(base + HIERARCHY_UP_OFFSETS, hierarchies[mode]->up_offsets);
+            add(base + HIERARCHY_UP_TO, hierarchies[mode]->up_to);
+            add(base + HIERARCHY_UP_COST, hierarchies[mode]->up_cost);
+            add(base + HIERARCHY_UP_MIDDLE, hierarchies[mode]->up_middle);
+        }
+        
+        offset = align(sizeof(Header) + sections.size() * sizeof(Section));
+        for (auto& section : sections) {
+            section.offset = offset;
+            offset = align(offset + section.bytes);
+        }
+        
+        std::vector<unsigned char> image(offset, 0);
+        Header header = {};
+        std::copy(std::begin(MAGIC), std::end(MAGIC), header.magic);
+        header.version = VERSION;
+        header.endian_tag = ENDIAN_TAG;
+        header.station_count = static_cast<uint32_t>(graph.station_count());
+        header.edge_count = static_cast<uint32_t>(graph.edge_count());
+        header.line_count = graph.line_count;
+        header.section_count = static_cast<uint32_t>(sections.size());
+        header.file_size = offset;
+        
+        std::memcpy(image.data() + sizeof(Header), sections.data(), 
+                    sections.size() * sizeof(Section));
+        for (size_t i = 0; i < sections.size(); ++i) {
+            if (sections[i].bytes > 0) {
+                std::memcpy(image.data() + sections[i].offset, payloads[i], sections[i].bytes);
+            }
+        }
+        header.checksum = checksum(image.data() + sizeof(Header), image.size() - sizeof(Header));
+        std::memcpy(image.data(), &header, sizeof(Header));
+        
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(image.data()), 
+                  static_cast<std::streamsize>(image.size()));
+        if (!out) {
+            throw std::runtime_error("cannot write network image '" + path + "'");
+        }
+    }
+    
+    static NetworkImage load(const std::string& path, Checks checks = Checks::STRUCTURE) {
+        auto file = std::make_shared<const MappedFile>(path);
+        const unsigned char* base = file->data();
+        size_t size = file->size();
+        
+        Header header;
+        if (size < sizeof(Header)) fail(path, "truncated header");
+        std::memcpy(&header, base, sizeof(Header));
+        
+        if (!std::equal(std::begin(MAGIC), std::end(MAGIC), header.magic)) fail(path, "bad magic");
+        if (header.endian_tag != ENDIAN_TAG) fail(path, "byte order mismatch");
+        if (header.version != VERSION) fail(path, "unsupported version");
+        if (header.file_size != size) fail(path, "size mismatch");
+        if (header.section_count > (size - sizeof(Header)) / sizeof(Section)) {
+            fail(path, "truncated section table");
+        }
+        if (checks == Checks::CHECKSUM && 
+            checksum(base + sizeof(Header), size - sizeof(Header)) != header.checksum) {
+            fail(path, "checksum mismatch");
+        }
+        
+        const auto* sections = reinterpret_cast<const Section*>(base + sizeof(Header));
+        auto find = [&](uint32_t id) -> const Section* {
+            for (uint32_t i = 0; i < header.section_count; ++i) {
+                if (sections[i].id == id) return &sections[i];
+            }
+            return nullptr;
+        };
+        
+        auto view = [&](uint32_t id, auto* type, size_t expected, bool required) {
+            using T = std::remove_pointer_t<decltype(type)>;
+            const Section* section = find(id);
+            if (!section) {
+                if (required) fail(path, "missing section " + std::to_string(id));
+                return ArrayView<T>();
+            }
+            if (section->element_size != sizeof(T) || section->offset % alignof(T) != 0 ||
+                section->offset > size || section->bytes > size - section->offset ||
+                section->bytes != expected * sizeof(T)) {
+                fail(path, "malformed section " + std::to_string(id));
+            }
+            return ArrayView<T>(reinterpret_cast<const T*>(base + section->offset), expected);
+        };
+        
+        size_t n = header.station_count;
+        size_t m = header.edge_count;
+        size_t lines = header.line_count;
+        if (lines > MAX_LINES) fail(path, "too many lines");
+        
+        auto pool_bytes = [&](uint32_t id) {
+            const Section* section = find(id);
+            return section ? section->bytes : 0;
+        };
+        size_t name_bytes = pool_bytes(NAME_CHARS);
+        size_t line_name_bytes = pool_bytes(LINE_NAME_CHARS);
+        size_t line_badge_bytes = pool_bytes(LINE_BADGE_CHARS);
+        
+        NetworkImage image;
+        NetworkGraph& graph = image.graph;
+        graph.offsets = view(OFFSETS, (uint32_t*)nullptr, n + 1, true);
+        graph.edge_to = view(EDGE_TO, (uint32_t*)nullptr, m, true);
+        graph.edge_time = view(EDGE_TIME, (float*)nullptr, m, true);
+        graph.edge_distance = view(EDGE_DISTANCE, (float*)nullptr, m, true);
+        graph.edge_line = view(EDGE_LINE, (uint8_t*)nullptr, m, true);
+        graph.station_lines = view(STATION_LINES, (LineMask*)nullptr, n, true);
+        graph.name_offsets = view(NAME_OFFSETS, (uint32_t*)nullptr, n + 1, true);
+        graph.name_chars = view(NAME_CHARS, (char*)nullptr, name_bytes, true);
+        graph.name_order = view(NAME_ORDER, (uint32_t*)nullptr, n, true);
+        graph.line_name_offsets = view(LINE_NAME_OFFSETS, (uint32_t*)nullptr, lines + 1, true);
+        graph.line_name_chars = view(LINE_NAME_CHARS, (char*)nullptr, line_name_bytes, true);
+        graph.line_badge_offsets = view(LINE_BADGE_OFFSETS, (uint32_t*)nullptr, lines + 1, true);
+        graph.line_badge_chars = view(LINE_BADGE_CHARS, (char*)nullptr, line_badge_bytes, true);
+        graph.station_lat = view(STATION_LAT, (float*)nullptr, n, false);
+        graph.station_lon = view(STATION_LON, (float*)nullptr, n, false);
+        ArrayView<float> geometry = view(GEOMETRY, (float*)nullptr, 4, false);
+        if (!geometry.empty() && graph.station_lat.size() == n && graph.station_lon.size() == n) {
+            graph.km_per_degree_lat = geometry[0];
+            graph.km_per_degree_lon = geometry[1];
+            graph.min_cost_per_km[0] = geometry[2];
+            graph.min_cost_per_km[1] = geometry[3];
+        }
+        graph.line_fares = view(LINE_FARES, (LineFare*)nullptr, lines, false);
+        graph.line_count = header.line_count;
+        graph.storage = file;
+        
+        if (graph.offsets[n] != m || graph.name_offsets[n] != name_bytes ||
+            graph.line_name_offsets[lines] != line_name_bytes ||
+            graph.line_badge_offsets[lines] != line_badge_bytes) {
+            fail(path, "inconsistent section sizes");
+        }
+        const bool deep = checks != Checks::TRUSTED;
+        if (deep) check_graph(path, graph);
+        
+        if (find(TIMETABLE_CONNECTIONS)) {
+            size_t connections = pool_bytes(TIMETABLE_CONNECTIONS) / sizeof(Connection);
+            auto timetable = std::make_unique<Timetable>();
+            timetable->connections = 
+                view(TIMETABLE_CONNECTIONS, (Connection*)nullptr, connections, true);
+            timetable->by_arrival = 
+                view(TIMETABLE_BY_ARRIVAL, (uint32_t*)nullptr, connections, true);
+            timetable->trip_line = view(TIMETABLE_TRIP_LINE, (uint8_t*)nullptr, 
+                                        pool_bytes(TIMETABLE_TRIP_LINE), true);
+            timetable->transfer_seconds = 
+                view(TIMETABLE_TRANSFER, (uint32_t*)nullptr, 1, true)[0];
+            timetable->storage = file;
+            if (deep) check_timetable(path, *timetable, n, lines);
+            image.timetable = std::move(timetable);
+        }
+        
+        for (int mode = 0; mode < 2; ++mode) {
+            uint32_t base_id = mode == 0 ? ROUTES_TIME : ROUTES_DISTANCE;
+            if (!find(base_id + ROUTE_PARENT)) continue;
+            
+            if (n >= RouteTable::NO_STATION) fail(path, "too many stations for a route table");
+            size_t states = n * n * lines;
+            auto table = std::make_unique<RouteTable>();
+            table->stations = n;
+            table->lines = header.line_count;
+            table->parent = view(base_id + ROUTE_PARENT, (uint16_t*)nullptr, states, true);
+            table->parent_line = view(base_id + ROUTE_PARENT_LINE, (uint8_t*)nullptr, states, true);
+            table->best_line = view(base_id + ROUTE_BEST_LINE, (uint8_t*)nullptr, n * n, true);
+            table->distance = view(base_id + ROUTE_DISTANCE, (float*)nullptr, n * n, true);
+            table->time = view(base_id + ROUTE_TIME, (float*)nullptr, n * n, true);
+            table->interchanges = view(base_id + ROUTE_INTERCHANGES, (uint8_t*)nullptr, n * n, true);
+            table->storage = file;
+            if (deep) check_routes(path, *table);
+            image.routes[mode] = std::move(table);
+        }
+        
+        for (int mode = 0; mode < 2; ++mode) {
+            uint32_t base_id = mode == 0 ? HIERARCHY_TIME : HIERARCHY_DISTANCE;
+            if (!find(base_id + HIERARCHY_STATION_STATES)) continue;
+            
+            auto hierarchy = std::make_unique<ContractionHierarchy>();
+            hierarchy->station_states = 
+                view(base_id + HIERARCHY_STATION_STATES, (uint32_t*)nullptr, n + 1, true);
+            size_t nodes = hierarchy->station_states[n];
+            if (nodes > n * lines) fail(path, "inconsistent hierarchy");
+            hierarchy->state_station = 
+                view(base_id + HIERARCHY_STATE_STATION, (uint32_t*)nullptr, nodes, true);
+            hierarchy->state_line = 
+                view(base_id + HIERARCHY_STATE_LINE, (uint8_t*)nullptr, nodes, true);
+            hierarchy->up_offsets = 
+                view(base_id + HIERARCHY_UP_OFFSETS, (uint32_t*)nullptr, nodes + 1, true);
+            size_t arcs = hierarchy->up_offsets[nodes];
+            hierarchy->up_to = view(base_id + HIERARCHY_UP_TO, (uint32_t*)nullptr, arcs, true);
+            hierarchy->up_cost = view(base_id + HIERARCHY_UP_COST, (double*)nullptr, arcs, true);
+            hierarchy->up_middle = 
+                view(base_id + HIERARCHY_UP_MIDDLE, (uint32_t*)nullptr, arcs, true);
+            hierarchy->storage = file;
+            if (deep) check_hierarchy(path, *hierarchy, graph);
+            image.hierarchies[mode] = std::move(hierarchy);
+        }
+        
+        return image;
+    }
+
+private:
+    static uint64_t align(uint64_t offset) {
+        return (offset + ALIGNMENT - 1) & ~static_cast<uint64_t>(ALIGNMENT - 1);
+    }
+    
+    [[noreturn]] static void fail(const std::string& path, const std::string& reason) {
+        throw std::runtime_error("invalid network image '" + path + "': " + reason);
+    }
+    
+    // Offsets into another array: starting at 0 and never decreasing.
+    static bool offsets_valid(ArrayView<uint32_t> offsets) {
+        if (offsets.empty() || offsets[0] != 0) return false;
+        for (size_t i = 1; i < offsets.size(); ++i) {
+            if (offsets[i] < offsets[i - 1]) return false;
+        }
+        return true;
+    }
+    
+    static bool weight_valid(float weight) { return weight >= 0; }  // INF closes a segment
+    
+    // Every segment joins two stations on a line that serves both, names
+    // are listed once each in order, and coordinates are usable whenever
+    // the A* bounds are on.
+    static void check_graph(const std::string& path, const NetworkGraph& graph) {
+        size_t n = graph.station_count();
+        uint32_t lines = graph.line_count;
+        LineMask all_lines = lines == MAX_LINES ? ~LineMask(0) : line_bit(lines) - 1;
+        if (!offsets_valid(graph.offsets) || !offsets_valid(graph.name_offsets) ||
+            !offsets_valid(graph.line_name_offsets) || !offsets_valid(graph.line_badge_offsets)) {
+            fail(path, "offsets out of order");
+        }
+        for (size_t s = 0; s < n; ++s) {
+            if (graph.station_lines[s] & ~all_lines) fail(path, "station on an unknown line");
+            for (uint32_t e = graph.offsets[s]; e < graph.offsets[s + 1]; ++e) {
+                if (graph.edge_to[e] >= n || graph.edge_line[e] >= lines) {
+                    fail(path, "segment to an unknown station or line");
+                }
+                LineMask line = line_bit(graph.edge_line[e]);
+                if (!(graph.station_lines[s] & line) || 
+                    !(graph.station_lines[graph.edge_to[e]] & line)) {
+                    fail(path, "segment on a line that does not serve its stations");
+                }
+                if (!weight_valid(graph.edge_time[e]) || !weight_valid(graph.edge_distance[e])) {
+                    fail(path, "negative segment weight");
+                }
+            }
+        }
+        
+        std::vector<bool> listed(n, false);
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t station = graph.name_order[i];
+            if (station >= n || listed[station]) fail(path, "name order is not a permutation");
+            listed[station] = true;
+            if (i > 0 && !(graph.name(graph.name_order[i - 1]) < graph.name(station))) {
+                fail(path, "names out of order");
+            }
+        }
+        
+        if (graph.km_per_degree_lat != 0 || graph.km_per_degree_lon != 0) {
+            const float factors[4] = {graph.km_per_degree_lat, graph.km_per_degree_lon,
+                                      graph.min_cost_per_km[0], graph.min_cost_per_km[1]};
+            for (float factor : factors) {
+                if (!std::isfinite(factor) || factor < 0) fail(path, "bad geometry");
+            }
+            for (size_t s = 0; s < n; ++s) {
+                if (!std::isfinite(graph.station_lat[s]) || !std::isfinite(graph.station_lon[s])) {
+                    fail(path, "bad station coordinates");
+                }
+            }
+        }
+    }
+    
+    // Connections run forward in time between known stations on known
+    // trips, in departure order, and by_arrival orders all of them by
+    // arrival.
+    static void check_timetable(const std::string& path, const Timetable& timetable, 
+                                size_t n, size_t lines) {
+        const auto& connections = timetable.connections;
+        for (uint8_t line : timetable.trip_line) {
+            if (line >= lines) fail(path, "trip on an unknown line");
+        }
+        for (size_t i = 0; i < connections.size(); ++i) {
+            const Connection& c = connections[i];
+            if (c.from >= n || c.to >= n || c.trip >= timetable.trip_count()) {
+                fail(path, "connection between unknown stations or on an unknown trip");
+            }
+            if (c.arrival < c.departure || (i > 0 && c.departure < connections[i - 1].departure)) {
+                fail(path, "connections out of order");
+            }
+        }
+        
+        std::vector<bool> listed(connections.size(), false);
+        for (size_t k = 0; k < timetable.by_arrival.size(); ++k) {
+            uint32_t i = timetable.by_arrival[k];
+            if (i >= connections.size() || listed[i]) {
+                fail(path, "arrival order is not a permutation");
+            }
+            listed[i] = true;
+            if (k > 0 && 
+                connections[i].arrival < connections[timetable.by_arrival[k - 1]].arrival) {
+                fail(path, "connections out of arrival order");
+            }
+        }
+    }
+    
+    // The route to every reachable pair unrolls back to its source: each
+    // (station, line) state on the way has a parent state, and none repeats.
+    // A state is visited once per source, so this is linear in the table.
+    static void check_routes(const std::string& path, const RouteTable& table) {
+        size_t n = table.stations, lines = table.lines;
+        enum : uint8_t { UNKNOWN, VISITING, REACHES_SOURCE };
+        std::vector<uint8_t> status(n * lines);
+        std::vector<size_t> chain;
+        
+        for (size_t source = 0; source < n; ++source) {
+            std::fill(status.begin(), status.end(), UNKNOWN);
+            for (size_t station = 0; station < n; ++station) {
+                uint8_t best = table.best_line[table.pair(static_cast<int>(source), 
+                                                          static_cast<int>(station))];
+                if (best == RouteTable::NO_LINE || station == source) continue;
+                if (best >= lines) fail(path, "route on an unknown line");
+                
+                chain.clear();
+                size_t at = station, line = best;
+                while (at != source && status[at * lines + line] == UNKNOWN) {
+                    status[at * lines + line] = VISITING;
+                    chain.push_back(at * lines + line);
+                    size_t s = table.state(static_cast<int>(source), static_cast<int>(at), 
+                                           static_cast<LineId>(line));
+                    at = table.parent[s];
+                    line = table.parent_line[s];
+                    if (at >= n || line >= lines) fail(path, "route tree leaves the network");
+                }
+                if (at != source && status[at * lines + line] == VISITING) {
+                    fail(path, "route tree has a cycle");
+                }
+                for (size_t state : chain) status[state] = REACHES_SOURCE;
+            }
+        }
+    }
+    
+    // States match the lines serving each station, arcs join known nodes
+    // with usable costs, the upward graph is acyclic, and each shortcut's
+    // middle node has arcs up to both of its ends, so unpacking a shortcut
+    // always finds its two halves and ends.
+    static void check_hierarchy(const std::string& path, const ContractionHierarchy& ch,
+                                const NetworkGraph& graph) {
+        size_t n = graph.station_count(), nodes = ch.node_count();
+        if (!offsets_valid(ch.station_states) || !offsets_valid(ch.up_offsets)) {
+            fail(path, "hierarchy offsets out of order");
+        }
+        for (size_t s = 0; s < n; ++s) {
+            uint32_t v = ch.station_states[s];
+            bool matches = true;
+            for (LineMask rest = graph.station_lines[s]; rest && matches; rest &= rest - 1, ++v) {
+                matches = v < ch.station_states[s + 1] && ch.state_station[v] == s &&
+                          ch.state_line[v] == __builtin_ctzll(rest);
+            }
+            if (!matches || v != ch.station_states[s + 1]) {
+                fail(path, "hierarchy states do not match the stations");
+            }
+        }
+        
+        std::vector<uint32_t> below(nodes, 0);  // arcs into each node not yet ordered
+        for (size_t e = 0; e < ch.arc_count(); ++e) {
+            if (ch.up_to[e] >= nodes || !(ch.up_cost[e] >= 0)) fail(path, "bad hierarchy arc");
+            ++below[ch.up_to[e]];
+        }
+        std::vector<uint32_t> order;
+        order.reserve(nodes);
+        for (uint32_t v = 0; v < nodes; ++v) {
+            if (below[v] == 0) order.push_back(v);
+        }
+        for (size_t i = 0; i < order.size(); ++i) {
+            for (uint32_t e = ch.up_offsets[order[i]]; e < ch.up_offsets[order[i] + 1]; ++e) {
+                if (--below[ch.up_to[e]] == 0) order.push_back(ch.up_to[e]);
+            }
+        }
+        if (order.size() != nodes) fail(path, "hierarchy has a cycle");
+        
+        // Shortcuts grouped by middle node, each checked against the nodes
+        // its middle node has arcs up to, marked in `above`.
+        std::vector<uint32_t> group(nodes + 1, 0);
+        for (uint32_t middle : ch.up_middle) {
+            if (middle == ContractionHierarchy::NO_NODE) continue;
+            if (middle >= nodes) fail(path, "shortcut without its halves");
+            ++group[middle + 1];
+        }
+        for (size_t v = 0; v < nodes; ++v) group[v + 1] += group[v];
+        std::vector<std::pair<uint32_t, uint32_t>> shortcuts(group[nodes]);  // (from, to)
+        std::vector<uint32_t> filled(group.begin(), group.end() - 1);
+        for (uint32_t v = 0; v < nodes; ++v) {
+            for (uint32_t e = ch.up_offsets[v]; e < ch.up_offsets[v + 1]; ++e) {
+                uint32_t middle = ch.up_middle[e];
+                if (middle != ContractionHierarchy::NO_NODE) {
+                    shortcuts[filled[middle]++] = {v, ch.up_to[e]};
+                }
+            }
+        }
+        std::vector<uint32_t> above(nodes, ContractionHierarchy::NO_NODE);
+        for (uint32_t middle = 0; middle < nodes; ++middle) {
+            for (uint32_t e = ch.up_offsets[middle]; e < ch.up_offsets[middle + 1]; ++e) {
+                above[ch.up_to[e]] = middle;
+            }
+            for (uint32_t i = group[middle]; i < group[middle + 1]; ++i) {
+                if (above[shortcuts[i].first] != middle || above[shortcuts[i].second] != middle) {
+                    fail(path, "shortcut without its halves");
+                }
+            }
+        }
+    }
+};
+
+// Fixed set of worker threads for data-parallel loops. parallel_for splits
+// the index range evenly over the workers (the calling thread is worker 0);
+// a worker that runs out steals the upper half of another worker's
+// remaining range. Each range is a packed [begin, end) pair in one atomic,
+// so taking and stealing work are single compare-and-swaps.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(unsigned thread_count) : slots(std::max(thread_count, 1u)) {
+        for (unsigned i = 1; i < slots.size(); ++i) {
+            threads.emplace_back([this, i] { worker_loop(i); });
+        }
+    }
+    
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) thread.join();
+    }
+    
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+    
+    unsigned size() const { return static_cast<unsigned>(slots.size()); }
+    
+    // Call fn(worker, index) for every index in [0, count) and wait for all
+    // of them. Workers take `grain` indices at a time. Calls from different
+    // threads are serialised; fn must not call parallel_for itself.
+    template <typename Fn>
+    void parallel_for(size_t count, Fn&& fn, size_t grain = 1) {
+        if (count == 0) return;
+        if (count > std::numeric_limits<uint32_t>::max()) {
+            throw std::length_error("parallel_for supports at most 2^32 - 1 indices");
+        }
+        
+        std::lock_guard<std::mutex> serial(submit_mutex);
+        using F = std::remove_reference_t<Fn>;
+        
+        size_t workers = slots.size();
+        for (size_t w = 0; w < workers; ++w) {
+            slots[w].range.store(pack(count * w / workers, count * (w + 1) / workers));
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job_context = const_cast<void*>(static_cast<const void*>(&fn));
+            job_invoke = [](void* ctx, unsigned worker, size_t begin, size_t end) {
+                F& f = *static_cast<F*>(ctx);
+                for (size_t i = begin; i < end; ++i) f(worker, i);
+            };
+            job_grain = std::max<size_t>(grain, 1);
+            job_error = nullptr;
+            pending = workers - 1;
+            ++generation;
+        }
+        wake.notify_all();
+        
+        run_job(0);
+        
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return pending == 0; });
+        if (job_error) std::rethrow_exception(job_error);
+    }
+    
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> range{0};
+    };
+    
+    static uint64_t pack(size_t begin, size_t end) {
+        return (static_cast<uint64_t>(begin) << 32) | static_cast<uint64_t>(end);
+    }
+    
+    // Claim up to `grain` indices from the front of a slot's range.
+    bool take(Slot& slot, size_t grain, size_t& begin, size_t& end) {
+        uint64_t range = slot.range.load(std::memory_order_relaxed);
+        while (true) {
+            size_t b = range >> 32, e = range & 0xFFFFFFFFu;
+            if (b >= e) return false;
+            size_t n = std::min(grain, e - b);
+            if (slot.range.compare_exchange_weak(range, pack(b + n, e))) {
+                begin = b;
+                end = b + n;
+                return true;
+            }
+        }
+    }
+    
+    // Move the upper half of the fullest other slot into our own slot.
+    bool steal(unsigned self) {
+        size_t workers = slots.size();
+        for (size_t k = 1; k < workers; ++k) {
+            Slot& victim = slots[(self + k) % workers];
+            uint64_t range = victim.range.load(std::memory_order_relaxed);
+            while (true) {
+                size_t b = range >> 32, e = range & 0xFFFFFFFFu;
+                if (b >= e) break;
+                size_t mid = b + (e - b) / 2;
+                if (victim.range.compare_exchange_weak(range, pack(b, mid))) {
+                    slots[self].range.store(pack(mid, e));
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+    
+    void run_job(unsigned self) {
+        size_t begin, end;
+        try {
+            do {
+                while (take(slots[self], job_grain, begin, end)) {
+                    job_invoke(job_context, self, begin, end);
+                }
+            } while (steal(self));
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!job_error) job_error = std::current_exception();
+            // Drain the remaining work so the other workers finish quickly.
+            for (auto& slot : slots) slot.range.store(0);
+        }
+    }
+    
+    void worker_loop(unsigned self) {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            
+            run_job(self);
+            
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0) done.notify_one();
+        }
+    }
+    
+    std::vector<Slot> slots;
+    std::vector<std::thread> threads;
+    std::mutex submit_mutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    void* job_context = nullptr;
+    void (*job_invoke)(void*, unsigned, size_t, size_t) = nullptr;
+    size_t job_grain = 1;
+    std::exception_ptr job_error;
+    size_t pending = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+};
+
+// One flat JSON object of scalar members, the unit of the line protocols.
+// String values are unescaped; numbers, booleans and null keep their
+// source spelling. Nested objects and arrays are rejected. Views returned
+// by find() stay valid until the next parse().
+class JsonFields {
+public:
+    struct Field {
+        std::string_view key;
+        std::string_view value;
+        std::string_view raw;  // the value as written, quotes included
+        bool string;
+    };
+    
+    bool parse(std::string_view line) {
+        fields.clear();
+        text.clear();
+        text.reserve(line.size());  // unescaping never grows, so views stay put
+        size_t at = 0;
+        skip_space(line, at);
+        if (at == line.size() || line[at++] != '{') return false;
+        skip_space(line, at);
+        if (at < line.size() && line[at] == '}') return trailing_space(line, ++at);
+        
+        while (true) {
+            Field field;
+            if (!parse_string(line, at, field.key)) return false;
+            skip_space(line, at);
+            if (at == line.size() || line[at++] != ':') return false;
+            skip_space(line, at);
+            size_t begin = at;
+            field.string = at < line.size() && line[at] == '"';
+            if (field.string) {
+                if (!parse_string(line, at, field.value)) return false;
+            } else {
+                while (at < line.size() && (std::isalnum(static_cast<unsigned char>(line[at])) ||
+                                            line[at] == '-' || line[at] == '+' || line[at] == '.')) {
+                    ++at;
+                }
+                field.value = line.substr(begin, at - begin);
+                if (!valid_literal(field.value)) return false;
+            }
+            field.raw = line.substr(begin, at - begin);
+            fields.push_back(field);
+            
+            skip_space(line, at);
+            if (at == line.size()) return false;
+            char c = line[at++];
+            if (c == '}') return trailing_space(line, at);
+            if (c != ',') return false;
+            skip_space(line, at);
+        }
+    }
+    
+    const Field* find(std::string_view key) const {
+        for (const auto& field : fields) {
+            if (field.key == key) return &field;
+        }
+        return nullptr;
+    }
+    
+    static void append_string(std::string& out, std::string_view value) {
+        out.push_back('"');
+        for (char c : value) {
+            if (c == '"' || c == '\\') {
+                out.push_back('\\');
+                out.push_back(c);
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+                out.append(escaped);
+            } else {
+                out.push_back(c);
+            }
+        }
+        out.push_back('"');
+    }
+    
+    static void append_number(std::string& out, double value, int decimals) {
+        char number[32];
+        auto [last, ec] = std::to_chars(number, number + sizeof(number), value, 
+                                        std::chars_format::fixed, decimals);
+        out.append(number, ec == std::errc() ? last : number);
+    }
+
+private:
+    std::string text;
+    std::vector<Field> fields;
+    
+    static void skip_space(std::string_view line, size_t& at) {
+        while (at < line.size() && (line[at] == ' ' || line[at] == '\t' || line[at] == '\r')) ++at;
+    }
+    
+    static bool trailing_space(std::string_view line, size_t at) {
+        skip_space(line, at);
+        return at == line.size();
+    }
+    
+    static bool valid_literal(std::string_view value) {
+        if (value == "true" || value == "false" || value == "null") return true;
+        double number;
+        auto [last, ec] = std::from_chars(value.data(), value.data() + value.size(), number);
+        return !value.empty() && ec == std::errc() && last == value.data() + value.size();
+    }
+    
+    static bool hex4(std::string_view line, size_t at, uint32_t& code) {
+        if (line.size() - at < 4) return false;
+        auto [last, ec] = std::from_chars(line.data() + at, line.data() + at + 4, code, 16);
+        return ec == std::errc() && last == line.data() + at + 4;
+    }
+    
+    void append_utf8(uint32_t code) {
+        if (code < 0x80) {
+            text.push_back(static_cast<char>(code));
+        } else if (code < 0x800) {
+            text.push_back(static_cast<char>(0xC0 | code >> 6));
+            text.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        } else if (code < 0x10000) {
+            text.push_back(static_cast<char>(0xE0 | code >> 12));
+            text.push_back(static_cast<char>(0x80 | (code >> 6 & 0x3F)));
+            text.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        } else {
+            text.push_back(static_cast<char>(0xF0 | code >> 18));
+            text.push_back(static_cast<char>(0x80 | (code >> 12 & 0x3F)));
+            text.push_back(static_cast<char>(0x80 | (code >> 6 & 0x3F)));
+            text.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        }
+    }
+    
+    bool parse_string(std::string_view line, size_t& at, std::string_view& out) {
+        if (at == line.size() || line[at] != '"') return false;
+        size_t begin = text.size();
+        for (++at; at < line.size(); ++at) {
+            char c = line[at];
+            if (c == '"') {
+                ++at;
+                out = std::string_view(text).substr(begin);
+                return true;
+            }
+            if (static_cast<unsigned char>(c) < 0x20) return false;
+            if (c != '\\') {
+                text.push_back(c);
+                continue;
+            }
+            if (++at == line.size()) return false;
+            switch (line[at]) {
+                case '"': case '\\': case '/': text.push_back(line[at]); break;
+                case 'b': text.push_back('\b'); break;
+                case 'f': text.push_back('\f'); break;
+                case 'n': text.push_back('\n'); break;
+                case 'r': text.push_back('\r'); break;
+                case 't': text.push_back('\t'); break;
+                case 'u': {
+                    uint32_t code;
+                    if (!hex4(line, at + 1, code)) return false;
+                    at += 4;
+                    if (code >= 0xD800 && code < 0xDC00) {
+                        uint32_t low;
+                        if (line.substr(at + 1, 2) != "\\u" || !hex4(line, at + 3, low) ||
+                            low < 0xDC00 || low >= 0xE000) {
+                            return false;
+                        }
+                        at += 6;
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    } else if (code >= 0xDC00 && code < 0xE000) {
+                        return false;
+                    }
+                    append_utf8(code);
+                    break;
+                }
+                default: return false;
+            }
+        }
+        return false;
+    }
+};
+
+// Latency distribution with bounded memory: values below 16 are counted
+// exactly, larger ones in 16 buckets per power of two, so percentiles are
+// within about 6% in any unit.
+class LatencyHistogram {
+public:
+    // Values are in whatever unit the owner picks. Only one thread may
+    // record into a histogram, but any thread may read or merge from it
+    // meanwhile.
+    void record(uint64_t value) {
+        bump(counts[bucket(value)], 1);
+        bump(total, 1);
+        bump(value_sum, value);
+    }
+    
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return value_sum.load(std::memory_order_relaxed); }
+    
+    // Upper bound of the bucket holding the q-quantile, 0 <= q <= 1.
+    uint64_t percentile(double q) const {
+        uint64_t recorded = count();
+        if (recorded == 0) return 0;
+        auto rank = static_cast<uint64_t>(std::ceil(q * static_cast<double>(recorded)));
+        uint64_t seen = 0;
+        for (size_t b = 0; b < BUCKETS; ++b) {
+            seen += counts[b].load(std::memory_order_relaxed);
+            if (seen >= std::max<uint64_t>(rank, 1)) return upper_bound(b);
+        }
+        return upper_bound(BUCKETS - 1);
+    }
+    
+    void merge(const LatencyHistogram& other) {
+        for (size_t b = 0; b < BUCKETS; ++b) {
+            bump(counts[b], other.counts[b].load(std::memory_order_relaxed));
+        }
+        bump(total, other.count());
+        bump(value_sum, other.sum());
+    }
+
+private:
+    constexpr static size_t SUB_BUCKETS = 16;
+    constexpr static size_t BUCKETS = SUB_BUCKETS * 61;
+    
+    // Relaxed loads and stores cost the same as plain ones; with a single
+    // writer no read-modify-write is needed.
+    std::atomic<uint64_t> counts[BUCKETS] = {};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> value_sum{0};
+    
+    static void bump(std::atomic<uint64_t>& counter, uint64_t by) {
+        counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+    
+    static size_t bucket(uint64_t value) {
+        if (value < SUB_BUCKETS) return static_cast<size_t>(value);
+        int exponent = 63 - __builtin_clzll(value);  // >= 4
+        size_t sub = static_cast<size_t>(value >> (exponent - 4)) - SUB_BUCKETS;
+        return std::min(BUCKETS - 1, static_cast<size_t>(exponent - 3) * SUB_BUCKETS + sub);
+    }
+    
+    static uint64_t upper_bound(size_t b) {
+        if (b < SUB_BUCKETS) return b;
+        size_t exponent = b / SUB_BUCKETS + 3, sub = b % SUB_BUCKETS;
+        return ((SUB_BUCKETS + sub + 1) << (exponent - 4)) - 1;
+    }
+};
+
+// What the searches on one workspace have done, counted only when metrics
+// are compiled in. EngineMetrics::Probe charges the growth over a query to
+// the query.
+struct SearchCounters {
+    uint64_t pushes = 0;
+    uint64_t pops = 0;
+    uint64_t stale_pops = 0;  // entries a cheaper label had superseded
+    uint64_t relaxations = 0;
+    uint64_t allocations = 0;  // times a workspace array had to grow
+    uint64_t peak_queue = 0;  // largest queue so far; never reset
+};
+
+// Process-wide query metrics: per query kind, a latency histogram in
+// nanoseconds and the SearchCounters of the searches the queries ran.
+// Every thread accumulates into a shard of its own, with relaxed stores
+// and no locking; readers sum the shards, which are linked into a
+// lock-free list and kept after their thread exits so that no counts are
+// lost. Without PUNE_METRO_METRICS everything here is a no-op.
+class EngineMetrics {
+public:
+    enum Query : size_t { ROUTE_TIME, ROUTE_DISTANCE, ALTERNATIVES, PARETO, JOURNEY, QUERY_KINDS };
+    
+    // Times a query from construction to destruction and charges it, with
+    // what the given workspaces counted meanwhile, to the calling thread.
+    class Probe {
+    public:
+        explicit Probe(Query query, const SearchCounters* first = nullptr, 
+                       const SearchCounters* second = nullptr) {
+            if constexpr (METRICS_ENABLED) {
+                kind = query;
+                sources[0] = first;
+                sources[1] = second;
+                for (int i = 0; i < 2; ++i) {
+                    if (sources[i]) before[i] = *sources[i];
+                }
+                start = std::chrono::steady_clock::now();
+            }
+        }
+        
+        ~Probe() {
+            if constexpr (METRICS_ENABLED) {
+                if (dismissed) return;
+                auto elapsed = std::chrono::steady_clock::now() - start;
+                Shard& shard = local_shard();
+                shard.latency[kind].record(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+                auto* totals = shard.counters[kind];
+                for (int i = 0; i < 2; ++i) {
+                    if (!sources[i]) continue;
+                    const SearchCounters& now = *sources[i];
+                    bump(totals[PUSHES], now.pushes - before[i].pushes);
+                    bump(totals[POPS], now.pops - before[i].pops);
+                    bump(totals[STALE_POPS], now.stale_pops - before[i].stale_pops);
+                    bump(totals[RELAXATIONS], now.relaxations - before[i].relaxations);
+                    bump(totals[ALLOCATIONS], now.allocations - before[i].allocations);
+                    if (now.peak_queue > totals[PEAK_QUEUE].load(std::memory_order_relaxed)) {
+                        totals[PEAK_QUEUE].store(now.peak_queue, std::memory_order_relaxed);
+                    }
+                }
+            }
+        }
+        
+        Probe(const Probe&) = delete;
+        Probe& operator=(const Probe&) = delete;
+        
+        // Charge nothing after all, as when a cache lookup missed and the
+        // search that follows is probed itself.
+        void dismiss() {
+            if constexpr (METRICS_ENABLED) dismissed = true;
+        }
+        
+    private:
+        Query kind = ROUTE_TIME;
+        bool dismissed = false;
+        const SearchCounters* sources[2] = {nullptr, nullptr};
+        SearchCounters before[2];
+        std::chrono::steady_clock::time_point start;
+    };
+    
+    static const char* query_name(Query query) {
+        static const char* const names[QUERY_KINDS] = 
+            {"route_time", "route_distance", "alternatives", "pareto", "journey"};
+        return names[query];
+    }
+    
+    // Latencies of one query kind over every thread so far.
+    static void merge_latency(Query query, LatencyHistogram& into) {
+        for (const Shard* shard = shards.load(std::memory_order_acquire); shard; 
+             shard = shard->next) {
+            into.merge(shard->latency[query]);
+        }
+    }
+    
+    // Everything in the Prometheus text exposition format: a summary of
+    // the latency in seconds and a family per counter, labelled by query
+    // kind. Empty without PUNE_METRO_METRICS.
+    static std::string prometheus() {
+        if constexpr (!METRICS_ENABLED) return std::string();
+        
+        std::ostringstream out;
+        out << std::setprecision(9);
+        out << "# HELP pune_metro_query_seconds Query latency, route cache hits included.\n"
+            << "# TYPE pune_metro_query_seconds summary\n";
+        for (size_t q = 0; q < QUERY_KINDS; ++q) {
+            auto query = static_cast<Query>(q);
+            LatencyHistogram latency;
+            merge_latency(query, latency);
+            for (double quantile : {0.5, 0.9, 0.99, 0.999}) {
+                out << "pune_metro_query_seconds{kind=\"" << query_name(query) 
+                    << "\",quantile=\"" << quantile << "\"} " 
+                    << latency.percentile(quantile) * 1e-9 << "\n";
+            }
+            out << "pune_metro_query_seconds_sum{kind=\"" << query_name(query) << "\"} " 
+                << latency.sum() * 1e-9 << "\n"
+                << "pune_metro_query_seconds_count{kind=\"" << query_name(query) << "\"} " 
+                << latency.count() << "\n";
+        }
+        
+        static const char* const counters[COUNTER_KINDS][3] = {
+            {"pune_metro_search_pushes_total", "counter", "States pushed onto a search queue."},
+            {"pune_metro_search_pops_total", "counter", "States popped from a search queue."},
+            {"pune_metro_search_stale_pops_total", "counter", 
+             "Popped states that a cheaper label had superseded."},
+            {"pune_metro_search_relaxations_total", "counter", "Segments relaxed."},
+            {"pune_metro_search_allocations_total", "counter", "Workspace arrays grown."},
+            {"pune_metro_search_peak_queue", "gauge", "Largest search queue so far."},
+        };
+        for (size_t c = 0; c < COUNTER_KINDS; ++c) {
+            out << "# HELP " << counters[c][0] << " " << counters[c][2] << "\n"
+                << "# TYPE " << counters[c][0] << " " << counters[c][1] << "\n";
+            for (size_t q = 0; q < QUERY_KINDS; ++q) {
+                out << counters[c][0] << "{kind=\"" << query_name(static_cast<Query>(q)) << "\"} " 
+                    << counter(static_cast<Query>(q), static_cast<Counter>(c)) << "\n";
+            }
+        }
+        return out.str();
+    }
+
+private:
+    enum Counter : size_t { 
+        PUSHES, POPS, STALE_POPS, RELAXATIONS, ALLOCATIONS, PEAK_QUEUE, COUNTER_KINDS 
+    };
+    
+    struct Shard {
+        std::atomic<uint64_t> counters[QUERY_KINDS][COUNTER_KINDS] = {};
+        LatencyHistogram latency[QUERY_KINDS];
+        Shard* next = nullptr;
+    };
+    
+    static inline std::atomic<Shard*> shards{nullptr};
+    
+    static Shard& local_shard() {
+        thread_local Shard* shard = [] {
+            auto* created = new Shard();  // never freed; see the class comment
+            created->next = shards.load(std::memory_order_relaxed);
+            while (!shards.compare_exchange_weak(created->next, created, 
+                                                 std::memory_order_release,
+                                                 std::memory_order_relaxed)) {}
+            return created;
+        }();
+        return *shard;
+    }
+    
+    static uint64_t counter(Query query, Counter which) {
+        uint64_t value = 0;
+        for (const Shard* shard = shards.load(std::memory_order_acquire); shard; 
+             shard = shard->next) {
+            uint64_t v = shard->counters[query][which].load(std::memory_order_relaxed);
+            value = which == PEAK_QUEUE ? std::max(value, v) : value + v;
+        }
+        return value;
+    }
+    
+    static void bump(std::atomic<uint64_t>& counter, uint64_t by) {
+        counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+};
+
+// Priority queue of search states: smallest key first, ties broken by
+// station and then line. Three layouts, picked per query:
+//   BINARY_HEAP  binary heap with lazy deletion; a state whose key drops
+//                is pushed again and its old entry is later popped stale.
+//   DARY_HEAP    indexed 4-ary heap with decrease-key; one entry per state.
+//   RADIX_HEAP   radix heap on keys in fixed point (1/1024 of a minute or
+//                kilometre); a push is a bucket append and an entry moves
+//                down at most 64 buckets in its life. Keys pushed must not
+//                be below the last key popped, which holds for Dijkstra and
+//                for A* with a consistent heuristic; smaller ones are
+//                treated as equal to it.
+// All three pop states in exactly the same order, so the layout never
+// changes a route. Slots identify states for decrease-key.
+class SearchQueue {
+public:
+    enum class Kind : uint8_t { BINARY_HEAP, DARY_HEAP, RADIX_HEAP };
+    
+    constexpr static double FIXED_POINT_SCALE = 1024.0;
+    
+    struct Entry {
+        double cost;
+        int station;
+        LineId line;
+        
+        bool operator>(const Entry& other) const {
+            if (cost != other.cost) return cost > other.cost;
+            if (station != other.station) return station > other.station;
+            return line > other.line;
+        }
+    };
+    
+    static const char* kind_name(Kind kind) {
+        switch (kind) {
+            case Kind::BINARY_HEAP: return "binary heap";
+            case Kind::DARY_HEAP: return "4-ary heap";
+            case Kind::RADIX_HEAP: return "radix heap";
+        }
+        return "?";
+    }
+    
+    // Empty the queue for a search over `slots` states.
+    void reset(Kind queue_kind, size_t slots) {
+        kind = queue_kind;
+        count = 0;
+        heap.clear();
+        if (kind == Kind::DARY_HEAP) {
+            nodes.clear();
+            if (position_stamp.size() < slots) {
+                position.resize(slots);
+                position_stamp.resize(slots, 0);
+            }
+            if (++generation == 0) {
+                std::fill(position_stamp.begin(), position_stamp.end(), 0);
+                generation = 1;
+            }
+        } else if (kind == Kind::RADIX_HEAP) {
+            buckets[0].clear();
+            for (; occupied; occupied &= occupied - 1) buckets[bucket_above(occupied)].clear();
+            last = 0;
+        }
+    }
+    
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+    
+    // Capacity the next push may have to grow, for allocation counts.
+    bool full() const {
+        switch (kind) {
+            case Kind::BINARY_HEAP: return heap.size() == heap.capacity();
+            case Kind::DARY_HEAP: return nodes.size() == nodes.capacity();
+            case Kind::RADIX_HEAP: return false;
+        }
+        return false;
+    }
+    
+    // Smallest key, or INF when empty.
+    double top_key() {
+        if (count == 0) return INF;
+        switch (kind) {
+            case Kind::BINARY_HEAP: return heap.front().cost;
+            case Kind::DARY_HEAP: return nodes.front().entry.cost;
+            case Kind::RADIX_HEAP: settle_minimum(); return buckets[0].front().cost;
+        }
+        return INF;
+    }
+    
+    void push(const Entry& entry, size_t slot) {
+        ++pushes;
+        switch (kind) {
+            case Kind::BINARY_HEAP:
+                heap.push_back(entry);
+                std::push_heap(heap.begin(), heap.end(), std::greater<Entry>());
+                ++count;
+                break;
+            case Kind::DARY_HEAP:
+                push_indexed(entry, slot);
+                break;
+            case Kind::RADIX_HEAP: {
+                uint64_t key = std::max(fixed_point(entry.cost), last);
+                size_t b = bucket_of(key);
+                buckets[b].push_back(entry);
+                if (b == 0) {
+                    std::push_heap(buckets[0].begin(), buckets[0].end(), std::greater<Entry>());
+                } else {
+                    occupied |= uint64_t(1) << (b - 1);
+                }
+                ++count;
+                break;
+            }
+        }
+    }
+    
+    Entry pop() {
+        ++pops;
+        --count;
+        switch (kind) {
+            case Kind::BINARY_HEAP: {
+                std::pop_heap(heap.begin(), heap.end(), std::greater<Entry>());
+                Entry top = heap.back();
+                heap.pop_back();
+                return top;
+            }
+            case Kind::DARY_HEAP:
+                return pop_indexed();
+            case Kind::RADIX_HEAP: {
+                settle_minimum();
+                auto& minimum = buckets[0];
+                std::pop_heap(minimum.begin(), minimum.end(), std::greater<Entry>());
+                Entry top = minimum.back();
+                minimum.pop_back();
+                return top;
+            }
+        }
+        return Entry{};
+    }
+    
+    // Room for the binary heap; the other layouts grow as they are used.
+    void reserve(size_t entries) { heap.reserve(entries); }
+    
+    // Running totals over every search, for benchmarks. A pop that the
+    // search skips as stale is still a pop.
+    uint64_t pushes = 0;
+    uint64_t pops = 0;
+
+private:
+    constexpr static uint32_t NOT_QUEUED = 0xFFFFFFFF;
+    constexpr static size_t ARITY = 4;
+    
+    struct Node {
+        Entry entry;
+        uint32_t slot;
+    };
+    
+    Kind kind = Kind::BINARY_HEAP;
+    size_t count = 0;
+    
+    std::vector<Entry> heap;
+    
+    std::vector<Node> nodes;
+    std::vector<uint32_t> position;  // of each slot in nodes, or NOT_QUEUED
+    std::vector<uint32_t> position_stamp;
+    uint32_t generation = 0;
+    
+    // Bucket 0 holds the keys equal to `last` as a heap in Entry order;
+    // bucket b > 0 the keys whose highest bit differing from `last` is
+    // bit b - 1.
+    std::vector<Entry> buckets[65];
+    uint64_t occupied = 0;  // bit b - 1 set while bucket b > 0 has entries
+    uint64_t last = 0;
+    
+    static uint64_t fixed_point(double cost) {
+        return static_cast<uint64_t>(cost * FIXED_POINT_SCALE);
+    }
+    
+    size_t bucket_of(uint64_t key) const {
+        return key == last ? 0 : 64 - static_cast<size_t>(__builtin_clzll(key ^ last));
+    }
+    
+    // Lowest bucket above 0 with entries, given a non-zero occupied mask.
+    static size_t bucket_above(uint64_t mask) {
+        return static_cast<size_t>(__builtin_ctzll(mask)) + 1;
+    }
+    
+    // Refill bucket 0 from the lowest non-empty bucket if it ran empty.
+    // Every entry of that bucket moves to a lower one.
+    void settle_minimum() {
+        if (!buckets[0].empty()) return;
+        size_t b = bucket_above(occupied);
+        occupied &= occupied - 1;
+        
+        auto& source = buckets[b];
+        last = UINT64_MAX;
+        for (const Entry& entry : source) last = std::min(last, fixed_point(entry.cost));
+        for (const Entry& entry : source) {
+            size_t to = bucket_of(fixed_point(entry.cost));
+            buckets[to].push_back(entry);
+            if (to > 0) occupied |= uint64_t(1) << (to - 1);
+        }
+        source.clear();
+        std::make_heap(buckets[0].begin(), buckets[0].end(), std::greater<Entry>());
+    }
+    
+    void place(size_t at, const Node& node) {
+        nodes[at] = node;
+        position[node.slot] = static_cast<uint32_t>(at);
+    }
+    
+    void sift_up(size_t at, Node node) {
+        while (at > 0) {
+            size_t parent = (at - 1) / ARITY;
+            if (!(nodes[parent].entry > node.entry)) break;
+            place(at, nodes[parent]);
+            at = parent;
+        }
+        place(at, node);
+    }
+    
+    void sift_down(size_t at, Node node) {
+        size_t size = nodes.size();
+        while (true) {
+            size_t first = at * ARITY + 1;
+            if (first >= size) break;
+            size_t best = first;
+            size_t end = std::min(first + ARITY, size);
+            for (size_t child = first + 1; child < end; ++child) {
+                if (nodes[best].entry > nodes[child].entry) best = child;
+            }
+            if (!(node.entry > nodes[best].entry)) break;
+            place(at, nodes[best]);
+            at = best;
+        }
+        place(at, node);
+    }
+    
+    void push_indexed(const Entry& entry, size_t slot) {
+        if (position_stamp[slot] != generation) {
+            position_stamp[slot] = generation;
+            position[slot] = NOT_QUEUED;
+        }
+        uint32_t at = position[slot];
+        if (at == NOT_QUEUED) {
+            nodes.push_back({entry, static_cast<uint32_t>(slot)});
+            ++count;
+            sift_up(nodes.size() - 1, nodes.back());
+        } else if (nodes[at].entry > entry) {
+            sift_up(at, {entry, static_cast<uint32_t>(slot)});
+        }
+    }
+    
+    Entry pop_indexed() {
+        Node top = nodes.front();
+        position[top.slot] = NOT_QUEUED;
+        Node tail = nodes.back();
+        nodes.pop_back();
+        if (!nodes.empty()) sift_down(0, tail);
+        return top.entry;
+    }
+};
+
+// A batch of disruptions for MetroSystem::updated(). Each change puts the
+// selected segments, in both directions, into one state: closed, running
+// a fixed number of minutes slower than planned, or as planned; the last
+// change to a segment wins. A line of -1 selects every line between the
+// two stations. Closing a station closes every segment that touches it.
+// Stations are checked when the update is applied.
+class NetworkUpdate {
+public:
+    enum class Action : uint8_t { CLOSE, DELAY, RESTORE };
+    enum class Scope : uint8_t { SEGMENT, STATION, LINE };
+    
+    struct Change {
+        Scope scope;
+        Action action;
+        int from;  // station index; the station, for STATION; unused for LINE
+        int to;
+        int line;
+        float minutes;
+    };
+    
+    NetworkUpdate& close_segment(StationId from, StationId to, int line = -1) {
+        return add({Scope::SEGMENT, Action::CLOSE, from.index(), to.index(), line, 0});
+    }
+    
+    NetworkUpdate& delay_segment(StationId from, StationId to, double minutes, int line = -1) {
+        return add({Scope::SEGMENT, Action::DELAY, from.index(), to.index(), line, 
+                    checked_delay(minutes)});
+    }
+    
+    NetworkUpdate& restore_segment(StationId from, StationId to, int line = -1) {
+        return add({Scope::SEGMENT, Action::RESTORE, from.index(), to.index(), line, 0});
+    }
+    
+    NetworkUpdate& close_station(StationId station) {
+        return add({Scope::STATION, Action::CLOSE, station.index(), -1, -1, 0});
+    }
+    
+    NetworkUpdate& restore_station(StationId station) {
+        return add({Scope::STATION, Action::RESTORE, station.index(), -1, -1, 0});
+    }
+    
+    NetworkUpdate& close_line(LineId line) {
+        return add({Scope::LINE, Action::CLOSE, -1, -1, line, 0});
+    }
+    
+    // Single-track working and the like: every segment of the line slower.
+    NetworkUpdate& delay_line(LineId line, double minutes_per_segment) {
+        return add({Scope::LINE, Action::DELAY, -1, -1, line, checked_delay(minutes_per_segment)});
+    }
+    
+    NetworkUpdate& restore_line(LineId line) {
+        return add({Scope::LINE, Action::RESTORE, -1, -1, line, 0});
+    }
+    
+    const std::vector<Change>& changes() const { return list; }
+    bool empty() const { return list.empty(); }
+
+private:
+    std::vector<Change> list;
+    
+    NetworkUpdate& add(const Change& change) {
+        list.push_back(change);
+        return *this;
+    }
+    
+    static float checked_delay(double minutes) {
+        if (!(minutes >= 0) || !std::isfinite(minutes)) {
+            throw std::invalid_argument("a delay must be a non-negative number of minutes");
+        }
+        return static_cast<float>(minutes);
+    }
+};
+
+class MetroSystem {
+private:
+    std::unordered_map<std::string, int> station_map;
+    std::unordered_map<std::string, LineId> line_map;
+    std::vector<Station> stations;
+    std::vector<std::string> line_names;
+    std::vector<std::string> line_badges;
+    std::vector<std::vector<Edge>> adjacency_list;
+    std::vector<ServiceBand> services;
+    std::vector<LineFare> fares;  // by line, up to the last line with a fare
+    std::unordered_map<std::string, uint32_t> fare_groups;
+    std::string lookup_key;
+    NetworkGraph graph;
+    NetworkGraph planned;  // graph with the weights it was built with
+    uint64_t network_version = 0;
+    std::shared_ptr<const Timetable> service_timetable;
+    std::shared_ptr<const Timetable> planned_timetable;  // as generated or loaded
+    
+    constexpr static double INTERCHANGE_PENALTY = 4.0;
+    constexpr static double BASE_SPEED = 35.0;
+    constexpr static uint32_t DWELL_SECONDS = 30;
+    constexpr static uint32_t NO_FARE_GROUP = 0xFFFFFFFF;
+    
+    int add_station(std::string_view name) {
+        lookup_key.assign(name);
+        auto it = station_map.find(lookup_key);
+        if (it != station_map.end()) return it->second;
+        
+        int idx = stations.size();
+        station_map.emplace(lookup_key, idx);
+        stations.emplace_back(lookup_key);
+        adjacency_list.emplace_back();
+        return idx;
+    }
+    
+    LineId add_line(std::string_view name, std::string_view badge = "⚪") {
+        lookup_key.assign(name);
+        auto it = line_map.find(lookup_key);
+        if (it != line_map.end()) return it->second;
+        
+        if (line_names.size() >= MAX_LINES) {
+            throw std::length_error("networks support at most " + 
+                                    std::to_string(MAX_LINES) + " lines");
+        }
+        
+        auto id = static_cast<LineId>(line_names.size());
+        line_map.emplace(lookup_key, id);
+        line_names.emplace_back(name);
+        line_badges.emplace_back(badge);
+        return id;
+    }
+    
+    void connect_stations(std::string_view from, std::string_view to, 
+                         double distance, LineId line) {
+        int from_idx = add_station(from);
+        int to_idx = add_station(to);
+        
+        stations[from_idx].add_line(line);
+        stations[to_idx].add_line(line);
+        
+        adjacency_list[from_idx].emplace_back(to_idx, distance, line);
+        adjacency_list[to_idx].emplace_back(from_idx, distance, line);
+    }
+    
+    void set_station_location(std::string_view name, double latitude, double longitude) {
+        Station& station = stations[add_station(name)];
+        station.latitude = latitude;
+        station.longitude = longitude;
+    }
+    
+    // Run trains on `line` from each end every `headway` minutes, the first
+    // at `start` and the last before `end` (seconds after midnight).
+    void add_service(LineId line, uint32_t start, uint32_t end, uint32_t headway_minutes) {
+        services.push_back({line, start, end, headway_minutes * 60});
+    }
+    
+    // Price `line` at `boarding` plus `per_km`. Lines of one fare group
+    // share a ticket; a line without a group gets its own.
+    void set_fare(LineId line, double boarding, double per_km, std::string_view group = {}) {
+        lookup_key.assign(group.empty() ? std::string_view(line_names[line]) : group);
+        auto group_entry = fare_groups.emplace(lookup_key, static_cast<uint32_t>(fare_groups.size()));
+        uint32_t group_id = group_entry.first->second;
+        if (fares.size() <= line) fares.resize(line + 1, LineFare{0, 0, NO_FARE_GROUP});
+        fares[line] = {static_cast<float>(boarding), static_cast<float>(per_km), group_id};
+    }
+    
+    // Split a comma-separated record into trimmed fields; returns how many
+    // were found, at most max_fields.
+    static size_t split_fields(std::string_view record, std::string_view* fields, 
+                               size_t max_fields) {
+        size_t count = 0;
+        while (count < max_fields) {
+            size_t comma = record.find(',');
+            std::string_view field = record.substr(0, comma);
+            while (!field.empty() && std::isspace(static_cast<unsigned char>(field.front()))) {
+                field.remove_prefix(1);
+            }
+            while (!field.empty() && std::isspace(static_cast<unsigned char>(field.back()))) {
+                field.remove_suffix(1);
+            }
+            fields[count++] = field;
+            if (comma == std::string_view::npos) break;
+            record.remove_prefix(comma + 1);
+        }
+        return count;
+    }
+
+public:
+    MetroSystem() {
+        build_network();
+        freeze();
+    }
+    
+    MetroSystem(const MetroSystem&) = delete;
+    MetroSystem& operator=(const MetroSystem&) = delete;
+    
+    // Build the network from a description streamed by load_network().
+    explicit MetroSystem(std::istream& network_csv) {
+        load_network(network_csv);
+        freeze();
+    }
+    
+    // Load a network image written by save_network(). The snapshot and any
+    // route tables or hierarchies in it point straight into the mapped file.
+    explicit MetroSystem(const std::string& image_path, 
+                         NetworkImage::Checks checks = NetworkImage::Checks::STRUCTURE) {
+        NetworkImage image = NetworkImage::load(image_path, checks);
+        graph = std::move(image.graph);
+        planned = graph;
+        service_timetable = std::move(image.timetable);
+        planned_timetable = service_timetable;
+        route_tables[0] = std::move(image.routes[0]);
+        route_tables[1] = std::move(image.routes[1]);
+        hierarchies[0] = std::move(image.hierarchies[0]);
+        hierarchies[1] = std::move(image.hierarchies[1]);
+        choose_search_defaults();
+    }
+    
+    // Flatten the build-time stations and adjacency lists into the CSR
+    // snapshot that all queries run against, then release them.
+    void freeze() {
+        size_t n = stations.size();
+        size_t m = 0;
+        for (const auto& edges : adjacency_list) m += edges.size();
+        
+        auto buffers = std::make_shared<NetworkGraphBuffers>();
+        buffers->offsets.reserve(n + 1);
+        buffers->edge_to.reserve(m);
+        buffers->edge_time.reserve(m);
+        buffers->edge_distance.reserve(m);
+        buffers->edge_line.reserve(m);
+        buffers->station_lines.reserve(n);
+        buffers->name_offsets.reserve(n + 1);
+        buffers->name_order.reserve(n);
+        
+        buffers->offsets.push_back(0);
+        buffers->name_offsets.push_back(0);
+        bool has_coordinates = false;
+        for (size_t i = 0; i < n; ++i) {
+            for (const auto& edge : adjacency_list[i]) {
+                buffers->edge_to.push_back(edge.to);
+                buffers->edge_time.push_back(static_cast<float>(edge.time));
+                buffers->edge_distance.push_back(static_cast<float>(edge.distance));
+                buffers->edge_line.push_back(static_cast<uint8_t>(edge.line));
+            }
+            buffers->offsets.push_back(static_cast<uint32_t>(buffers->edge_to.size()));
+            buffers->station_lines.push_back(stations[i].lines);
+            
+            const std::string& name = stations[i].name;
+            buffers->name_chars.insert(buffers->name_chars.end(), name.begin(), name.end());
+            buffers->name_offsets.push_back(static_cast<uint32_t>(buffers->name_chars.size()));
+            buffers->name_order.push_back(static_cast<uint32_t>(i));
+            
+            if (!std::isnan(stations[i].latitude)) has_coordinates = true;
+        }
+        
+        if (has_coordinates) {
+            buffers->station_lat.reserve(n);
+            buffers->station_lon.reserve(n);
+            for (const auto& station : stations) {
+                buffers->station_lat.push_back(static_cast<float>(station.latitude));
+                buffers->station_lon.push_back(static_cast<float>(station.longitude));
+            }
+        }
+        
+        std::sort(buffers->name_order.begin(), buffers->name_order.end(),
+            [&](uint32_t a, uint32_t b) { return stations[a].name < stations[b].name; });
+        
+        buffers->line_name_offsets.push_back(0);
+        buffers->line_badge_offsets.push_back(0);
+        for (size_t l = 0; l < line_names.size(); ++l) {
+            auto& names = buffers->line_name_chars;
+            auto& badges = buffers->line_badge_chars;
+            names.insert(names.end(), line_names[l].begin(), line_names[l].end());
+            badges.insert(badges.end(), line_badges[l].begin(), line_badges[l].end());
+            buffers->line_name_offsets.push_back(static_cast<uint32_t>(names.size()));
+            buffers->line_badge_offsets.push_back(static_cast<uint32_t>(badges.size()));
+        }
+        
+        // Lines that were never priced ride free, each in a group of its own.
+        if (!fares.empty()) {
+            fares.resize(line_names.size(), LineFare{0, 0, NO_FARE_GROUP});
+            auto next_group = static_cast<uint32_t>(fare_groups.size());
+            for (LineFare& fare : fares) {
+                if (fare.fare_group == NO_FARE_GROUP) fare.fare_group = next_group++;
+            }
+            buffers->line_fares = fares;
+        }
+        
+        graph = NetworkGraphBuffers::adopt(std::move(buffers), 
+                                           static_cast<uint32_t>(line_names.size()));
+        planned = graph;
+        service_timetable.reset();
+        if (!services.empty()) {
+            service_timetable = std::make_unique<Timetable>(TimetableBuffers::adopt(
+                TimetableBuffers::generate(graph, services, DWELL_SECONDS),
+                static_cast<uint32_t>(INTERCHANGE_PENALTY * 60)));
+        }
+        planned_timetable = service_timetable;
+        drop_precomputed_routes();
+        drop_hierarchies();
+        choose_search_defaults();
+        
+        std::vector<std::vector<Edge>>().swap(adjacency_list);
+        std::vector<Station>().swap(stations);
+        std::vector<std::string>().swap(line_names);
+        std::vector<std::string>().swap(line_badges);
+        std::vector<ServiceBand>().swap(services);
+        std::vector<LineFare>().swap(fares);
+        std::unordered_map<std::string, uint32_t>().swap(fare_groups);
+        std::unordered_map<std::string, int>().swap(station_map);
+        std::unordered_map<std::string, LineId>().swap(line_map);
+    }
+    
+    // Write the frozen network and timetable, plus the route tables and
+    // hierarchies that have been built, as a binary image that the loading
+    // constructor maps.
+    void save_network(const std::string& path) const {
+        NetworkImage::save(path, graph, timetable(), 
+                           precomputed_routes(true), precomputed_routes(false),
+                           hierarchy(true), hierarchy(false));
+    }
+    
+    const NetworkGraph& network() const { return graph; }
+    
+    // Generated from the service bands when the network was frozen; null if
+    // the network description had none.
+    const Timetable* timetable() const { return service_timetable.get(); }
+    
+    size_t line_count() const { return graph.line_count; }
+    std::string_view get_line_name(LineId line) const { return graph.line_name(line); }
+    std::string_view get_line_emoji(LineId line) const { return graph.line_badge(line); }
+    
+    // Whether more than one line serves `station`; false if it is not valid().
+    bool is_interchange(StationId station) const {
+        if (!valid(station)) return false;
+        LineMask lines = graph.station_lines[station.index()];
+        return (lines & (lines - 1)) != 0;
+    }
+    
+    void build_network() {
+        const auto purple = add_line("Purple Line", "🟣");
+        const auto aqua = add_line("Aqua Line", "🔵");
+        const auto red = add_line("Red Line", "🔴");
+        
+        connect_stations("PCMC Bhavan", "Sant Tukaram Nagar", 3.3, purple);
+        connect_stations("Sant Tukaram Nagar", "Nashik Phata", 2.0, purple);
+        connect_stations("Nashik Phata", "Kasarwadi", 1.8, purple);
+        connect_stations("Kasarwadi", "Phugewadi", 1.2, purple);
+        connect_stations("Phugewadi", "Dapodi", 1.5, purple);
+        connect_stations("Dapodi", "Bopodi", 1.4, purple);
+        connect_stations("Bopodi", "Khadki", 1.3, purple);
+        connect_stations("Khadki", "Range Hills", 1.2, purple);
+        connect_stations("Range Hills", "Shivaji Nagar", 2.8, purple);
+        connect_stations("Shivaji Nagar", "Civil Court", 1.4, purple);
+        connect_stations("Civil Court", "Kasba Peth", 1.2, purple);
+        connect_stations("Kasba Peth", "Mandai", 1.0, purple);
+        connect_stations("Mandai", "Swargate", 1.5, purple);
+        
+        connect_stations("Vanaz", "Anand Nagar", 1.0, aqua);
+        connect_stations("Anand Nagar", "Ideal Colony", 1.1, aqua);
+        connect_stations("Ideal Colony", "Nal Stop", 1.2, aqua);
+        connect_stations("Nal Stop", "Garware College", 1.4, aqua);
+        connect_stations("Garware College", "Deccan Gymkhana", 1.0, aqua);
+        connect_stations("Deccan Gymkhana", "Chhatrapati Sambhaji Udyan", 0.9, aqua);
+        connect_stations("Chhatrapati Sambhaji Udyan", "PMC Bhavan", 0.8, aqua);
+        connect_stations("PMC Bhavan", "Civil Court", 1.1, aqua);
+        connect_stations("Civil Court", "Mangalwar Peth", 1.0, aqua);
+        connect_stations("Mangalwar Peth", "Pune Railway Station", 1.2, aqua);
+        connect_stations("Pune Railway Station", "Ruby Hall Clinic", 1.0, aqua);
+        connect_stations("Ruby Hall Clinic", "Bund Garden", 1.1, aqua);
+        connect_stations("Bund Garden", "Yerawada", 1.0, aqua);
+        connect_stations("Yerawada", "Kalyani Nagar", 0.9, aqua);
+        connect_stations("Kalyani Nagar", "Ramwadi", 1.2, aqua);
+        
+        connect_stations("Megapolis Circle", "Quadron", 1.5, red);
+        connect_stations("Quadron", "Infosys Phase II", 1.8, red);
+        connect_stations("Infosys Phase II", "Dollar", 1.3, red);
+        connect_stations("Dollar", "RBI", 1.2, red);
+        connect_stations("RBI", "Rajiv Gandhi IT Park", 1.4, red);
+        connect_stations("Rajiv Gandhi IT Park", "EON IT Park", 1.1, red);
+        connect_stations("EON IT Park", "Kamnagar", 1.6, red);
+        connect_stations("Kamnagar", "Laxmi Nagar", 1.3, red);
+        connect_stations("Laxmi Nagar", "Balewadi Phata", 1.2, red);
+        connect_stations("Balewadi Phata", "Baner Gaon", 1.4, red);
+        connect_stations("Baner Gaon", "Baner", 1.0, red);
+        connect_stations("Baner", "Indian Agricultural Research Institute", 1.5, red);
+        connect_stations("Indian Agricultural Research Institute", "Sakal Nagar", 1.3, red);
+        connect_stations("Sakal Nagar", "Savitribai Phule Pune University", 1.1, red);
+        connect_stations("Savitribai Phule Pune University", "Reserve Bank of India", 1.2, red);
+        connect_stations("Reserve Bank of India", "Agriculture College", 1.4, red);
+        connect_stations("Agriculture College", "Shivaji Nagar", 1.6, red);
+        connect_stations("Shivaji Nagar", "Civil Court", 1.4, red);
+        
+        set_station_location("PCMC Bhavan", 18.6286, 73.8037);
+        set_station_location("Sant Tukaram Nagar", 18.6184, 73.8145);
+        set_station_location("Nashik Phata", 18.6069, 73.8222);
+        set_station_location("Kasarwadi", 18.5993, 73.8253);
+        set_station_location("Phugewadi", 18.5897, 73.8315);
+        set_station_location("Dapodi", 18.5829, 73.8370);
+        set_station_location("Bopodi", 18.5717, 73.8434);
+        set_station_location("Khadki", 18.5630, 73.8467);
+        set_station_location("Range Hills", 18.5540, 73.8442);
+        set_station_location("Shivaji Nagar", 18.5314, 73.8497);
+        set_station_location("Civil Court", 18.5266, 73.8560);
+        set_station_location("Kasba Peth", 18.5196, 73.8590);
+        set_station_location("Mandai", 18.5131, 73.8560);
+        set_station_location("Swargate", 18.5018, 73.8636);
+        set_station_location("Vanaz", 18.5074, 73.8056);
+        set_station_location("Anand Nagar", 18.5086, 73.8139);
+        set_station_location("Ideal Colony", 18.5097, 73.8232);
+        set_station_location("Nal Stop", 18.5098, 73.8330);
+        set_station_location("Garware College", 18.5137, 73.8395);
+        set_station_location("Deccan Gymkhana", 18.5165, 73.8428);
+        set_station_location("Chhatrapati Sambhaji Udyan", 18.5195, 73.8466);
+        set_station_location("PMC Bhavan", 18.5233, 73.8525);
+        set_station_location("Mangalwar Peth", 18.5272, 73.8661);
+        set_station_location("Pune Railway Station", 18.5289, 73.8744);
+        set_station_location("Ruby Hall Clinic", 18.5323, 73.8779);
+        set_station_location("Bund Garden", 18.5375, 73.8855);
+        set_station_location("Yerawada", 18.5463, 73.8887);
+        set_station_location("Kalyani Nagar", 18.5478, 73.9002);
+        set_station_location("Ramwadi", 18.5527, 73.9107);
+        set_station_location("Megapolis Circle", 18.5793, 73.6877);
+        set_station_location("Quadron", 18.5827, 73.6985);
+        set_station_location("Infosys Phase II", 18.5893, 73.7080);
+        set_station_location("Dollar", 18.5905, 73.7185);
+        set_station_location("RBI", 18.5905, 73.7300);
+        set_station_location("Rajiv Gandhi IT Park", 18.5880, 73.7390);
+        set_station_location("EON IT Park", 18.5850, 73.7470);
+        set_station_location("Kamnagar", 18.5790, 73.7560);
+        set_station_location("Laxmi Nagar", 18.5740, 73.7650);
+        set_station_location("Balewadi Phata", 18.5670, 73.7760);
+        set_station_location("Baner Gaon", 18.5620, 73.7850);
+        set_station_location("Baner", 18.5590, 73.7930);
+        set_station_location("Indian Agricultural Research Institute", 18.5560, 73.8020);
+        set_station_location("Sakal Nagar", 18.5520, 73.8110);
+        set_station_location("Savitribai Phule Pune University", 18.5470, 73.8240);
+        set_station_location("Reserve Bank of India", 18.5420, 73.8320);
+        set_station_location("Agriculture College", 18.5370, 73.8410);
+        
+        // Trains run 06:00-22:00, more often in the morning and evening peaks.
+        const uint32_t bands[][3] = {{6, 8, 10}, {8, 11, 7}, {11, 17, 10}, {17, 20, 7}, {20, 22, 15}};
+        for (LineId line : {purple, aqua, red}) {
+            for (const auto& [from, until, headway] : bands) {
+                add_service(line, from * 3600, until * 3600, headway);
+            }
+        }
+        
+        // Illustrative fares: the Purple and Aqua lines share one operator
+        // and ticket, the Red Line is run separately.
+        set_fare(purple, 10, 1.0, "Maha-Metro");
+        set_fare(aqua, 10, 1.0, "Maha-Metro");
+        set_fare(red, 15, 1.5, "Pune IT City Metro");
+    }
+    
+    // Stream a network description, one comma-separated record per line
+    // ('#' starts a comment):
+    //   line,<name>[,<badge>]
+    //   segment,<line name>,<from station>,<to station>,<distance km>
+    //   station,<name>,<latitude>,<longitude>
+    //   service,<line name>,<from HH:MM>,<until HH:MM>,<headway minutes>
+    //   fare,<line name>,<boarding>,<per km>[,<fare group>]
+    // A segment may name a line that was not declared; it is added with the
+    // default badge. Stations get dense IDs in order of first appearance.
+    // Coordinates are optional but enable A* search when every station has them.
+    // Service records describe the timetable; times may run past 24:00.
+    // Fare records price route comparisons; see LineFare.
+    void load_network(std::istream& in) {
+        std::string record;
+        std::string_view fields[5];
+        size_t line_number = 0;
+        
+        auto fail = [&](const char* reason) {
+            throw std::runtime_error("network description line " + 
+                                     std::to_string(line_number) + ": " + reason);
+        };
+        
+        while (std::getline(in, record)) {
+            ++line_number;
+            std::string_view text = record;
+            text = text.substr(0, text.find('#'));
+            if (text.find_first_not_of(" \t\r") == std::string_view::npos) continue;
+            
+            size_t count = split_fields(text, fields, 5);
+            if (fields[0] == "line") {
+                if (count < 2 || fields[1].empty()) fail("expected line,<name>[,<badge>]");
+                if (count > 2 && !fields[2].empty()) {
+                    add_line(fields[1], fields[2]);
+                } else {
+                    add_line(fields[1]);
+                }
+            } else if (fields[0] == "segment") {
+                if (count != 5) fail("expected segment,<line>,<from>,<to>,<km>");
+                
+                double distance = 0;
+                auto [end, ec] = std::from_chars(fields[4].data(), 
+                                                 fields[4].data() + fields[4].size(), distance);
+                if (ec != std::errc() || end != fields[4].data() + fields[4].size() || 
+                    !(distance > 0)) {
+                    fail("segment distance must be a positive number");
+                }
+                if (fields[2].empty() || fields[3].empty() || fields[2] == fields[3]) {
+                    fail("segment needs two distinct station names");
+                }
+                
+                connect_stations(fields[2], fields[3], distance, add_line(fields[1]));
+            } else if (fields[0] == "station") {
+                double coordinates[2];
+                for (int k = 0; k < 2; ++k) {
+                    std::string_view field = count == 4 ? fields[2 + k] : std::string_view();
+                    auto [end, ec] = std::from_chars(field.data(), field.data() + field.size(), 
+                                                     coordinates[k]);
+                    if (count != 4 || ec != std::errc() || end != field.data() + field.size()) {
+                        fail("expected station,<name>,<latitude>,<longitude>");
+                    }
+                }
+                if (fields[1].empty()) fail("station needs a name");
+                set_station_location(fields[1], coordinates[0], coordinates[1]);
+            } else if (fields[0] == "service") {
+                uint32_t start = 0, end = 0, headway = 0;
+                bool valid = count == 5 && parse_clock(fields[2], start) && 
+                             parse_clock(fields[3], end);
+                if (valid) {
+                    auto [last, ec] = std::from_chars(fields[4].data(), 
+                                                      fields[4].data() + fields[4].size(), headway);
+                    valid = ec == std::errc() && last == fields[4].data() + fields[4].size();
+                }
+                if (!valid) fail("expected service,<line>,<HH:MM>,<HH:MM>,<headway minutes>");
+                if (headway == 0 || end <= start) fail("service needs a headway and a time span");
+                add_service(add_line(fields[1]), start, end, headway);
+            } else if (fields[0] == "fare") {
+                double prices[2];
+                for (int k = 0; k < 2; ++k) {
+                    std::string_view field = count >= 4 ? fields[2 + k] : std::string_view();
+                    auto [last, ec] = std::from_chars(field.data(), field.data() + field.size(), 
+                                                      prices[k]);
+                    if (count < 4 || ec != std::errc() || last != field.data() + field.size() ||
+                        !(prices[k] >= 0)) {
+                        fail("expected fare,<line>,<boarding>,<per km>[,<fare group>]");
+                    }
+                }
+                set_fare(add_line(fields[1]), prices[0], prices[1], 
+                         count == 5 ? fields[4] : std::string_view());
+            } else {
+                fail("unknown record type");
+            }
+        }
+        
+        if (stations.empty()) {
+            throw std::runtime_error("network description contains no segments");
+        }
+    }
+    
+    struct PathResult {
+        std::vector<int> path;
+        std::vector<LineId> path_lines;
+        double total_distance;
+        double total_time;
+        int interchanges;
+        bool found;
+        std::vector<std::pair<std::string, LineId>> detailed_route;
+        
+        PathResult() : total_distance(0), total_time(0), interchanges(0), found(false) {}
+    };
+    
+    // Least-recently-used cache of finished routes for skewed traffic,
+    // shared by a system and every version updated() derives from it.
+    // Entries are tagged with the generation of the system that computed
+    // them, a number no other MetroSystem in the process shares; a lookup
+    // from another system misses and drops the entry, so an update
+    // invalidates the whole cache without touching it. Keys hash to one of
+    // a fixed number of shards, each with its own lock, LRU list and slab
+    // of entries. A shard serializes the routes of its entries into one
+    // arena of 32-bit words (stations, then lines four to a word) and
+    // compacts it when evicted entries fill half of it.
+    class RouteCache {
+    public:
+        explicit RouteCache(size_t capacity, size_t shard_count = 16) 
+            : shards(std::max<size_t>(1, shard_count)) {
+            size_t per_shard = std::max<size_t>(1, (capacity + shards.size() - 1) / shards.size());
+            for (Shard& shard : shards) {
+                shard.slots.resize(per_shard);
+                shard.index.reserve(per_shard);
+                for (uint32_t i = 0; i < per_shard; ++i) shard.free.push_back(per_shard - 1 - i);
+            }
+        }
+        
+        static uint64_t route_key(int start_idx, int end_idx, bool minimize_time) {
+            return pair_key(start_idx, end_idx) << 8 | (minimize_time ? 1 : 0);
+        }
+        
+        // find_alternative_routes with the default stretch and overlap;
+        // k must be below MAX_ALTERNATIVES, the most the key has room for.
+        constexpr static size_t MAX_ALTERNATIVES = 64;
+        static uint64_t alternatives_key(int start_idx, int end_idx, bool minimize_time, size_t k) {
+            return pair_key(start_idx, end_idx) << 8 | 0x80 | k << 1 | (minimize_time ? 1 : 0);
+        }
+        
+        bool find(uint64_t key, uint64_t generation, PathResult& route) {
+            return find_with(key, generation, [&](const uint32_t* data) { decode(data + 1, route); });
+        }
+        
+        bool find(uint64_t key, uint64_t generation, std::vector<PathResult>& routes) {
+            return find_with(key, generation, [&](const uint32_t* data) {
+                routes.assign(data[0], PathResult());
+                ++data;
+                for (PathResult& route : routes) data = decode(data, route);
+            });
+        }
+        
+        void store(uint64_t key, uint64_t generation, const PathResult* routes, size_t count) {
+            Shard& shard = shard_of(key);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto it = shard.index.find(key);
+            uint32_t s;
+            if (it != shard.index.end()) {
+                s = it->second;
+                unlink(shard, s);
+                shard.garbage += shard.slots[s].size;
+            } else {
+                if (shard.free.empty()) evict(shard, shard.tail);
+                s = shard.free.back();
+                shard.free.pop_back();
+                shard.index.emplace(key, s);
+            }
+            
+            Slot& slot = shard.slots[s];
+            slot.key = key;
+            slot.generation = generation;
+            slot.offset = static_cast<uint32_t>(shard.arena.size());
+            shard.arena.push_back(static_cast<uint32_t>(count));
+            for (size_t r = 0; r < count; ++r) encode(routes[r], shard.arena);
+            slot.size = static_cast<uint32_t>(shard.arena.size()) - slot.offset;
+            push_front(shard, s);
+            if (shard.garbage * 2 > shard.arena.size() && shard.arena.size() > COMPACT_WORDS) {
+                compact(shard);
+            }
+        }
+        
+        struct Stats {
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            uint64_t evictions = 0;
+            uint64_t invalidations = 0;  // entries dropped for another network
+            size_t entries = 0;
+            size_t capacity = 0;
+            
+            double hit_rate() const {
+                return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / (hits + misses);
+            }
+        };
+        
+        Stats stats() const {
+            Stats total;
+            for (const Shard& shard : shards) {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                total.hits += shard.hits;
+                total.misses += shard.misses;
+                total.evictions += shard.evictions;
+                total.invalidations += shard.invalidations;
+                total.entries += shard.index.size();
+                total.capacity += shard.slots.size();
+            }
+            return total;
+        }
+        
+        // Lookup latencies in nanoseconds, hits and misses alike; recorded
+        // only with PUNE_METRO_METRICS.
+        void merge_latency(LatencyHistogram& into) const {
+            for (const Shard& shard : shards) {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                into.merge(shard.latency);
+            }
+        }
+        
+        // The counters, and the lookup latency when recorded, in the
+        // Prometheus text format, to follow EngineMetrics::prometheus().
+        std::string prometheus() const {
+            Stats totals = stats();
+            std::ostringstream out;
+            out << std::setprecision(9);
+            const std::pair<const char*, uint64_t> counters[] = {
+                {"hits", totals.hits}, {"misses", totals.misses}, 
+                {"evictions", totals.evictions}, {"invalidations", totals.invalidations}};
+            for (auto [name, value] : counters) {
+                out << "# TYPE pune_metro_route_cache_" << name << "_total counter\n"
+                    << "pune_metro_route_cache_" << name << "_total " << value << "\n";
+            }
+            out << "# TYPE pune_metro_route_cache_entries gauge\n"
+                << "pune_metro_route_cache_entries " << totals.entries << "\n";
+            if constexpr (METRICS_ENABLED) {
+                LatencyHistogram latency;
+                merge_latency(latency);
+                out << "# HELP pune_metro_route_cache_lookup_seconds Route cache lookup latency.\n"
+                    << "# TYPE pune_metro_route_cache_lookup_seconds summary\n";
+                for (double quantile : {0.5, 0.9, 0.99}) {
+                    out << "pune_metro_route_cache_lookup_seconds{quantile=\"" << quantile << "\"} "
+                        << latency.percentile(quantile) * 1e-9 << "\n";
+                }
+                out << "pune_metro_route_cache_lookup_seconds_sum " << latency.sum() * 1e-9 << "\n"
+                    << "pune_metro_route_cache_lookup_seconds_count " << latency.count() << "\n";
+            }
+            return out.str();
+        }
+        
+    private:
+        constexpr static uint32_t NONE = 0xFFFFFFFF;
+        constexpr static size_t COMPACT_WORDS = 4096;
+        
+        struct Slot {
+            uint64_t key = 0;
+            uint64_t generation = 0;
+            uint32_t prev = NONE;
+            uint32_t next = NONE;
+            uint32_t offset = 0;  // of the routes in the shard's arena
+            uint32_t size = 0;
+        };
+        
+        struct alignas(64) Shard {
+            mutable std::mutex mutex;
+            std::vector<Slot> slots;
+            std::vector<uint32_t> free;
+            std::unordered_map<uint64_t, uint32_t> index;
+            std::vector<uint32_t> arena;
+            size_t garbage = 0;  // arena words of replaced and evicted entries
+            uint32_t head = NONE;  // most recently used
+            uint32_t tail = NONE;
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            uint64_t evictions = 0;
+            uint64_t invalidations = 0;
+            LatencyHistogram latency;
+        };
+        
+        std::vector<Shard> shards;
+        
+        static uint64_t pair_key(int start_idx, int end_idx) {
+            return static_cast<uint64_t>(static_cast<uint32_t>(start_idx)) << 28 ^ 
+                   static_cast<uint32_t>(end_idx);
+        }
+        
+        Shard& shard_of(uint64_t key) {
+            uint64_t mixed = key * 0x9E3779B97F4A7C15ull;
+            return shards[(mixed >> 32) % shards.size()];
+        }
+        
+        template <typename Decode>
+        bool find_with(uint64_t key, uint64_t generation, Decode&& decode_entry) {
+            std::chrono::steady_clock::time_point start;
+            if constexpr (METRICS_ENABLED) start = std::chrono::steady_clock::now();
+            Shard& shard = shard_of(key);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            bool hit = false;
+            auto it = shard.index.find(key);
+            if (it != shard.index.end()) {
+                uint32_t s = it->second;
+                if (shard.slots[s].generation == generation) {
+                    unlink(shard, s);
+                    push_front(shard, s);
+                    decode_entry(shard.arena.data() + shard.slots[s].offset);
+                    hit = true;
+                } else {
+                    ++shard.invalidations;
+                    drop(shard, s);
+                }
+            }
+            ++(hit ? shard.hits : shard.misses);
+            if constexpr (METRICS_ENABLED) {
+                shard.latency.record(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start).count()));
+            }
+            return hit;
+        }
+        
+        static void encode(const PathResult& route, std::vector<uint32_t>& out) {
+            uint32_t words[4];
+            std::memcpy(words, &route.total_time, sizeof(double));
+            std::memcpy(words + 2, &route.total_distance, sizeof(double));
+            out.push_back(static_cast<uint32_t>(route.interchanges) << 1 | (route.found ? 1 : 0));
+            out.insert(out.end(), words, words + 4);
+            out.push_back(static_cast<uint32_t>(route.path.size()));
+            out.push_back(static_cast<uint32_t>(route.path_lines.size()));
+            for (int station : route.path) out.push_back(static_cast<uint32_t>(station));
+            for (size_t i = 0; i < route.path_lines.size(); i += 4) {
+                uint32_t packed = 0;
+                for (size_t j = i; j < std::min(i + 4, route.path_lines.size()); ++j) {
+                    packed |= static_cast<uint32_t>(route.path_lines[j]) << (8 * (j - i));
+                }
+                out.push_back(packed);
+            }
+        }
+        
+        // Fill route from the words at data; returns the words after it.
+        static const uint32_t* decode(const uint32_t* data, PathResult& route) {
+            route.found = (data[0] & 1) != 0;
+            route.interchanges = static_cast<int>(data[0] >> 1);
+            std::memcpy(&route.total_time, data + 1, sizeof(double));
+            std::memcpy(&route.total_distance, data + 3, sizeof(double));
+            uint32_t stations = data[5], lines = data[6];
+            data += 7;
+            route.path.assign(data, data + stations);
+            data += stations;
+            route.path_lines.resize(lines);
+            for (uint32_t j = 0; j < lines; ++j) {
+                route.path_lines[j] = static_cast<LineId>(data[j / 4] >> (8 * (j % 4)));
+            }
+            return data + (lines + 3) / 4;
+        }
+        
+        static void unlink(Shard& shard, uint32_t s) {
+            Slot& slot = shard.slots[s];
+            (slot.prev == NONE ? shard.head : shard.slots[slot.prev].next) = slot.next;
+            (slot.next == NONE ? shard.tail : shard.slots[slot.next].prev) = slot.prev;
+            slot.prev = slot.next = NONE;
+        }
+        
+        static void push_front(Shard& shard, uint32_t s) {
+            Slot& slot = shard.slots[s];
+            slot.prev = NONE;
+            slot.next = shard.head;
+            (shard.head == NONE ? shard.tail : shard.slots[shard.head].prev) = s;
+            shard.head = s;
+        }
+        
+        static void drop(Shard& shard, uint32_t s) {
+            unlink(shard, s);
+            shard.index.erase(shard.slots[s].key);
+            shard.garbage += shard.slots[s].size;
+            shard.free.push_back(s);
+        }
+        
+        static void evict(Shard& shard, uint32_t s) {
+            ++shard.evictions;
+            drop(shard, s);
+        }
+        
+        // Copy the live entries to a fresh arena, most recently used first.
+        static void compact(Shard& shard) {
+            std::vector<uint32_t> arena;
+            arena.reserve(shard.arena.size() - shard.garbage);
+            for (uint32_t s = shard.head; s != NONE; s = shard.slots[s].next) {
+                Slot& slot = shard.slots[s];
+                auto from = shard.arena.begin() + slot.offset;
+                slot.offset = static_cast<uint32_t>(arena.size());
+                arena.insert(arena.end(), from, from + slot.size);
+            }
+            shard.arena.swap(arena);
+            shard.garbage = 0;
+        }
+    };
+    
+    // Reusable scratch space for find_optimal_path. Keep one per thread: the
+    // (station, line) tables are flat and stamped with a generation counter,
+    // so after the first query nothing is cleared or reallocated.
+    class QueryWorkspace {
+    public:
+        using State = SearchQueue::Entry;
+        
+        void prepare(size_t station_count, size_t line_count, SearchQueue::Kind queue_kind) {
+            size_t states = station_count * line_count;
+            lines = line_count;
+            if (stamp.size() < states) {
+                cost.resize(states);
+                parent.resize(states);
+                parent_line.resize(states);
+                stamp.resize(states, 0);
+                queue.reserve(states * 2);
+                settled.reserve(states);
+                if constexpr (METRICS_ENABLED) ++counters.allocations;
+            }
+            if (reached.size() < station_count) reached.resize(station_count, 0);
+            queue.reset(queue_kind, states);
+            settled.clear();
+            if (++generation == 0) {
+                std::fill(stamp.begin(), stamp.end(), 0);
+                std::fill(reached.begin(), reached.end(), 0);
+                generation = 1;
+            }
+        }
+        
+        size_t slot(int station, LineId line) const {
+            return static_cast<size_t>(station) * lines + static_cast<size_t>(line);
+        }
+        
+        double cost_at(size_t s) const {
+            return stamp[s] == generation ? cost[s] : INF;
+        }
+        
+        void set(size_t s, double c, int from, LineId from_line) {
+            stamp[s] = generation;
+            cost[s] = c;
+            parent[s] = from;
+            parent_line[s] = from_line;
+        }
+        
+        void push(double c, int station, LineId line) {
+            if constexpr (METRICS_ENABLED) {
+                ++counters.pushes;
+                if (queue.full()) ++counters.allocations;
+                counters.peak_queue = std::max<uint64_t>(counters.peak_queue, queue.size() + 1);
+            }
+            queue.push({c, station, line}, slot(station, line));
+        }
+        
+        State pop() {
+            if constexpr (METRICS_ENABLED) ++counters.pops;
+            return queue.pop();
+        }
+        
+        // The state just popped had already been settled more cheaply.
+        void skip_stale() {
+            if constexpr (METRICS_ENABLED) ++counters.stale_pops;
+        }
+        
+        // Mark a station as seen by this search; false if it already was.
+        bool reach(int station) {
+            if (reached[station] == generation) return false;
+            reached[station] = generation;
+            return true;
+        }
+        
+        std::vector<double> cost;
+        std::vector<int> parent;
+        std::vector<LineId> parent_line;
+        std::vector<uint32_t> stamp;
+        std::vector<uint32_t> reached;
+        SearchQueue queue;
+        std::vector<uint32_t> settled;
+        std::vector<double> tree_distance;
+        std::vector<double> tree_time;
+        std::vector<int> tree_interchanges;
+        uint32_t generation = 0;
+        size_t lines = 0;
+        uint64_t relaxations = 0;
+        SearchCounters counters;
+    };
+    
+    // Workspace owned by the calling thread, kept for the thread's lifetime.
+    static QueryWorkspace& thread_workspace() {
+        thread_local QueryWorkspace workspace;
+        return workspace;
+    }
+    
+    // Second per-thread workspace for the backward half of bidirectional search.
+    static QueryWorkspace& thread_backward_workspace() {
+        thread_local QueryWorkspace workspace;
+        return workspace;
+    }
+    
+    // Point-to-point search engine. All three return optimal routes; A*
+    // falls back to Dijkstra when the network has no station coordinates.
+    enum class SearchAlgorithm { DIJKSTRA, BIDIRECTIONAL, ASTAR };
+    
+    void set_search_algorithm(SearchAlgorithm algorithm) { search_algorithm = algorithm; }
+    
+    // Relax segments four at a time (see relax_lanes); only available when
+    // compiled for AVX2. Both ways give the same routes. By default it is
+    // on for networks whose stations average VECTOR_MIN_DEGREE segments;
+    // setting it fixes it for this system and every version derived from it.
+    void set_vector_relaxation(bool enabled) {
+        vector_relaxation = enabled && SIMD_RELAXATION;
+        vector_relaxation_fixed = true;
+    }
+    
+    bool uses_vector_relaxation() const { return vector_relaxation; }
+    
+    // Priority queue of the searches in each cost mode. By default it is
+    // chosen from the segment weights (see choose_search_defaults); setting it
+    // fixes it for this system and every version derived from it.
+    void set_queue_kind(SearchQueue::Kind kind) {
+        queue_kinds[0] = queue_kinds[1] = kind;
+        queue_kinds_fixed = true;
+    }
+    
+    // Go back to choosing the queues from the network.
+    void reset_queue_kind() {
+        queue_kinds_fixed = false;
+        choose_search_defaults();
+    }
+    
+    SearchQueue::Kind queue_kind(bool minimize_time) const {
+        return queue_kinds[minimize_time ? 0 : 1];
+    }
+    
+    // Station with exactly this name; an invalid ID if there is none.
+    StationId station_id(std::string_view name) const { 
+        return StationId(graph.find_station(name)); 
+    }
+    
+    // Whether `station` is a station of this network.
+    bool valid(StationId station) const {
+        return station.valid() && static_cast<size_t>(station.index()) < graph.station_count();
+    }
+    
+    // Empty for an ID that is not valid().
+    std::string_view station_name(StationId station) const { 
+        return valid(station) ? graph.name(station.index()) : std::string_view(); 
+    }
+    
+    PathResult find_optimal_path(StationId start, StationId end, bool minimize_time = true) const {
+        return find_optimal_path(start, end, minimize_time, thread_workspace());
+    }
+    
+    PathResult find_optimal_path(StationId start, StationId end, bool minimize_time, 
+                                 QueryWorkspace& ws) const {
+        if (!valid(start) || !valid(end)) return PathResult();
+        return find_optimal_path(start.index(), end.index(), minimize_time, ws);
+    }
+    
+    // With the given search algorithm instead of the configured one, and
+    // without the route cache; route tables and hierarchies still answer
+    // when they are built.
+    PathResult find_optimal_path(StationId start, StationId end, bool minimize_time, 
+                                 QueryWorkspace& ws, SearchAlgorithm algorithm) const {
+        if (!valid(start) || !valid(end)) return PathResult();
+        return find_optimal_path(start.index(), end.index(), minimize_time, ws, algorithm);
+    }
+    
+    // By name: the names are resolved once, then as above.
+    PathResult find_optimal_path(std::string_view start, std::string_view end, 
+                                 bool minimize_time = true) const {
+        return find_optimal_path(station_id(start), station_id(end), minimize_time);
+    }
+    
+    // Run the line-aware search from every station, once per cost mode, and
+    // answer later find_optimal_path calls from the resulting tables.
+    void precompute_routes() {
+        size_t n = graph.station_count();
+        if (n >= RouteTable::NO_STATION) {
+            throw std::length_error("precomputed routes support at most 65534 stations");
+        }
+        
+        for (int mode = 0; mode < 2; ++mode) {
+            auto buffers = std::make_shared<RouteTableBuffers>(n, graph.line_count);
+            auto table = std::make_unique<RouteTable>(
+                RouteTableBuffers::adopt(buffers, n, graph.line_count));
+            
+            bool minimize_time = mode == 0;
+            WorkStealingPool& pool = worker_pool();
+            std::vector<PathResult> routes(pool.size());
+            pool.parallel_for(n, [&](unsigned worker, size_t s) {
+                fill_route_table(*table, *buffers, static_cast<int>(s), minimize_time,
+                                 thread_workspace(), routes[worker]);
+            });
+            
+            route_tables[mode] = std::move(table);
+        }
+    }
+    
+    void drop_precomputed_routes() {
+        route_tables[0].reset();
+        route_tables[1].reset();
+    }
+    
+    const RouteTable* precomputed_routes(bool minimize_time) const {
+        return route_tables[minimize_time ? 0 : 1].get();
+    }
+    
+    // Contract the line-expanded network once per cost mode that has no
+    // hierarchy yet (the two modes in parallel). Unless route tables are
+    // loaded, later find_optimal_path calls search the hierarchies instead
+    // of the network. Unlike the route tables they grow roughly with the
+    // network, not its square.
+    void build_hierarchies() {
+        std::shared_ptr<const ContractionHierarchy> built[2] = {hierarchies[0], hierarchies[1]};
+        worker_pool().parallel_for(2, [&](unsigned, size_t mode) {
+            if (built[mode]) return;
+            bool minimize_time = mode == 0;
+            const float* weight = minimize_time ? graph.edge_time.data() 
+                                                : graph.edge_distance.data();
+            HierarchyBuilder builder(graph, weight, minimize_time ? INTERCHANGE_PENALTY : 0.5);
+            built[mode] = std::make_shared<ContractionHierarchy>(builder.build());
+        });
+        hierarchies[0] = std::move(built[0]);
+        hierarchies[1] = std::move(built[1]);
+    }
+    
+    void drop_hierarchies() {
+        hierarchies[0].reset();
+        hierarchies[1].reset();
+    }
+    
+    const ContractionHierarchy* hierarchy(bool minimize_time) const {
+        return hierarchies[minimize_time ? 0 : 1].get();
+    }
+    
+    // What updated() changed and repaired.
+    struct UpdateReport {
+        uint64_t version = 0;
+        size_t changed_edges = 0;  // directed segments whose weights changed
+        size_t repaired_sources[2] = {0, 0};  // route table rows recomputed, per mode
+        bool dropped_hierarchy[2] = {false, false};
+    };
+    
+    // Number of updates applied since the network was built or loaded.
+    uint64_t version() const { return network_version; }
+    
+    // Answer repeated route and alternatives queries for the same stations
+    // from a RouteCache of `entries` results (0 turns it off). Versions
+    // derived from this system share it.
+    void enable_route_cache(size_t entries) {
+        route_cache = entries > 0 ? std::make_shared<RouteCache>(entries) : nullptr;
+    }
+    
+    const RouteCache* cache() const { return route_cache.get(); }
+    
+    // Index of the line with this name, or -1.
+    int find_line(std::string_view name) const {
+        for (uint32_t line = 0; line < graph.line_count; ++line) {
+            if (graph.line_name(static_cast<LineId>(line)) == name) return static_cast<int>(line);
+        }
+        return -1;
+    }
+    
+    // Copy-on-write successor of this network with `update` applied, for
+    // LiveNetwork. This version is left untouched, so queries running on it
+    // carry on undisturbed. Only the segment weights are copied; topology,
+    // names, timetable and worker pool are shared. A route table is copied
+    // and repaired only for the sources whose search trees the update can
+    // change, and a cost mode the update does not touch (delays leave
+    // distances alone) keeps its table and hierarchy as they are. A
+    // hierarchy whose weights did change is dropped, as its shortcuts rest
+    // on witness searches that may no longer hold; that mode searches the
+    // network until with_hierarchies() rebuilds it. The timetable is
+    // rescheduled from the planned one when segment times changed: trains
+    // skip closed segments and run late after delayed ones.
+    std::shared_ptr<const MetroSystem> updated(const NetworkUpdate& update, 
+                                               UpdateReport* report = nullptr) const {
+        struct Weights {
+            std::shared_ptr<const void> planned;
+            std::vector<float> time;
+            std::vector<float> distance;
+        };
+        auto weights = std::make_shared<Weights>();
+        weights->planned = planned.storage;
+        weights->time.assign(graph.edge_time.begin(), graph.edge_time.end());
+        weights->distance.assign(graph.edge_distance.begin(), graph.edge_distance.end());
+        for (const auto& change : update.changes()) {
+            apply_change(change, weights->time, weights->distance);
+        }
+        
+        NetworkGraph next_graph = graph;
+        next_graph.edge_time = weights->time;
+        next_graph.edge_distance = weights->distance;
+        next_graph.storage = weights;
+        next_graph.calibrate_geometry();
+        std::shared_ptr<MetroSystem> next(
+            new MetroSystem(*this, std::move(next_graph), network_version + 1));
+        
+        UpdateReport summary;
+        summary.version = next->network_version;
+        std::vector<uint32_t> changed[2];
+        for (uint32_t e = 0; e < graph.edge_count(); ++e) {
+            bool time_changed = weights->time[e] != graph.edge_time[e];
+            bool distance_changed = weights->distance[e] != graph.edge_distance[e];
+            if (time_changed) changed[0].push_back(e);
+            if (distance_changed) changed[1].push_back(e);
+            if (time_changed || distance_changed) ++summary.changed_edges;
+        }
+        if (planned_timetable && !changed[0].empty()) {
+            bool as_planned = std::equal(weights->time.begin(), weights->time.end(),
+                                         planned.edge_time.begin());
+            next->service_timetable = as_planned ? planned_timetable
+                : std::make_shared<Timetable>(TimetableBuffers::adopt(
+                      TimetableBuffers::reschedule(*planned_timetable, planned, next->graph),
+                      planned_timetable->transfer_seconds));
+        }
+        
+        for (int mode = 0; mode < 2; ++mode) {
+            if (changed[mode].empty()) continue;
+            summary.dropped_hierarchy[mode] = next->hierarchies[mode] != nullptr;
+            next->hierarchies[mode].reset();
+            if (next->route_tables[mode]) {
+                summary.repaired_sources[mode] = next->repair_route_table(mode, changed[mode], graph);
+            }
+        }
+        if (report) *report = summary;
+        return next;
+    }
+    
+    // This version with the hierarchies dropped by updated() rebuilt.
+    std::shared_ptr<const MetroSystem> with_hierarchies() const {
+        std::shared_ptr<MetroSystem> next(new MetroSystem(*this, graph, network_version));
+        next->build_hierarchies();
+        return next;
+    }
+    
+    // Use a pool of thread_count workers for batch queries and precomputation.
+    // Not safe to call while another thread is running a batch.
+    void set_thread_count(unsigned thread_count) {
+        std::atomic_store(&pool, std::make_shared<WorkStealingPool>(thread_count));
+    }
+    
+    unsigned thread_count() const { return worker_pool().size(); }
+    
+    // Journey by station name. The names are only read during the call.
+    struct RouteQuery {
+        std::string_view start;
+        std::string_view end;
+        bool minimize_time = true;
+    };
+    
+    // Journey by station ID.
+    struct StationQuery {
+        StationId start;
+        StationId end;
+        bool minimize_time = true;
+    };
+    
+    // Answer every query on the worker pool; results are in input order.
+    // Unknown station names give a result with found == false.
+    std::vector<PathResult> find_paths_batch(ArrayView<RouteQuery> queries) const {
+        std::vector<PathResult> results(queries.size());
+        worker_pool().parallel_for(queries.size(), [&](unsigned, size_t i) {
+            int start_idx = graph.find_station(queries[i].start);
+            int end_idx = graph.find_station(queries[i].end);
+            if (start_idx < 0 || end_idx < 0) return;
+            results[i] = find_optimal_path(start_idx, end_idx, queries[i].minimize_time,
+                                           thread_workspace());
+        }, BATCH_GRAIN);
+        return results;
+    }
+    
+    // As above; stations that are not valid() give found == false.
+    std::vector<PathResult> find_paths_batch(ArrayView<StationQuery> queries) const {
+        std::vector<PathResult> results(queries.size());
+        worker_pool().parallel_for(queries.size(), [&](unsigned, size_t i) {
+            results[i] = find_optimal_path(queries[i].start, queries[i].end, 
+                                           queries[i].minimize_time, thread_workspace());
+        }, BATCH_GRAIN);
+        return results;
+    }
+    
+    // Result of one line-aware search from `source` to every station. The
+    // per-station arrays, indexed by StationId::index(), describe the best
+    // route to that station; the per-(station, line) parent labels let
+    // route_in_tree() unroll it.
+    struct ShortestPathTree {
+        StationId source;
+        bool minimize_time = true;
+        size_t lines = 0;
+        std::vector<double> cost;
+        std::vector<double> distance;
+        std::vector<double> time;
+        std::vector<int> interchanges;
+        std::vector<int> arrival_line;
+        std::vector<int> parent;
+        std::vector<LineId> parent_line;
+        
+        bool reachable(StationId station) const { return arrival_line[station.index()] >= 0; }
+    };
+    
+    // Throws std::out_of_range for a source that is not valid().
+    ShortestPathTree one_to_all(StationId source, bool minimize_time) const {
+        if (!valid(source)) {
+            throw std::out_of_range("shortest path tree from an unknown station");
+        }
+        QueryWorkspace& ws = thread_workspace();
+        run_search(source.index(), minimize_time, ws);
+        fill_tree_totals(ws);
+        
+        size_t n = graph.station_count();
+        size_t states = n * graph.line_count;
+        ShortestPathTree tree;
+        tree.source = source;
+        tree.minimize_time = minimize_time;
+        tree.lines = graph.line_count;
+        tree.cost.assign(n, INF);
+        tree.distance.assign(n, 0.0);
+        tree.time.assign(n, 0.0);
+        tree.interchanges.assign(n, 0);
+        tree.arrival_line.assign(n, -1);
+        tree.parent.assign(states, -1);
+        tree.parent_line.assign(states, 0);
+        
+        for (uint32_t s : ws.settled) {
+            tree.parent[s] = ws.parent[s];
+            tree.parent_line[s] = ws.parent_line[s];
+        }
+        
+        for (size_t station = 0; station < n; ++station) {
+            int line = best_arrival_line(static_cast<int>(station), ws);
+            if (static_cast<int>(station) == source.index()) {
+                tree.cost[station] = 0.0;
+                tree.arrival_line[station] = 0;
+            } else if (line >= 0) {
+                size_t s = ws.slot(static_cast<int>(station), static_cast<LineId>(line));
+                tree.cost[station] = ws.cost[s];
+                tree.distance[station] = ws.tree_distance[s];
+                tree.time[station] = ws.tree_time[s];
+                tree.interchanges[station] = ws.tree_interchanges[s];
+                tree.arrival_line[station] = line;
+            }
+        }
+        return tree;
+    }
+    
+    PathResult route_in_tree(const ShortestPathTree& tree, StationId target) const {
+        if (!target.valid() || static_cast<size_t>(target.index()) >= tree.cost.size()) {
+            throw std::out_of_range("route to a station outside the tree");
+        }
+        int target_idx = target.index();
+        PathResult result;
+        if (target == tree.source) {
+            result.path = {target_idx};
+            result.found = true;
+            return result;
+        }
+        if (!tree.reachable(target)) return result;
+        
+        unroll_path(tree.source.index(), target_idx, 
+            static_cast<LineId>(tree.arrival_line[target_idx]),
+            [&](int station, LineId line) {
+                size_t s = static_cast<size_t>(station) * tree.lines + line;
+                return std::make_pair(tree.parent[s], tree.parent_line[s]);
+            }, result);
+        result.total_distance = tree.distance[target_idx];
+        result.total_time = tree.time[target_idx];
+        result.interchanges = tree.interchanges[target_idx];
+        return result;
+    }
+    
+    // Stations within reach of a set of origins: the totals of the fastest
+    // route from any origin, for every station no more than the largest
+    // budget away. Budgets are in minutes and, like total_time, include
+    // interchange penalties. `stations` lists each station once in order
+    // of time, origins first, so the first rings[i] of them are the ones
+    // within budgets[i]; budgets are sorted ascending.
+    struct Isochrone {
+        struct Reach {
+            int station;
+            double time;
+            double distance;
+            int interchanges;
+        };
+        
+        std::vector<double> budgets;
+        std::vector<size_t> rings;
+        std::vector<Reach> stations;
+    };
+    
+
+    // One time search from all origins together that stops expanding at
+    // the largest budget, so its cost depends on the size of the area
+    // reached rather than of the network. An origin that is not valid()
+    // throws std::out_of_range.
+    Isochrone isochrone(ArrayView<StationId> origins, ArrayView<double> budgets) const {
+        std::vector<int> indices;
+        indices.reserve(origins.size());
+        for (StationId origin : origins) indices.push_back(valid(origin) ? origin.index() : -1);
+        return isochrone(ArrayView<int>(indices), budgets);
+    }
+    
+    Isochrone isochrone(StationId origin, ArrayView<double> budgets) const {
+        return isochrone(ArrayView<StationId>(&origin, 1), budgets);
+    }
+    
+    // How many stations each station reaches within each budget (itself
+    // included), for heatmaps: count[station * budgets.size() + i] is the
+    // count within budgets[i], sorted ascending.
+    struct ReachCounts {
+        std::vector<double> budgets;
+        std::vector<uint32_t> count;
+        
+        uint32_t at(StationId station, size_t ring) const { 
+            return count[static_cast<size_t>(station.index()) * budgets.size() + ring]; 
+        }
+    };
+    
+    // isochrone() from every station on its own, on the worker pool.
+    // Only counts are kept, so the totals of the routes are not computed.
+    ReachCounts reach_counts(ArrayView<double> budgets) const {
+        ReachCounts result;
+        result.budgets = sorted_budgets(budgets);
+        size_t n = graph.station_count();
+        size_t rings = result.budgets.size();
+        result.count.assign(n * rings, 0);
+        
+        worker_pool().parallel_for(n, [&](unsigned, size_t origin) {
+            int source = static_cast<int>(origin);
+            QueryWorkspace& ws = thread_workspace();
+            bounded_search(ArrayView<int>(&source, 1), result.budgets.back(), ws);
+            ws.reach(source);
+            
+            uint32_t* count = result.count.data() + origin * rings;
+            uint32_t reached = 1;
+            size_t ring = 0;
+            for (uint32_t s : ws.settled) {  // in order of cost, which is time here
+                int station = static_cast<int>(s / ws.lines);
+                if (!ws.reach(station)) continue;
+                for (; ws.cost[s] > result.budgets[ring]; ++ring) count[ring] = reached;
+                ++reached;
+            }
+            for (; ring < rings; ++ring) count[ring] = reached;
+        }, BATCH_GRAIN);
+        return result;
+    }
+    
+    // Trips from one station to another, for assign_demand.
+    struct Demand {
+        StationId origin;
+        StationId destination;
+        double trips;
+    };
+    
+    // Load that routes put on the network. through[v] counts the trips that
+    // pass through station v without starting or ending there, transfers[v]
+    // those that change lines at v, and segment[e] those that ride the
+    // directed segment e (an index into the snapshot's edges). Trips
+    // between stations with no route are counted as unassigned.
+    struct NetworkLoad {
+        std::vector<double> through;
+        std::vector<double> transfers;
+        std::vector<double> segment;
+        double assigned = 0;
+        double unassigned = 0;
+        size_t searches = 0;
+    };
+    
+    // Put every trip on its optimal route (the one find_optimal_path gives,
+    // up to ties between routes of equal cost): one search per distinct
+    // origin on the worker pool.
+    NetworkLoad assign_demand(ArrayView<Demand> demand, bool minimize_time = true) const {
+        struct Row {
+            int origin;
+            int destination;
+            double trips;
+        };
+        std::vector<Row> rows;
+        rows.reserve(demand.size());
+        for (const Demand& trip : demand) {
+            if (!valid(trip.origin) || !valid(trip.destination)) {
+                throw std::out_of_range("demand names an unknown station");
+            }
+            if (!(trip.trips >= 0) || !std::isfinite(trip.trips)) {
+                throw std::invalid_argument("demand must be a non-negative number of trips");
+            }
+            if (trip.trips > 0 && trip.origin != trip.destination) {
+                rows.push_back({trip.origin.index(), trip.destination.index(), trip.trips});
+            }
+        }
+        std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+            return a.origin < b.origin;
+        });
+        
+        std::vector<int> origins;
+        std::vector<size_t> offsets;
+        for (size_t i = 0; i < rows.size(); ++i) {
+            if (i == 0 || rows[i].origin != rows[i - 1].origin) {
+                origins.push_back(rows[i].origin);
+                offsets.push_back(i);
+            }
+        }
+        offsets.push_back(rows.size());
+        return accumulate_load(origins, minimize_time, [&](size_t i, std::vector<double>& to) {
+            for (size_t r = offsets[i]; r < offsets[i + 1]; ++r) to[rows[r].destination] += rows[r].trips;
+            return [&, i](std::vector<double>& to) {
+                for (size_t r = offsets[i]; r < offsets[i + 1]; ++r) to[rows[r].destination] = 0;
+            };
+        });
+    }
+    
+    // Read an origin/destination demand matrix, one record per line ('#'
+    // starts a comment):
+    //   <from station>,<to station>,<trips>
+    std::vector<Demand> load_demand(std::istream& in) const {
+        std::vector<Demand> demand;
+        std::string record;
+        std::string_view fields[3];
+        size_t line_number = 0;
+        
+        auto fail = [&](const std::string& reason) {
+            throw std::runtime_error("demand line " + std::to_string(line_number) + ": " + reason);
+        };
+        
+        while (std::getline(in, record)) {
+            ++line_number;
+            std::string_view text = record;
+            text = text.substr(0, text.find('#'));
+            if (text.find_first_not_of(" \t\r") == std::string_view::npos) continue;
+            
+            if (split_fields(text, fields, 3) != 3) fail("expected <from>,<to>,<trips>");
+            Demand trip{station_id(fields[0]), station_id(fields[1]), 0.0};
+            if (!trip.origin.valid()) fail("unknown station: " + std::string(fields[0]));
+            if (!trip.destination.valid()) fail("unknown station: " + std::string(fields[1]));
+            auto [end, ec] = std::from_chars(fields[2].data(), fields[2].data() + fields[2].size(), 
+                                             trip.trips);
+            if (ec != std::errc() || end != fields[2].data() + fields[2].size() || 
+                !(trip.trips >= 0) || !std::isfinite(trip.trips)) {
+                fail("trips must be a non-negative number");
+            }
+            demand.push_back(trip);
+        }
+        return demand;
+    }
+    
+    // Betweenness over the (station, line) graph: one trip between every
+    // ordered pair of stations, assigned as above. With 0 < sample < the
+    // number of stations, only that many randomly chosen origins are
+    // searched and their loads scaled up to estimate the total.
+    NetworkLoad betweenness(size_t sample = 0, bool minimize_time = true, unsigned seed = 1) const {
+        size_t n = graph.station_count();
+        std::vector<int> origins(n);
+        std::iota(origins.begin(), origins.end(), 0);
+        double weight = 1.0;
+        if (sample > 0 && sample < n) {
+            std::mt19937 rng(seed);
+            for (size_t i = 0; i < sample; ++i) {
+                std::swap(origins[i], origins[i + rng() % (n - i)]);
+            }
+            origins.resize(sample);
+            std::sort(origins.begin(), origins.end());
+            weight = static_cast<double>(n) / sample;
+        }
+        return accumulate_load(origins, minimize_time, [&](size_t i, std::vector<double>& to) {
+            std::fill(to.begin(), to.end(), weight);
+            to[origins[i]] = 0;
+            return [](std::vector<double>&) {};
+        });
+    }
+    
+    // Route costs and totals for every (source, target) pair, row-major by
+    // source. Unreachable cells have cost INF.
+    struct RouteMatrix {
+        size_t rows = 0;
+        size_t cols = 0;
+        std::vector<float> cost;
+        std::vector<float> distance;
+        std::vector<float> time;
+        std::vector<uint8_t> interchanges;
+        size_t searches = 0;
+        
+        size_t cell(size_t row, size_t col) const { return row * cols + col; }
+    };
+    
+    // Fill the matrix with one search per distinct source, or, when there
+    // are fewer distinct targets, one search per distinct target. Every
+    // segment is stored in both directions with the same weights and the
+    // interchange penalty does not depend on direction, so the search from
+    // a target yields the cost of reaching it from every station. Throws
+    // std::out_of_range if a source or target is not valid().
+    RouteMatrix many_to_many(ArrayView<StationId> sources, ArrayView<StationId> targets, 
+                             bool minimize_time) const {
+        std::vector<int> source_indices, target_indices;
+        for (auto [stations, indices] : {std::make_pair(sources, &source_indices), 
+                                         std::make_pair(targets, &target_indices)}) {
+            indices->reserve(stations.size());
+            for (StationId station : stations) {
+                if (!valid(station)) throw std::out_of_range("route matrix names an unknown station");
+                indices->push_back(station.index());
+            }
+        }
+        return many_to_many(ArrayView<int>(source_indices), ArrayView<int>(target_indices), 
+                            minimize_time);
+    }
+    
+    // Parse "HH:MM" into seconds after midnight. Hours may exceed 23 for
+    // services that run past midnight.
+    static bool parse_clock(std::string_view text, uint32_t& seconds) {
+        uint32_t hours = 0, minutes = 0;
+        size_t colon = text.find(':');
+        if (colon == std::string_view::npos || colon == 0 || text.size() - colon != 3) return false;
+        auto [h_end, h_ec] = std::from_chars(text.data(), text.data() + colon, hours);
+        auto [m_end, m_ec] = std::from_chars(text.data() + colon + 1, text.data() + text.size(), minutes);
+        if (h_ec != std::errc() || h_end != text.data() + colon || m_ec != std::errc() ||
+            m_end != text.data() + text.size() || hours > 47 || minutes > 59) {
+            return false;
+        }
+        seconds = hours * 3600 + minutes * 60;
+        return true;
+    }
+    
+    static std::string format_clock(uint32_t seconds) {
+        char text[16];
+        std::snprintf(text, sizeof(text), "%02u:%02u", seconds / 3600, seconds / 60 % 60);
+        return text;
+    }
+    
+    // One train ride of a timetabled journey.
+    struct JourneyLeg {
+        LineId line;
+        int from;
+        int to;
+        uint32_t departure;
+        uint32_t arrival;
+    };
+    
+    struct Journey {
+        std::vector<JourneyLeg> legs;
+        uint32_t departure = 0;
+        uint32_t arrival = 0;
+        bool found = false;
+    };
+    
+    // Scratch space for timetable queries, one per thread like
+    // QueryWorkspace. Per-station labels and per-trip connections are
+    // stamped with a generation counter instead of being cleared.
+    class JourneyWorkspace {
+    public:
+        constexpr static uint32_t NONE = 0xFFFFFFFF;
+        
+        void prepare(size_t station_count, size_t trip_count) {
+            if (station_stamp.size() < station_count) {
+                time.resize(station_count);
+                board.resize(station_count);
+                alight.resize(station_count);
+                station_stamp.resize(station_count, 0);
+            }
+            if (trip_stamp.size() < trip_count) {
+                trip_connection.resize(trip_count);
+                trip_stamp.resize(trip_count, 0);
+            }
+            if (++generation == 0) {
+                std::fill(station_stamp.begin(), station_stamp.end(), 0);
+                std::fill(trip_stamp.begin(), trip_stamp.end(), 0);
+                generation = 1;
+            }
+        }
+        
+        bool reached(uint32_t station) const { return station_stamp[station] == generation; }
+        
+        // Label a station with a time and the connections that board and
+        // leave the train of the leg that attains it.
+        void reach(uint32_t station, uint32_t t, uint32_t board_at, uint32_t alight_at) {
+            station_stamp[station] = generation;
+            time[station] = t;
+            board[station] = board_at;
+            alight[station] = alight_at;
+        }
+        
+        uint32_t trip_at(uint32_t trip) const {
+            return trip_stamp[trip] == generation ? trip_connection[trip] : NONE;
+        }
+        
+        void set_trip(uint32_t trip, uint32_t connection) {
+            trip_stamp[trip] = generation;
+            trip_connection[trip] = connection;
+        }
+        
+        std::vector<uint32_t> time;
+        std::vector<uint32_t> board;
+        std::vector<uint32_t> alight;
+        std::vector<uint32_t> station_stamp;
+        std::vector<uint32_t> trip_connection;
+        std::vector<uint32_t> trip_stamp;
+        uint32_t generation = 0;
+        uint64_t scanned = 0;
+    };
+    
+    static JourneyWorkspace& thread_journey_workspace() {
+        thread_local JourneyWorkspace workspace;
+        return workspace;
+    }
+    
+    // Earliest arrival at end for a traveller ready to leave start at
+    // `time` (seconds after midnight). Connection Scan: one pass over the
+    // connections departing from `time` on, in departure order, that stops
+    // once they leave after the best arrival at the destination so far.
+    // No journey when either station is not valid().
+    Journey depart_at(StationId start, StationId end, uint32_t time) const {
+        return depart_at(start, end, time, thread_journey_workspace());
+    }
+    
+    Journey depart_at(StationId start, StationId end, uint32_t time, JourneyWorkspace& ws) const {
+        if (!valid(start) || !valid(end)) return Journey();
+        return depart_at(start.index(), end.index(), time, ws);
+    }
+    
+    // Latest departure from start that reaches end by `time`: the same
+    // scan run backwards over the connections in arrival order.
+    Journey arrive_by(StationId start, StationId end, uint32_t time) const {
+        return arrive_by(start, end, time, thread_journey_workspace());
+    }
+    
+    Journey arrive_by(StationId start, StationId end, uint32_t time, JourneyWorkspace& ws) const {
+        if (!valid(start) || !valid(end)) return Journey();
+        return arrive_by(start.index(), end.index(), time, ws);
+    }
+    
+    void display_journey(const Journey& journey) const {
+        if (!journey.found) {
+            std::cout << "❌ No train gets there at that time.\n";
+            return;
+        }
+        
+        std::cout << "\n" << std::string(70, '=') << "\n";
+        std::cout << "🕐 TIMETABLED JOURNEY\n";
+        std::cout << std::string(70, '=') << "\n\n";
+        
+        for (size_t i = 0; i < journey.legs.size(); ++i) {
+            const JourneyLeg& leg = journey.legs[i];
+            if (i > 0) {
+                uint32_t wait = leg.departure - journey.legs[i - 1].arrival;
+                std::cout << "\n   🔄 INTERCHANGE at " << graph.name(leg.from) << " (" 
+                          << wait / 60 << " min)\n\n";
+            }
+            std::cout << "🚀 " << format_clock(leg.departure) << "  Board " 
+                      << get_line_emoji(leg.line) << " " << get_line_name(leg.line) 
+                      << " at " << graph.name(leg.from) << "\n";
+            std::cout << "🏁 " << format_clock(leg.arrival) << "  Alight at " 
+                      << graph.name(leg.to) << "\n";
+        }
+        
+        std::cout << "\n" << std::string(70, '=') << "\n";
+        std::cout << "📊 JOURNEY SUMMARY\n";
+        std::cout << std::string(70, '=') << "\n";
+        std::cout << "🚀 Departure: " << format_clock(journey.departure) << "\n";
+        std::cout << "🏁 Arrival: " << format_clock(journey.arrival) << "\n";
+        std::cout << "⏱️  Travel Time: " << (journey.arrival - journey.departure) / 60 
+                  << " minutes\n";
+        std::cout << "🔄 Interchanges: " << (journey.legs.empty() ? 0 : journey.legs.size() - 1) 
+                  << "\n";
+        std::cout << std::string(70, '=') << "\n";
+    }
+    
+    // Append a route as the members of a JSON object (without braces):
+    // totals, the stations in order and the line ridden between each
+    // consecutive pair.
+    void append_json(std::string& out, const PathResult& result) const {
+        out += "\"found\":";
+        out += result.found ? "true" : "false";
+        if (!result.found) return;
+        out += ",\"total_time\":";
+        JsonFields::append_number(out, result.total_time, 2);
+        out += ",\"total_distance\":";
+        JsonFields::append_number(out, result.total_distance, 2);
+        out += ",\"interchanges\":";
+        out += std::to_string(result.interchanges);
+        out += ",\"stations\":[";
+        for (size_t i = 0; i < result.path.size(); ++i) {
+            if (i > 0) out.push_back(',');
+            JsonFields::append_string(out, graph.name(result.path[i]));
+        }
+        out += "],\"lines\":[";
+        for (size_t i = 0; i < result.path_lines.size(); ++i) {
+            if (i > 0) out.push_back(',');
+            JsonFields::append_string(out, graph.line_name(result.path_lines[i]));
+        }
+        out.push_back(']');
+    }
+    
+    void display_path(const PathResult& result, const std::string& title = "OPTIMAL ROUTE FOUND") const {
+        if (!result.found) {
+            std::cout << "❌ No route found between specified stations.\n";
+            return;
+        }
+        
+        std::cout << "\n" << std::string(70, '=') << "\n";
+        std::cout << "🚇 " << title << "\n";
+        std::cout << std::string(70, '=') << "\n\n";
+        
+        LineId current_line = 0;
+        bool first_station = true;
+        
+        for (size_t i = 0; i < result.path.size(); ++i) {
+            int station = result.path[i];
+            
+            if (i < result.path_lines.size()) {
+                LineId line = result.path_lines[i];
+                
+                if (first_station || current_line != line) {
+                    if (!first_station) {
+                        std::cout << "\n   🔄 INTERCHANGE → " 
+                                  << get_line_emoji(line) << " " 
+                                  << get_line_name(line) << "\n\n";
+                    } else {
+                        std::cout << "🚀 Board " << get_line_emoji(line) 
+                                  << " " << get_line_name(line) << "\n\n";
+                    }
+                    current_line = line;
+                    first_station = false;
+                }
+            }
+            
+            std::cout << get_line_emoji(current_line) << " " 
+                      << std::setw(2) << (i + 1) << ". " << graph.name(station);
+            
+            if (is_interchange(StationId(station))) {
+                std::cout << " 🔄";
+            }
+            std::cout << "\n";
+            
+            if (i < result.path.size() - 1) {
+                std::cout << "     |\n";
+            }
+        }
+        
+        std::cout << "\n" << std::string(70, '=') << "\n";
+        std::cout << "📊 JOURNEY SUMMARY\n";
+        std::cout << std::string(70, '=') << "\n";
+        std::cout << "🗺️  Total Distance: " << std::fixed << std::setprecision(1) 
+                  << result.total_distance << " km\n";
+        std::cout << "⏱️  Estimated Time: " << std::fixed << std::setprecision(0) 
+                  << result.total_time << " minutes\n";
+        std::cout << "🚉 Total Stations: " << result.path.size() << "\n";
+        std::cout << "🔄 Interchanges: " << result.interchanges << "\n";
+        
+        if (result.interchanges > 0) {
+            std::cout << "💡 Tip: Allow extra 2-3 minutes for each interchange\n";
+        }
+        
+        std::cout << std::string(70, '=') << "\n";
+    }
+    
+    void display_network_stats() const {
+        std::cout << "\n🚇 PUNE METRO NETWORK STATISTICS\n";
+        std::cout << std::string(50, '=') << "\n";
+        std::cout << "Total Stations: " << graph.station_count() << "\n";
+        
+        std::vector<int> line_counts(graph.line_count, 0);
+        int interchange_count = 0;
+        
+        for (LineMask lines : graph.station_lines) {
+            for (LineMask rest = lines; rest; rest &= rest - 1) {
+                line_counts[__builtin_ctzll(rest)]++;
+            }
+            if (lines & (lines - 1)) interchange_count++;
+        }
+        
+        for (size_t l = 0; l < line_counts.size(); ++l) {
+            auto line = static_cast<LineId>(l);
+            std::cout << get_line_emoji(line) << " " << get_line_name(line) << ": " 
+                      << line_counts[l] << " stations\n";
+        }
+        std::cout << "🔄 Interchange Stations: " << interchange_count << "\n";
+        std::cout << std::string(50, '=') << "\n\n";
+    }
+    
+    // Every station, and the stations of one line, in name order. Both
+    // are views of lists built once on first use.
+    ArrayView<StationId> all_stations() const { return station_lists().all(); }
+    ArrayView<StationId> stations_on_line(LineId line) const { return station_lists().on_line(line); }
+    
+    // Copies of the names in all_stations() and stations_on_line().
+    std::vector<std::string> get_all_stations() const {
+        return station_names_of(all_stations());
+    }
+    
+    std::vector<std::string> get_stations_by_line(LineId line) const {
+        return station_names_of(stations_on_line(line));
+    }
+    
+    // Best `limit` stations for a partial or misspelt name; see
+    // StationNameIndex::search for the ranking.
+    std::vector<std::string> search_stations(std::string_view query, size_t limit = 10) const {
+        std::vector<StationNameIndex::Match> found;
+        name_index().search(query, limit, found);
+        
+        std::vector<std::string> matches;
+        matches.reserve(found.size());
+        for (const auto& match : found) {
+            matches.emplace_back(graph.name(match.station));
+        }
+        return matches;
+    }
+    
+    // Autocomplete entry point: fills `out` with station indices and
+    // allocates nothing once `out` has room for `limit` matches.
+    size_t search_stations(std::string_view query, size_t limit, 
+                           std::vector<StationNameIndex::Match>& out) const {
+        return name_index().search(query, limit, out);
+    }
+    
+    // Built on first use, since only interactive front ends search by name.
+    const StationNameIndex& name_index() const {
+        auto current = std::atomic_load(&station_names);
+        if (!current) {
+            auto created = std::make_shared<const StationNameIndex>(graph);
+            if (std::atomic_compare_exchange_strong(&station_names, &current, created)) {
+                current = std::move(created);
+            }
+        }
+        return *current;
+    }
+    
+    const StationLists& station_lists() const {
+        auto current = std::atomic_load(&line_stations);
+        if (!current) {
+            auto created = std::make_shared<const StationLists>(graph);
+            if (std::atomic_compare_exchange_strong(&line_stations, &current, created)) {
+                current = std::move(created);
+            }
+        }
+        return *current;
+    }
+    
+    // Up to k routes from start to end, the optimal one first, each
+    // meaningfully different from those before it: it costs at most
+    // max_stretch times the optimum, shares at most max_overlap of its
+    // length with any earlier route and visits no station twice. Empty
+    // when there is no route at all. The defaults are the usual ones for
+    // via-route alternatives.
+    //
+    // Alternatives are via routes: the best route from start to a station
+    // v joined to the best route from v to end. The forward search that
+    // finds the optimal route carries on, and one backward search joins
+    // it; each settles only the states that can lie on a route within the
+    // stretch bound, and stops after a fixed multiple of the states the
+    // optimal route took. Only the cheapest few vias per route asked for
+    // are unrolled and checked, so k = 5 costs a few single queries, not
+    // five; the price is that an alternative within the limits is
+    // sometimes missed. Route tables and hierarchies are not used. Empty
+    // as well when either station is not valid().
+    std::vector<PathResult> find_alternative_routes(StationId start, StationId end, size_t k, 
+                                                    bool minimize_time, QueryWorkspace& fwd, 
+                                                    QueryWorkspace& bwd, double max_stretch = 1.25,
+                                                    double max_overlap = 0.8) const {
+        if (!valid(start) || !valid(end)) return {};
+        return find_alternative_routes(start.index(), end.index(), k, minimize_time, fwd, bwd,
+                                       max_stretch, max_overlap);
+    }
+    
+    std::vector<PathResult> find_alternative_routes(std::string_view start, std::string_view end,
+                                                    size_t k = 3, bool minimize_time = true) const {
+        return find_alternative_routes(station_id(start), station_id(end), k, minimize_time);
+    }
+    
+    std::vector<PathResult> find_alternative_routes(StationId start, StationId end,
+                                                    size_t k = 3, bool minimize_time = true) const {
+        if (!valid(start) || !valid(end)) return {};
+        int start_idx = start.index();
+        int end_idx = end.index();
+        if (!route_cache || k >= RouteCache::MAX_ALTERNATIVES) {
+            return find_alternative_routes(start, end, k, minimize_time, 
+                                           thread_workspace(), thread_backward_workspace());
+        }
+        
+        uint64_t key = RouteCache::alternatives_key(start_idx, end_idx, minimize_time, k);
+        std::vector<PathResult> routes;
+        EngineMetrics::Probe hit(EngineMetrics::ALTERNATIVES);
+        if (route_cache->find(key, cache_generation, routes)) return routes;
+        hit.dismiss();
+        routes = find_alternative_routes(start, end, k, minimize_time, 
+                                         thread_workspace(), thread_backward_workspace());
+        route_cache->store(key, cache_generation, routes.data(), routes.size());
+        return routes;
+    }
+    
+    // Scratch space for find_pareto_routes, one per thread like
+    // QueryWorkspace. Labels live in one arena that later queries reuse;
+    // every (station, line) state links the labels no other label there
+    // dominates into a bag, whose head is stamped with a generation
+    // counter instead of being cleared.
+    class ParetoWorkspace {
+    public:
+        constexpr static uint32_t NONE = 0xFFFFFFFF;
+        // Totals are summed in 64-bit fixed point, 1/SCALE of a minute,
+        // kilometre or rupee, so no route comes near overflowing them, and
+        // compared in steps of 2^STEP_BITS of those, about a thousandth.
+        constexpr static double SCALE = 65536.0;
+        constexpr static int STEP_BITS = 6;
+        
+        static uint64_t fixed(double value) {
+            return static_cast<uint64_t>(std::llround(value * SCALE));
+        }
+        
+        static uint64_t step(uint64_t total) {
+            return (total + (uint64_t(1) << (STEP_BITS - 1))) >> STEP_BITS;
+        }
+        
+        // A route so far: its totals, the label it extends and the state it
+        // reached. Kept to 40 bytes; a search may create millions.
+        struct Label {
+            uint64_t time;  // interchange penalties included
+            uint64_t distance;
+            uint64_t fare;
+            uint32_t parent;
+            uint32_t next;  // next label in the same bag
+            uint32_t station;
+            LineId line;
+            uint8_t interchanges;
+            bool dead;  // dominated after it was queued
+            
+            // A total is exact whatever order a route adds its segments in,
+            // and rounded to a step two routes of the same cost all but
+            // never tell apart. Unlike a tolerance, comparing the steps is
+            // transitive, so the labels that survive do not depend on the
+            // order they arrive in; of equal labels the first is kept.
+            bool dominates(const Label& other) const {
+                return step(time) <= step(other.time) && 
+                       step(distance) <= step(other.distance) &&
+                       step(fare) <= step(other.fare) && interchanges <= other.interchanges;
+            }
+        };
+        
+        void prepare(size_t station_count, size_t line_count) {
+            lines = line_count;
+            size_t states = station_count * line_count;
+            if (bag_stamp.size() < states) {
+                bag_head.resize(states);
+                bag_stamp.resize(states, 0);
+                if constexpr (METRICS_ENABLED) ++counters.allocations;
+            }
+            if (++generation == 0) {
+                std::fill(bag_stamp.begin(), bag_stamp.end(), 0);
+                generation = 1;
+            }
+            labels.clear();
+            heap.clear();
+            targets.clear();
+            truncated = false;
+        }
+        
+        uint32_t& bag(uint32_t station, LineId line) {
+            size_t s = station * lines + line;
+            if (bag_stamp[s] != generation) {
+                bag_stamp[s] = generation;
+                bag_head[s] = NONE;
+            }
+            return bag_head[s];
+        }
+        
+        void push(uint64_t time, uint32_t label) {
+            if constexpr (METRICS_ENABLED) {
+                ++counters.pushes;
+                if (heap.size() == heap.capacity()) ++counters.allocations;
+                counters.peak_queue = std::max<uint64_t>(counters.peak_queue, heap.size() + 1);
+            }
+            heap.emplace_back(time, label);
+            std::push_heap(heap.begin(), heap.end(), std::greater<>());
+        }
+        
+        uint32_t pop() {
+            if constexpr (METRICS_ENABLED) ++counters.pops;
+            std::pop_heap(heap.begin(), heap.end(), std::greater<>());
+            uint32_t label = heap.back().second;
+            heap.pop_back();
+            return label;
+        }
+        
+        std::vector<Label> labels;
+        std::vector<std::pair<uint64_t, uint32_t>> heap;
+        std::vector<uint32_t> targets;  // labels at the destination
+        std::vector<uint32_t> bag_head;
+        std::vector<uint32_t> bag_stamp;
+        size_t lines = 0;
+        uint32_t generation = 0;
+        uint64_t settled = 0;
+        bool truncated = false;
+        SearchCounters counters;
+    };
+    
+    static ParetoWorkspace& thread_pareto_workspace() {
+        thread_local ParetoWorkspace workspace;
+        return workspace;
+    }
+    
+    struct ParetoRoute {
+        PathResult route;
+        double fare;
+    };
+    
+    // Every route from start to end that no other route beats on all of
+    // travel time (interchange penalties included), distance, interchanges
+    // and fare, fastest first. Equal routes are reported once.
+    //
+    // One multi-label search finds them all. Labels are settled in order
+    // of time (plus the A* bound when stations have coordinates), which
+    // never decreases along a route, so a label that no label at its state
+    // dominates when it is settled is final. Labels that a route already
+    // found dominates are dropped, which bounds the search by the slowest
+    // useful route. A search that would create more
+    // than max_labels labels stops early with ws.truncated set; its routes
+    // are then non-dominated among themselves but may be incomplete.
+    // Closed segments are avoided; route tables and hierarchies are not
+    // used. No routes when either station is not valid().
+    std::vector<ParetoRoute> find_pareto_routes(StationId start, StationId end, ParetoWorkspace& ws,
+                                                size_t max_labels = size_t(1) << 24) const {
+        if (!valid(start) || !valid(end)) return {};
+        return find_pareto_routes(start.index(), end.index(), ws, max_labels);
+    }
+    
+    std::vector<ParetoRoute> find_pareto_routes(std::string_view start, std::string_view end) const {
+        return find_pareto_routes(station_id(start), station_id(end));
+    }
+    
+    std::vector<ParetoRoute> find_pareto_routes(StationId start, StationId end) const {
+        return find_pareto_routes(start, end, thread_pareto_workspace());
+    }
+    
+    // Ticket cost of a route: each line's per-kilometre price, plus its
+    // boarding price whenever the route boards it from another fare group.
+    // Zero when the network has no fares.
+    double route_fare(const PathResult& route) const {
+        double fare = 0;
+        for (size_t i = 0; i + 1 < route.path.size(); ++i) {
+            int e = graph.find_edge(route.path[i], route.path[i + 1], route.path_lines[i]);
+            if (e >= 0) fare += segment_fare(e, i == 0 ? -1 : route.path_lines[i - 1]);
+        }
+        return fare;
+    }
+    
+    void display_route_tradeoffs(const std::vector<ParetoRoute>& routes) const {
+        if (routes.empty()) {
+            std::cout << "❌ No route found between specified stations.\n";
+            return;
+        }
+        
+        std::cout << "\n" << std::string(70, '=') << "\n";
+        std::cout << "⚖️  ROUTE TRADE-OFFS (none is beaten on every count)\n";
+        std::cout << std::string(70, '=') << "\n";
+        for (size_t i = 0; i < routes.size(); ++i) {
+            const PathResult& route = routes[i].route;
+            std::cout << "\n" << (i + 1) << ". ⏱️  " << std::fixed << std::setprecision(0) 
+                      << route.total_time << " min   🗺️  " << std::setprecision(1) 
+                      << route.total_distance << " km   🔄 " << route.interchanges;
+            if (!graph.line_fares.empty()) {
+                std::cout << "   🎫 ₹" << std::setprecision(2) << routes[i].fare;
+            }
+            std::cout << "\n   ";
+            for (size_t k = 0; k < route.path_lines.size(); ++k) {
+                if (k > 0 && route.path_lines[k] == route.path_lines[k - 1]) continue;
+                std::cout << get_line_emoji(route.path_lines[k]) << " " 
+                          << graph.name(route.path[k]) << " → ";
+            }
+            std::cout << graph.name(route.path.back()) << "\n";
+        }
+        std::cout << std::string(70, '=') << "\n";
+    }
+    
+    // The `top` busiest stations, interchanges and segments of a load.
+    void display_network_load(const NetworkLoad& load, size_t top = 10) const {
+        auto busiest = [&](const std::vector<double>& values) {
+            std::vector<uint32_t> order;
+            for (size_t i = 0; i < values.size(); ++i) {
+                if (values[i] > 0) order.push_back(static_cast<uint32_t>(i));
+            }
+            size_t shown = std::min(top, order.size());
+            std::partial_sort(order.begin(), order.begin() + shown, order.end(), 
+                              [&](uint32_t a, uint32_t b) { return values[a] > values[b]; });
+            order.resize(shown);
+            return order;
+        };
+        
+        std::cout << "\n" << std::string(70, '=') << "\n";
+        std::cout << "📈 NETWORK LOAD (" << std::fixed << std::setprecision(0) << load.assigned 
+                  << " trips routed, " << load.unassigned << " without a route, " 
+                  << load.searches << " searches)\n";
+        std::cout << std::string(70, '=') << "\n";
+        
+        std::cout << "\n🚉 Busiest stations (trips passing through):\n";
+        for (uint32_t v : busiest(load.through)) {
+            std::cout << "   " << std::setw(12) << load.through[v] << "  " << graph.name(v) << "\n";
+        }
+        std::cout << "\n🔄 Busiest interchanges (trips changing lines):\n";
+        for (uint32_t v : busiest(load.transfers)) {
+            std::cout << "   " << std::setw(12) << load.transfers[v] << "  " << graph.name(v) << "\n";
+        }
+        std::cout << "\n🛤️  Busiest segments (trips riding them):\n";
+        for (uint32_t e : busiest(load.segment)) {
+            int from = static_cast<int>(std::upper_bound(graph.offsets.begin(), graph.offsets.end(), e) - 
+                                        graph.offsets.begin() - 1);
+            auto line = static_cast<LineId>(graph.edge_line[e]);
+            std::cout << "   " << std::setw(12) << load.segment[e] << "  " << get_line_emoji(line) 
+                      << " " << graph.name(from) << " → " << graph.name(graph.edge_to[e]) << "\n";
+        }
+        std::cout << std::string(70, '=') << "\n";
+    }
+    
+    void display_isochrone(const Isochrone& isochrone) const {
+        std::cout << "\n" << std::string(70, '=') << "\n";
+        std::cout << "🎯 STATIONS WITHIN REACH\n";
+        std::cout << std::string(70, '=') << "\n";
+        size_t shown = 0;
+        for (size_t ring = 0; ring < isochrone.budgets.size(); ++ring) {
+            if (ring > 0 && isochrone.rings[ring] == isochrone.rings[ring - 1]) continue;
+            std::cout << "\n⏱️  Within " << std::fixed << std::setprecision(0) 
+                      << isochrone.budgets[ring] << " min (" << isochrone.rings[ring] 
+                      << " stations):\n";
+            for (; shown < isochrone.rings[ring]; ++shown) {
+                const auto& reach = isochrone.stations[shown];
+                std::cout << "   " << std::setw(4) << std::setprecision(1) << reach.time << " min  "
+                          << std::setw(5) << reach.distance << " km  🔄 " << reach.interchanges 
+                          << "  " << graph.name(reach.station) << "\n";
+            }
+        }
+        std::cout << std::string(70, '=') << "\n";
+    }
+
+private:
+    constexpr static size_t BATCH_GRAIN = 32;
+    constexpr static size_t SMALL_QUEUE_STATES = 4096;
+    constexpr static double RADIX_STATES_PER_UNIT = 64;
+    constexpr static size_t VECTOR_MIN_DEGREE = 12;
+    // find_alternative_routes spends about this many times the states the
+    // optimal route took on its forward and backward searches, and builds
+    // at most this many candidate routes per route asked for.
+    constexpr static double VIA_FORWARD_WORK = 1.25;
+    constexpr static double VIA_BACKWARD_WORK = 0.5;
+    constexpr static size_t VIAS_PRICED_PER_ROUTE = 3;
+    
+    std::shared_ptr<const RouteTable> route_tables[2];
+    std::shared_ptr<const ContractionHierarchy> hierarchies[2];
+    mutable std::shared_ptr<WorkStealingPool> pool;
+    mutable std::shared_ptr<const StationNameIndex> station_names;
+    mutable std::shared_ptr<const StationLists> line_stations;
+    std::shared_ptr<RouteCache> route_cache;
+    // Tags the routes this system stores in route_cache. Unlike
+    // network_version it is unique to this object: two updated() calls on
+    // one base are both its version + 1, but not the same network.
+    const uint64_t cache_generation = next_cache_generation();
+    SearchAlgorithm search_algorithm = SearchAlgorithm::ASTAR;
+    bool vector_relaxation = false;
+    bool vector_relaxation_fixed = false;
+    SearchQueue::Kind queue_kinds[2] = {SearchQueue::Kind::BINARY_HEAP, 
+                                        SearchQueue::Kind::BINARY_HEAP};
+    bool queue_kinds_fixed = false;
+    
+    // Pick how searches run on this network, as measured by pune_metro_bench.
+    // Relaxing four segments at a time pays only when stations have many:
+    // at 4 per station it is some 5% slower, at 32 some 12% faster.
+    // The queue of each cost mode follows from the network size and the
+    // segment weights. A search's queue holds keys within one step (the
+    // largest segment weight plus an interchange) of each other. Up to a
+    // few thousand states the binary heap is as fast as anything; the 4-ary
+    // heap saves the stale pops while its per-state positions stay in
+    // cache; the radix heap wins once there are many states per fixed-point
+    // unit of that step, as the queue then spreads over few buckets.
+    void choose_search_defaults() {
+        if (!vector_relaxation_fixed) {
+            vector_relaxation = SIMD_RELAXATION && 
+                                graph.edge_count() >= VECTOR_MIN_DEGREE * graph.station_count();
+        }
+        
+        if (queue_kinds_fixed) return;
+        size_t states = graph.station_count() * graph.line_count;
+        for (int mode = 0; mode < 2; ++mode) {
+            const auto& weights = mode == 0 ? graph.edge_time : graph.edge_distance;
+            double step = 0;
+            for (float w : weights) {
+                if (w != INF) step = std::max(step, static_cast<double>(w));
+            }
+            step += mode == 0 ? INTERCHANGE_PENALTY : 0.5;
+            if (states < SMALL_QUEUE_STATES) {
+                queue_kinds[mode] = SearchQueue::Kind::BINARY_HEAP;
+            } else if (states >= RADIX_STATES_PER_UNIT * step * SearchQueue::FIXED_POINT_SCALE) {
+                queue_kinds[mode] = SearchQueue::Kind::RADIX_HEAP;
+            } else {
+                queue_kinds[mode] = SearchQueue::Kind::DARY_HEAP;
+            }
+        }
+    }
+    
+    static uint64_t next_cache_generation() {
+        static std::atomic<uint64_t> generations{0};
+        return generations.fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    // The pool is created on first use with one worker per hardware thread.
+    WorkStealingPool& worker_pool() const {
+        auto current = std::atomic_load(&pool);
+        if (!current) {
+            auto created = std::make_shared<WorkStealingPool>(
+                std::max(std::thread::hardware_concurrency(), 1u));
+            if (std::atomic_compare_exchange_strong(&pool, &current, created)) {
+                current = std::move(created);
+            }
+        }
+        return *current;
+    }
+    
+    // Successor version for updated() and with_hierarchies(): everything is
+    // shared with `base` except the graph passed in.
+    MetroSystem(const MetroSystem& base, NetworkGraph next_graph, uint64_t version) {
+        graph = std::move(next_graph);
+        planned = base.planned;
+        network_version = version;
+        service_timetable = base.service_timetable;
+        planned_timetable = base.planned_timetable;
+        for (int mode = 0; mode < 2; ++mode) {
+            route_tables[mode] = base.route_tables[mode];
+            hierarchies[mode] = base.hierarchies[mode];
+        }
+        pool = std::atomic_load(&base.pool);
+        station_names = std::atomic_load(&base.station_names);
+        line_stations = std::atomic_load(&base.line_stations);
+        route_cache = base.route_cache;
+        search_algorithm = base.search_algorithm;
+        vector_relaxation = base.vector_relaxation;
+        vector_relaxation_fixed = base.vector_relaxation_fixed;
+        queue_kinds[0] = base.queue_kinds[0];
+        queue_kinds[1] = base.queue_kinds[1];
+        queue_kinds_fixed = base.queue_kinds_fixed;
+        choose_search_defaults();
+    }
+    
+    // Set the weights of the segments selected by one change.
+    void apply_change(const NetworkUpdate::Change& change, std::vector<float>& time, 
+                      std::vector<float>& distance) const {
+        using Action = NetworkUpdate::Action;
+        using Scope = NetworkUpdate::Scope;
+        auto n = static_cast<int>(graph.station_count());
+        if ((change.scope != Scope::LINE && (change.from < 0 || change.from >= n)) ||
+            (change.scope == Scope::SEGMENT && (change.to < 0 || change.to >= n)) ||
+            change.line >= static_cast<int>(graph.line_count) || 
+            (change.scope == Scope::LINE && change.line < 0)) {
+            throw std::out_of_range("network update names an unknown station or line");
+        }
+        
+        auto set = [&](uint32_t e) {
+            if (change.action == Action::CLOSE) {
+                time[e] = distance[e] = std::numeric_limits<float>::infinity();
+            } else {
+                time[e] = planned.edge_time[e] + change.minutes;
+                distance[e] = planned.edge_distance[e];
+            }
+        };
+        auto on_line = [&](uint32_t e) {
+            return change.line < 0 || graph.edge_line[e] == static_cast<uint8_t>(change.line);
+        };
+        // Segment a -> b, on the selected line or on every line.
+        auto set_segment = [&](int a, int b, bool all_lines, uint8_t line) {
+            for (uint32_t e = graph.offsets[a]; e < graph.offsets[a + 1]; ++e) {
+                if (graph.edge_to[e] == static_cast<uint32_t>(b) && 
+                    (all_lines ? on_line(e) : graph.edge_line[e] == line)) {
+                    set(e);
+                }
+            }
+        };
+        
+        switch (change.scope) {
+            case Scope::SEGMENT:
+                set_segment(change.from, change.to, true, 0);
+                set_segment(change.to, change.from, true, 0);
+                break;
+            case Scope::STATION:
+                for (uint32_t e = graph.offsets[change.from]; e < graph.offsets[change.from + 1]; ++e) {
+                    set(e);
+                    set_segment(static_cast<int>(graph.edge_to[e]), change.from, false, graph.edge_line[e]);
+                }
+                break;
+            case Scope::LINE:
+                for (uint32_t e = 0; e < graph.edge_count(); ++e) {
+                    if (on_line(e)) set(e);
+                }
+                break;
+        }
+    }
+    
+    // Recompute the rows of the route table for `mode` whose search trees
+    // the changed segments can alter, in a copy of the table. A segment
+    // u -> v on line l that got dearer matters only to sources whose tree
+    // rides it, i.e. whose state (v, l) has parent u. One that got cheaper
+    // matters only where reaching v through it could beat the best route
+    // to v plus an interchange, the most any continuation from (v, l) can
+    // gain over changing there. Returns the number of rows recomputed.
+    size_t repair_route_table(int mode, const std::vector<uint32_t>& changed, 
+                              const NetworkGraph& before) {
+        const RouteTable& old = *route_tables[mode];
+        bool minimize_time = mode == 0;
+        const float* weight_before = minimize_time ? before.edge_time.data() 
+                                                   : before.edge_distance.data();
+        const float* weight_after = minimize_time ? graph.edge_time.data() 
+                                                  : graph.edge_distance.data();
+        const double penalty = minimize_time ? INTERCHANGE_PENALTY : 0.5;
+        
+        auto cost = [&](int source, int station) {
+            if (source == station) return 0.0;
+            size_t pair = old.pair(source, station);
+            if (old.best_line[pair] == RouteTable::NO_LINE) return INF;
+            // Route times already include their interchange penalties.
+            return minimize_time ? old.time[pair] 
+                                 : old.distance[pair] + penalty * old.interchanges[pair];
+        };
+        
+        std::vector<int> sources;
+        for (size_t s = 0; s < old.stations; ++s) {
+            auto source = static_cast<int>(s);
+            bool affected = std::any_of(changed.begin(), changed.end(), [&](uint32_t e) {
+                auto from = static_cast<int>(std::upper_bound(graph.offsets.begin(), 
+                                                              graph.offsets.end(), e) - 
+                                             graph.offsets.begin() - 1);
+                auto to = static_cast<int>(graph.edge_to[e]);
+                auto line = static_cast<LineId>(graph.edge_line[e]);
+                if (weight_after[e] > weight_before[e]) {
+                    return old.parent[old.state(source, to, line)] == from;
+                }
+                // Float totals: err towards recomputing.
+                return cost(source, from) + weight_after[e] < cost(source, to) + penalty + 1e-3;
+            });
+            if (affected) sources.push_back(source);
+        }
+        if (sources.empty()) return 0;
+        
+        auto buffers = std::make_shared<RouteTableBuffers>(old);
+        auto table = std::make_shared<RouteTable>(
+            RouteTableBuffers::adopt(buffers, old.stations, old.lines));
+        WorkStealingPool& workers = worker_pool();
+        std::vector<PathResult> routes(workers.size());
+        workers.parallel_for(sources.size(), [&](unsigned worker, size_t i) {
+            buffers->clear_source(sources[i], old.stations, old.lines);
+            fill_route_table(*table, *buffers, sources[i], minimize_time,
+                             thread_workspace(), routes[worker]);
+        });
+        route_tables[mode] = std::move(table);
+        return sources.size();
+    }
+    
+    // depart_at() and arrive_by() between station indices.
+    Journey depart_at(int start_idx, int end_idx, uint32_t time, JourneyWorkspace& ws) const {
+        EngineMetrics::Probe probe(EngineMetrics::JOURNEY);
+        Journey journey;
+        const Timetable* table = timetable();
+        if (!table || !valid(StationId(start_idx)) || !valid(StationId(end_idx))) return journey;
+        if (start_idx == end_idx) return stay_put(time);
+        
+        const auto start = static_cast<uint32_t>(start_idx);
+        const auto end = static_cast<uint32_t>(end_idx);
+        const auto& connections = table->connections;
+        ws.prepare(graph.station_count(), table->trip_count());
+        ws.reach(start, time, JourneyWorkspace::NONE, JourneyWorkspace::NONE);
+        
+        for (size_t i = table->first_departure(time); i < connections.size(); ++i) {
+            const Connection& c = connections[i];
+            if (ws.reached(end) && c.departure >= ws.time[end]) break;
+            ++ws.scanned;
+            
+            uint32_t boarded = ws.trip_at(c.trip);
+            if (boarded == JourneyWorkspace::NONE) {
+                if (!ws.reached(c.from)) continue;
+                uint32_t change = c.from == start ? 0 : table->transfer_seconds;
+                if (uint64_t(ws.time[c.from]) + change > c.departure) continue;
+                boarded = static_cast<uint32_t>(i);
+                ws.set_trip(c.trip, boarded);
+            }
+            if (!ws.reached(c.to) || c.arrival < ws.time[c.to]) {
+                ws.reach(c.to, c.arrival, boarded, static_cast<uint32_t>(i));
+            }
+        }
+        if (!ws.reached(end)) return journey;
+        
+        for (uint32_t station = end; station != start; ) {
+            const Connection& first = connections[ws.board[station]];
+            const Connection& last = connections[ws.alight[station]];
+            journey.legs.push_back({static_cast<LineId>(table->trip_line[first.trip]),
+                                    static_cast<int>(first.from), static_cast<int>(station),
+                                    first.departure, last.arrival});
+            station = first.from;
+        }
+        std::reverse(journey.legs.begin(), journey.legs.end());
+        return finish_journey(journey);
+    }
+    
+    Journey arrive_by(int start_idx, int end_idx, uint32_t time, JourneyWorkspace& ws) const {
+        EngineMetrics::Probe probe(EngineMetrics::JOURNEY);
+        Journey journey;
+        const Timetable* table = timetable();
+        if (!table || !valid(StationId(start_idx)) || !valid(StationId(end_idx))) return journey;
+        if (start_idx == end_idx) return stay_put(time);
+        
+        const auto start = static_cast<uint32_t>(start_idx);
+        const auto end = static_cast<uint32_t>(end_idx);
+        const auto& connections = table->connections;
+        ws.prepare(graph.station_count(), table->trip_count());
+        ws.reach(end, time, JourneyWorkspace::NONE, JourneyWorkspace::NONE);
+        
+        for (size_t k = table->arrived_by(time); k-- > 0; ) {
+            uint32_t i = table->by_arrival[k];
+            const Connection& c = connections[i];
+            if (ws.reached(start) && c.arrival <= ws.time[start]) break;
+            ++ws.scanned;
+            
+            uint32_t alighted = ws.trip_at(c.trip);
+            if (alighted == JourneyWorkspace::NONE) {
+                if (!ws.reached(c.to)) continue;
+                uint32_t change = c.to == end ? 0 : table->transfer_seconds;
+                if (uint64_t(c.arrival) + change > ws.time[c.to]) continue;
+                alighted = i;
+                ws.set_trip(c.trip, alighted);
+            }
+            if (!ws.reached(c.from) || c.departure > ws.time[c.from]) {
+                ws.reach(c.from, c.departure, i, alighted);
+            }
+        }
+        if (!ws.reached(start)) return journey;
+        
+        for (uint32_t station = start; station != end; ) {
+            const Connection& first = connections[ws.board[station]];
+            const Connection& last = connections[ws.alight[station]];
+            journey.legs.push_back({static_cast<LineId>(table->trip_line[first.trip]),
+                                    static_cast<int>(station), static_cast<int>(last.to),
+                                    first.departure, last.arrival});
+            station = last.to;
+        }
+        return finish_journey(journey);
+    }
+    
+    static Journey stay_put(uint32_t time) {
+        Journey journey;
+        journey.departure = journey.arrival = time;
+        journey.found = true;
+        return journey;
+    }
+    
+    static Journey& finish_journey(Journey& journey) {
+        journey.departure = journey.legs.front().departure;
+        journey.arrival = journey.legs.back().arrival;
+        journey.found = true;
+        return journey;
+    }
+    
+    struct NoHeuristic {
+        double operator()(int) const { return 0.0; }
+    };
+    
+    // Admissible, consistent lower bound on the cost from a station to the
+    // target: straight-line distance times the snapshot's calibrated minimum
+    // cost per kilometre.
+    struct GeoHeuristic {
+        const NetworkGraph* graph;
+        int target;
+        double per_km;
+        
+        double operator()(int station) const {
+            return graph->straight_line_km(station, target) * per_km;
+        }
+    };
+    
+    // Label every segment out of start_idx. The first segment is boarded
+    // without an interchange penalty.
+    template <typename Heuristic>
+    void seed_search(int start_idx, const float* weight, QueryWorkspace& ws, 
+                     const Heuristic& h) const {
+        seed_search(start_idx, weight, ws, h, [](int, LineId, double) {});
+    }
+    
+    // As above, calling on_label(to, line, cost) for every first label.
+    template <typename Heuristic, typename OnLabel>
+    void seed_search(int start_idx, const float* weight, QueryWorkspace& ws, 
+                     const Heuristic& h, OnLabel&& on_label) const {
+        for (uint32_t e = graph.offsets[start_idx]; e < graph.offsets[start_idx + 1]; ++e) {
+            auto line = static_cast<LineId>(graph.edge_line[e]);
+            int to = static_cast<int>(graph.edge_to[e]);
+            double edge_cost = weight[e];
+            if (edge_cost == INF) continue;  // closed
+            ws.set(ws.slot(start_idx, line), 0.0, -1, line);
+            double key = edge_cost + h(to);
+            if (key < INF) ws.push(key, to, line);  // INF: pruned by the heuristic
+            ws.set(ws.slot(to, line), edge_cost, start_idx, line);
+            on_label(to, line, edge_cost);
+        }
+    }
+    
+    // Relax every segment out of the settled state (station, line) and call
+    // on_label(to, line, cost) for each label that improved.
+    template <typename Heuristic, typename OnLabel>
+    void relax_state(int station, LineId line, double cost, const float* weight, 
+                     double penalty, QueryWorkspace& ws, const Heuristic& h,
+                     OnLabel&& on_label) const {
+        auto improve = [&](uint32_t e, double new_cost) {
+            auto next_line = static_cast<LineId>(graph.edge_line[e]);
+            int to = static_cast<int>(graph.edge_to[e]);
+            size_t next = ws.slot(to, next_line);
+            if (new_cost < ws.cost_at(next)) {
+                ws.set(next, new_cost, station, line);
+                double key = new_cost + h(to);
+                if (key < INF) ws.push(key, to, next_line);  // INF: pruned by the heuristic
+                on_label(to, next_line, new_cost);
+            }
+        };
+        
+        uint32_t e = graph.offsets[station];
+        const uint32_t edge_end = graph.offsets[station + 1];
+#if defined(__AVX2__)
+        if (vector_relaxation && ws.stamp.size() <= UINT32_MAX) {  // slots computed in 32 bits
+            e = relax_lanes(e, edge_end, line, cost, weight, penalty, ws, improve);
+        }
+#endif
+        for (; e < edge_end; ++e) {
+            auto next_line = static_cast<LineId>(graph.edge_line[e]);
+            double interchange_cost = line != next_line ? penalty : 0.0;
+            ++ws.relaxations;
+            if constexpr (METRICS_ENABLED) ++ws.counters.relaxations;
+            improve(e, cost + weight[e] + interchange_cost);
+        }
+    }
+    
+#if defined(__AVX2__)
+    // relax_state four segments at a time: the slots and new costs of the
+    // four (station, line) states they lead to are computed side by side,
+    // the interchange penalty added through a line comparison mask, and
+    // the costs compared with the states' current ones. Only improvements
+    // go through improve(), which checks again in edge order, so the result
+    // is exactly that of the loop in relax_state. Returns the first edge
+    // left for that loop. (Gathering the current costs with AVX2 gathers
+    // measured slower than four loads.)
+    template <typename Improve>
+    uint32_t relax_lanes(uint32_t e, uint32_t edge_end, LineId line, double cost, 
+                         const float* weight, double penalty, QueryWorkspace& ws, 
+                         Improve& improve) const {
+        const __m256d base = _mm256_set1_pd(cost);
+        const __m256d interchange = _mm256_set1_pd(penalty);
+        const __m128i current_line = _mm_set1_epi32(line);
+        const __m128i lane_count = _mm_set1_epi32(static_cast<int>(ws.lines));
+        
+        for (; e + 4 <= edge_end; e += 4) {
+            int packed_lines;
+            std::memcpy(&packed_lines, graph.edge_line.data() + e, sizeof(packed_lines));
+            __m128i lines = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed_lines));
+            __m128i to = _mm_loadu_si128(reinterpret_cast<const __m128i*>(graph.edge_to.data() + e));
+            __m128i slots = _mm_add_epi32(_mm_mullo_epi32(to, lane_count), lines);
+            
+            alignas(16) uint32_t next[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(next), slots);
+            __m256d current = _mm256_setr_pd(ws.cost_at(next[0]), ws.cost_at(next[1]), 
+                                             ws.cost_at(next[2]), ws.cost_at(next[3]));
+            
+            __m256d same_line = _mm256_castsi256_pd(
+                _mm256_cvtepi32_epi64(_mm_cmpeq_epi32(lines, current_line)));
+            __m256d candidate = _mm256_add_pd(
+                _mm256_add_pd(base, _mm256_cvtps_pd(_mm_loadu_ps(weight + e))),
+                _mm256_andnot_pd(same_line, interchange));
+            
+            ws.relaxations += 4;
+            if constexpr (METRICS_ENABLED) ws.counters.relaxations += 4;
+            int better = _mm256_movemask_pd(_mm256_cmp_pd(candidate, current, _CMP_LT_OQ));
+            if (better == 0) continue;
+            
+            alignas(32) double costs[4];
+            _mm256_store_pd(costs, candidate);
+            for (; better; better &= better - 1) {
+                int lane = __builtin_ctz(better);
+                improve(e + lane, costs[lane]);
+            }
+        }
+        return e;
+    }
+#endif
+    
+    // Line-aware search over (station, line) states from start_idx; plain
+    // Dijkstra with the default heuristic, A* with GeoHeuristic. With a
+    // target it stops as soon as the first state at the target is settled,
+    // otherwise it settles every reachable state whose cost plus heuristic
+    // stays within limit, or stops once ws.settled holds settle_budget
+    // states. Leaves the search tree in ws; the caller reads costs and
+    // parents from there.
+    template <typename Heuristic = NoHeuristic>
+    void run_search(int start_idx, bool minimize_time, QueryWorkspace& ws, 
+                    int target = -1, const Heuristic& h = Heuristic(), double limit = INF,
+                    size_t settle_budget = std::numeric_limits<size_t>::max()) const {
+        ws.prepare(graph.station_count(), graph.line_count, queue_kind(minimize_time));
+        seed_search(start_idx, minimize_time ? graph.edge_time.data() : graph.edge_distance.data(), 
+                    ws, h);
+        resume_search(minimize_time, ws, target, h, limit, settle_budget);
+    }
+    
+    // The settle loop of run_search. Called again on the same workspace
+    // and heuristic, it carries on a search that stopped at its target,
+    // limit or budget; a target state it stopped at stays unexpanded.
+    template <typename Heuristic>
+    void resume_search(bool minimize_time, QueryWorkspace& ws, int target, const Heuristic& h, 
+                       double limit, 
+                       size_t settle_budget = std::numeric_limits<size_t>::max()) const {
+        const float* weight = minimize_time ? graph.edge_time.data() 
+                                            : graph.edge_distance.data();
+        const double penalty = minimize_time ? INTERCHANGE_PENALTY : 0.5;
+        
+        while (!ws.queue.empty() && ws.queue.top_key() <= limit && 
+               ws.settled.size() < settle_budget) {
+            auto [key, current_idx, current_line] = ws.pop();
+            
+            size_t current = ws.slot(current_idx, current_line);
+            double current_cost = ws.cost_at(current);
+            if (key > current_cost + h(current_idx)) {
+                ws.skip_stale();
+                continue;
+            }
+            ws.settled.push_back(static_cast<uint32_t>(current));
+            if (current_idx == target) break;
+            
+            relax_state(current_idx, current_line, current_cost, weight, penalty, ws, h,
+                        [](int, LineId, double) {});
+        }
+    }
+    
+    // Bidirectional line-aware Dijkstra. The backward search runs the same
+    // relaxation from end_idx: since segments are symmetric, a backward label
+    // on (v, l) is the cost from v to the target when leaving v on line l.
+    // The searches meet at a station where a forward arrival line and a
+    // backward departure line are joined, paying the interchange penalty if
+    // they differ. Stops once the two queue minima add up to the best meeting.
+    PathResult run_bidirectional(int start_idx, int end_idx, bool minimize_time,
+                                 QueryWorkspace& fwd, QueryWorkspace& bwd) const {
+        fwd.prepare(graph.station_count(), graph.line_count, queue_kind(minimize_time));
+        bwd.prepare(graph.station_count(), graph.line_count, queue_kind(minimize_time));
+        
+        const float* weight = minimize_time ? graph.edge_time.data() 
+                                            : graph.edge_distance.data();
+        const double penalty = minimize_time ? INTERCHANGE_PENALTY : 0.5;
+        const NoHeuristic h;
+        
+        double best = INF;
+        int meet_station = -1;
+        LineId meet_fwd_line = 0, meet_bwd_line = 0;
+        
+        // Try to join a new label of one search with the other search's
+        // labels at the same station.
+        auto meet = [&](int station, LineId line, double cost, bool forward) {
+            const QueryWorkspace& other = forward ? bwd : fwd;
+            if (station == (forward ? end_idx : start_idx)) {
+                if (cost < best) {
+                    best = cost;
+                    meet_station = station;
+                    meet_fwd_line = meet_bwd_line = line;
+                }
+                return;
+            }
+            if (station == (forward ? start_idx : end_idx)) return;
+            
+            for (LineMask rest = graph.station_lines[station]; rest; rest &= rest - 1) {
+                auto other_line = static_cast<LineId>(__builtin_ctzll(rest));
+                double total = cost + other.cost_at(other.slot(station, other_line)) +
+                               (other_line != line ? penalty : 0.0);
+                if (total < best) {
+                    best = total;
+                    meet_station = station;
+                    meet_fwd_line = forward ? line : other_line;
+                    meet_bwd_line = forward ? other_line : line;
+                }
+            }
+        };
+        
+        seed_search(start_idx, weight, fwd, h,
+                    [&](int to, LineId line, double cost) { meet(to, line, cost, true); });
+        seed_search(end_idx, weight, bwd, h,
+                    [&](int to, LineId line, double cost) { meet(to, line, cost, false); });
+        
+        auto top = [](QueryWorkspace& ws) { return ws.queue.top_key(); };
+        
+        while (top(fwd) + top(bwd) < best) {
+            bool forward = top(fwd) <= top(bwd);
+            QueryWorkspace& ws = forward ? fwd : bwd;
+            
+            auto [current_cost, current_idx, current_line] = ws.pop();
+            size_t current = ws.slot(current_idx, current_line);
+            if (current_cost > ws.cost_at(current)) {
+                ws.skip_stale();
+                continue;
+            }
+            ws.settled.push_back(static_cast<uint32_t>(current));
+            
+            relax_state(current_idx, current_line, current_cost, weight, penalty, ws, h,
+                [&](int to, LineId line, double cost) { meet(to, line, cost, forward); });
+        }
+        
+        PathResult result;
+        if (meet_station < 0) return result;
+        
+        if (meet_station == start_idx) {
+            result.path = {start_idx};
+            result.found = true;
+        } else {
+            unroll_path(start_idx, meet_station, meet_fwd_line,
+                [&](int station, LineId line) {
+                    size_t s = fwd.slot(station, line);
+                    return std::make_pair(fwd.parent[s], fwd.parent_line[s]);
+                }, result);
+        }
+        
+        follow_backward(meet_station, meet_bwd_line, end_idx, bwd, result);
+        compute_totals(result);
+        return result;
+    }
+    
+    // Extend a route ending at station with the backward search tree in
+    // bwd, leaving station on line. A backward label on (v, l) points at
+    // the next station towards the target and the line to leave that
+    // station on.
+    static void follow_backward(int station, LineId line, int end_idx, 
+                                const QueryWorkspace& bwd, PathResult& result) {
+        while (station != end_idx) {
+            size_t s = bwd.slot(station, line);
+            result.path_lines.push_back(line);
+            result.path.push_back(bwd.parent[s]);
+            station = bwd.parent[s];
+            line = bwd.parent_line[s];
+        }
+    }
+    
+    // Search cost of a route: time or distance plus the interchange
+    // penalties (already part of total_time).
+    static double route_cost(const PathResult& route, bool minimize_time) {
+        return minimize_time ? route.total_time : route.total_distance + 0.5 * route.interchanges;
+    }
+    
+    // The station pairs a route travels between, on any line, sorted.
+    static std::vector<uint64_t> segment_keys(const PathResult& route) {
+        std::vector<uint64_t> keys;
+        keys.reserve(route.path.size());
+        for (size_t i = 0; i + 1 < route.path.size(); ++i) {
+            auto [a, b] = std::minmax(route.path[i], route.path[i + 1]);
+            keys.push_back(static_cast<uint64_t>(a) << 32 | static_cast<uint32_t>(b));
+        }
+        std::sort(keys.begin(), keys.end());
+        return keys;
+    }
+    
+    // Kilometres of route that run between stations also adjacent on the
+    // route with the given segment_keys.
+    double shared_distance(const PathResult& route, const std::vector<uint64_t>& keys) const {
+        double shared = 0;
+        for (size_t i = 0; i + 1 < route.path.size(); ++i) {
+            auto [a, b] = std::minmax(route.path[i], route.path[i + 1]);
+            if (std::binary_search(keys.begin(), keys.end(), 
+                                   static_cast<uint64_t>(a) << 32 | static_cast<uint32_t>(b))) {
+                shared += graph.edge_distance[graph.find_edge(route.path[i], route.path[i + 1], 
+                                                              route.path_lines[i])];
+            }
+        }
+        return shared;
+    }
+    
+    // find_alternative_routes() between station indices.
+    std::vector<PathResult> find_alternative_routes(int start_idx, int end_idx, size_t k, 
+                                                    bool minimize_time, QueryWorkspace& fwd, 
+                                                    QueryWorkspace& bwd, double max_stretch,
+                                                    double max_overlap) const {
+        EngineMetrics::Probe probe(EngineMetrics::ALTERNATIVES, &fwd.counters, &bwd.counters);
+        if (k == 0 || !valid(StationId(start_idx)) || !valid(StationId(end_idx))) return {};
+        if (start_idx == end_idx) return {find_optimal_path(start_idx, end_idx, minimize_time, fwd)};
+        
+        double per_km = graph.min_cost_per_km[minimize_time ? 0 : 1];
+        if (per_km > 0) {
+            return via_routes(start_idx, end_idx, k, minimize_time, fwd, bwd, max_stretch, max_overlap,
+                              GeoHeuristic{&graph, end_idx, per_km});
+        }
+        return via_routes(start_idx, end_idx, k, minimize_time, fwd, bwd, max_stretch, max_overlap,
+                          NoHeuristic());
+    }
+    
+    // find_alternative_routes with the forward search guided by to_end.
+    template <typename Heuristic>
+    std::vector<PathResult> via_routes(int start_idx, int end_idx, size_t k, bool minimize_time, 
+                                       QueryWorkspace& fwd, QueryWorkspace& bwd, double max_stretch, 
+                                       double max_overlap, const Heuristic& to_end) const {
+        std::vector<PathResult> routes;
+        run_search(start_idx, minimize_time, fwd, end_idx, to_end);
+        routes.push_back(route_in_search(start_idx, end_idx, fwd));
+        if (!routes[0].found) return {};
+        if (k == 1) return routes;
+        
+        const double penalty = minimize_time ? INTERCHANGE_PENALTY : 0.5;
+        const double limit = route_cost(routes[0], minimize_time) * max_stretch + 1e-6;
+        const size_t optimum_work = fwd.settled.size();
+        resume_search(minimize_time, fwd, -1, to_end, limit, 
+                      static_cast<size_t>(optimum_work * VIA_FORWARD_WORK));
+        
+        // The forward search stopped at the limit or at its budget, and
+        // knows the exact cost from start to every station it settled: the
+        // perfect heuristic for the backward search, which then settles
+        // just the states on routes within the limit through them. Other
+        // stations are pruned. Some of those lie on routes within the
+        // limit when the budget ran out first, so the budget trades away
+        // some alternatives for bounded work.
+        std::vector<double> settled_cost(graph.station_count(), INF);
+        for (uint32_t s : fwd.settled) {  // a station's cheapest state first
+            double& cost = settled_cost[s / fwd.lines];
+            if (cost == INF) cost = fwd.cost_at(s);
+        }
+        auto to_start = [&](int station) {
+            double cost = settled_cost[station];
+            return cost + to_end(station) <= limit ? cost : INF;
+        };
+        run_search(end_idx, minimize_time, bwd, -1, to_start, limit, 
+                   static_cast<size_t>(optimum_work * VIA_BACKWARD_WORK));
+        
+        // The cheapest join of an arrival and a departure line at every
+        // station the forward search settled, in a heap by cost.
+        struct Via {
+            double cost;
+            int station;
+            LineId in, out;
+        };
+        auto cheaper = [](const Via& a, const Via& b) {
+            return std::tie(a.cost, a.station, a.in, a.out) < std::tie(b.cost, b.station, b.in, b.out);
+        };
+        std::vector<Via> vias;
+        std::vector<uint32_t> via_at(graph.station_count(), ParetoWorkspace::NONE);
+        for (uint32_t s : fwd.settled) {
+            int station = static_cast<int>(s / fwd.lines);
+            auto in = static_cast<LineId>(s % fwd.lines);
+            for (LineMask rest = graph.station_lines[station]; rest; rest &= rest - 1) {
+                auto out = static_cast<LineId>(__builtin_ctzll(rest));
+                Via via{fwd.cost_at(s) + bwd.cost_at(bwd.slot(station, out)) + 
+                        (in != out ? penalty : 0.0), station, in, out};
+                if (via.cost > limit) continue;
+                uint32_t& at = via_at[station];
+                if (at == ParetoWorkspace::NONE) {
+                    at = static_cast<uint32_t>(vias.size());
+                    vias.push_back(via);
+                } else if (cheaper(via, vias[at])) {
+                    vias[at] = via;
+                }
+            }
+        }
+        auto later = [&](const Via& a, const Via& b) { return cheaper(b, a); };
+        std::make_heap(vias.begin(), vias.end(), later);
+        
+        // seen[v] is the last route built through v (the optimal one is 1).
+        // A via station on a route built before costs no less than that
+        // route, as it comes later, and no more, as the route passes it; it
+        // would only rebuild the route or an equal-cost twin.
+        std::vector<uint32_t> seen(graph.station_count(), 0);
+        uint32_t built = 1;
+        for (int station : routes[0].path) seen[station] = built;
+        
+        // Every via station priced costs a route to build and compare, so
+        // only the cheapest few are.
+        std::vector<std::vector<uint64_t>> accepted{segment_keys(routes[0])};
+        PathResult candidate;
+        size_t priced = 0;
+        for (auto end = vias.end(); end != vias.begin() && routes.size() < k; --end) {
+            std::pop_heap(vias.begin(), end, later);
+            const Via& via = end[-1];
+            if (seen[via.station]) continue;
+            if (priced++ == k * VIAS_PRICED_PER_ROUTE) break;
+            unroll_path(start_idx, via.station, via.in,
+                [&](int station, LineId line) {
+                    size_t s = fwd.slot(station, line);
+                    return std::make_pair(fwd.parent[s], fwd.parent_line[s]);
+                }, candidate);
+            follow_backward(via.station, via.out, end_idx, bwd, candidate);
+            
+            ++built;
+            bool loops = false;
+            for (int station : candidate.path) {
+                loops |= seen[station] == built;
+                seen[station] = built;
+            }
+            if (loops) continue;
+            
+            compute_totals(candidate);
+            bool distinct = std::all_of(accepted.begin(), accepted.end(), [&](const auto& earlier) {
+                return shared_distance(candidate, earlier) <= max_overlap * candidate.total_distance;
+            });
+            if (!distinct) continue;
+            accepted.push_back(segment_keys(candidate));
+            routes.push_back(std::move(candidate));
+        }
+        return routes;
+    }
+    
+    // find_pareto_routes() between station indices.
+    std::vector<ParetoRoute> find_pareto_routes(int start_idx, int end_idx, ParetoWorkspace& ws,
+                                                size_t max_labels) const {
+        using Label = ParetoWorkspace::Label;
+        constexpr uint32_t NONE = ParetoWorkspace::NONE;
+        
+        EngineMetrics::Probe probe(EngineMetrics::PARETO, &ws.counters);
+        ws.prepare(graph.station_count(), graph.line_count);
+        if (!valid(StationId(start_idx)) || !valid(StationId(end_idx))) return {};
+        if (start_idx == end_idx) {
+            PathResult route;
+            route.path = {start_idx};
+            route.found = true;
+            return {{route, 0.0}};
+        }
+        
+        // With coordinates, a label is judged by the least time and distance
+        // any route through it can reach the destination with, and queued
+        // by that time, as in A*.
+        const double per_km[2] = {graph.min_cost_per_km[0], graph.min_cost_per_km[1]};
+        auto bound = [&](const Label& label) {
+            Label best = label;
+            if (per_km[0] > 0) {
+                double km = graph.straight_line_km(label.station, end_idx);
+                best.time += static_cast<uint64_t>(km * per_km[0] * ParetoWorkspace::SCALE);
+                best.distance += static_cast<uint64_t>(km * per_km[1] * ParetoWorkspace::SCALE);
+            }
+            return best;
+        };
+        auto dominated_at_target = [&](const Label& best) {
+            for (uint32_t t : ws.targets) {
+                if (ws.labels[t].dominates(best)) return true;
+            }
+            return false;
+        };
+        
+        // Queue a label unless one at its state or at the destination
+        // dominates it, and retire the labels at its state that it dominates.
+        auto offer = [&](const Label& label) {
+            if constexpr (METRICS_ENABLED) ++ws.counters.relaxations;
+            Label best = bound(label);
+            if (dominated_at_target(best)) return;
+            uint32_t& head = ws.bag(label.station, label.line);
+            for (uint32_t* link = &head; *link != NONE;) {
+                Label& other = ws.labels[*link];
+                if (other.dominates(label)) return;
+                if (label.dominates(other)) {
+                    other.dead = true;
+                    *link = other.next;
+                } else {
+                    link = &other.next;
+                }
+            }
+            if (ws.labels.size() >= max_labels) {
+                ws.truncated = true;
+                return;
+            }
+            if constexpr (METRICS_ENABLED) {
+                if (ws.labels.size() == ws.labels.capacity()) ++ws.counters.allocations;
+            }
+            auto index = static_cast<uint32_t>(ws.labels.size());
+            ws.labels.push_back(label);
+            ws.labels.back().next = head;
+            head = index;
+            ws.push(best.time, index);
+        };
+        
+        for (uint32_t e = graph.offsets[start_idx]; e < graph.offsets[start_idx + 1]; ++e) {
+            if (graph.edge_time[e] == INF) continue;  // closed
+            offer({ParetoWorkspace::fixed(graph.edge_time[e]), 
+                   ParetoWorkspace::fixed(graph.edge_distance[e]), 
+                   ParetoWorkspace::fixed(segment_fare(e, -1)), NONE, NONE, 
+                   graph.edge_to[e], graph.edge_line[e], 0, false});
+        }
+        
+        const uint64_t penalty = ParetoWorkspace::fixed(INTERCHANGE_PENALTY);
+        while (!ws.heap.empty()) {
+            uint32_t index = ws.pop();
+            const Label label = ws.labels[index];
+            if (label.dead || dominated_at_target(bound(label))) {
+                if constexpr (METRICS_ENABLED) ++ws.counters.stale_pops;
+                continue;
+            }
+            ++ws.settled;
+            
+            if (label.station == static_cast<uint32_t>(end_idx)) {
+                // Only a label of equal time can dominate an earlier one.
+                ws.targets.erase(std::remove_if(ws.targets.begin(), ws.targets.end(),
+                    [&](uint32_t t) { return label.dominates(ws.labels[t]); }), ws.targets.end());
+                ws.targets.push_back(index);
+                continue;
+            }
+            
+            // Going straight back is never better than not having left.
+            uint32_t previous = label.parent == NONE ? static_cast<uint32_t>(start_idx) 
+                                                     : ws.labels[label.parent].station;
+            for (uint32_t e = graph.offsets[label.station]; e < graph.offsets[label.station + 1]; ++e) {
+                if (graph.edge_time[e] == INF || graph.edge_to[e] == previous) continue;
+                auto line = static_cast<LineId>(graph.edge_line[e]);
+                bool change = line != label.line;
+                offer({label.time + ParetoWorkspace::fixed(graph.edge_time[e]) + 
+                           (change ? penalty : 0),
+                       label.distance + ParetoWorkspace::fixed(graph.edge_distance[e]),
+                       label.fare + ParetoWorkspace::fixed(segment_fare(e, label.line)),
+                       index, NONE, graph.edge_to[e], line,
+                       static_cast<uint8_t>(std::min(label.interchanges + change, 255)), false});
+            }
+        }
+        
+        std::vector<ParetoRoute> routes;
+        routes.reserve(ws.targets.size());
+        for (uint32_t t : ws.targets) {
+            ParetoRoute entry;
+            PathResult& route = entry.route;
+            for (uint32_t i = t; i != NONE; i = ws.labels[i].parent) {
+                route.path.push_back(static_cast<int>(ws.labels[i].station));
+                route.path_lines.push_back(ws.labels[i].line);
+            }
+            route.path.push_back(start_idx);
+            std::reverse(route.path.begin(), route.path.end());
+            std::reverse(route.path_lines.begin(), route.path_lines.end());
+            route.found = true;
+            compute_totals(route);
+            entry.fare = route_fare(route);
+            routes.push_back(std::move(entry));
+        }
+        std::sort(routes.begin(), routes.end(), [](const ParetoRoute& a, const ParetoRoute& b) {
+            return a.route.total_time < b.route.total_time;
+        });
+        return routes;
+    }
+    
+    std::vector<std::string> station_names_of(ArrayView<StationId> list) const {
+        std::vector<std::string> names;
+        names.reserve(list.size());
+        for (StationId station : list) names.emplace_back(station_name(station));
+        return names;
+    }
+    
+    static std::vector<double> sorted_budgets(ArrayView<double> budgets) {
+        std::vector<double> sorted(budgets.begin(), budgets.end());
+        if (sorted.empty() || std::any_of(sorted.begin(), sorted.end(), [](double minutes) {
+                return !(minutes >= 0) || !std::isfinite(minutes);
+            })) {
+            throw std::invalid_argument("isochrone budgets must be non-negative numbers of minutes");
+        }
+        std::sort(sorted.begin(), sorted.end());
+        return sorted;
+    }
+    
+    // isochrone() from station indices.
+    Isochrone isochrone(ArrayView<int> origins, ArrayView<double> budgets) const {
+        Isochrone result;
+        result.budgets = sorted_budgets(budgets);
+        QueryWorkspace& ws = thread_workspace();
+        bounded_search(origins, result.budgets.back(), ws);
+        fill_tree_totals(ws);
+        
+        for (int origin : origins) {
+            if (ws.reach(origin)) result.stations.push_back({origin, 0.0, 0.0, 0});
+        }
+        for (uint32_t s : ws.settled) {  // cheapest state of each station first
+            int station = static_cast<int>(s / ws.lines);
+            if (!ws.reach(station)) continue;
+            result.stations.push_back({station, ws.tree_time[s], ws.tree_distance[s], 
+                                       ws.tree_interchanges[s]});
+        }
+        
+        for (double budget : result.budgets) {
+            auto within = std::partition_point(result.stations.begin(), result.stations.end(),
+                [&](const Isochrone::Reach& reach) { return reach.time <= budget; });
+            result.rings.push_back(static_cast<size_t>(within - result.stations.begin()));
+        }
+        return result;
+    }
+    
+    // Time search from every origin at once that settles exactly the states
+    // at most `limit` minutes away. All origin states are labelled before
+    // their segments, so no origin is ever reached through another.
+    void bounded_search(ArrayView<int> origins, double limit, QueryWorkspace& ws) const {
+        int n = static_cast<int>(graph.station_count());
+        for (int origin : origins) {
+            if (origin < 0 || origin >= n) throw std::out_of_range("isochrone from an unknown station");
+        }
+        ws.prepare(graph.station_count(), graph.line_count, queue_kind(true));
+        const float* weight = graph.edge_time.data();
+        
+        for (int origin : origins) {
+            for (uint32_t e = graph.offsets[origin]; e < graph.offsets[origin + 1]; ++e) {
+                auto line = static_cast<LineId>(graph.edge_line[e]);
+                if (weight[e] != INF) ws.set(ws.slot(origin, line), 0.0, -1, line);
+            }
+        }
+        for (int origin : origins) {
+            for (uint32_t e = graph.offsets[origin]; e < graph.offsets[origin + 1]; ++e) {
+                auto line = static_cast<LineId>(graph.edge_line[e]);
+                int to = static_cast<int>(graph.edge_to[e]);
+                size_t next = ws.slot(to, line);
+                if (weight[e] < ws.cost_at(next)) {
+                    ws.set(next, weight[e], origin, line);
+                    ws.push(weight[e], to, line);
+                }
+            }
+        }
+        resume_search(true, ws, -1, NoHeuristic(), limit);
+    }
+    
+    // many_to_many() between station indices, all within the network.
+    RouteMatrix many_to_many(ArrayView<int> sources, ArrayView<int> targets, 
+                             bool minimize_time) const {
+        RouteMatrix matrix;
+        matrix.rows = sources.size();
+        matrix.cols = targets.size();
+        size_t cells = matrix.rows * matrix.cols;
+        matrix.cost.assign(cells, static_cast<float>(INF));
+        matrix.distance.assign(cells, 0.0f);
+        matrix.time.assign(cells, 0.0f);
+        matrix.interchanges.assign(cells, 0);
+        
+        auto distinct = [](ArrayView<int> stations) {
+            std::vector<int> unique(stations.begin(), stations.end());
+            std::sort(unique.begin(), unique.end());
+            unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+            return unique;
+        };
+        std::vector<int> roots = distinct(sources);
+        std::vector<int> leaves = distinct(targets);
+        bool reverse = leaves.size() < roots.size();
+        if (reverse) std::swap(roots, leaves);
+        matrix.searches = roots.size();
+        
+        ArrayView<int> root_side = reverse ? targets : sources;
+        ArrayView<int> leaf_side = reverse ? sources : targets;
+        std::vector<std::vector<size_t>> root_slots(roots.size());
+        for (size_t i = 0; i < root_side.size(); ++i) {
+            size_t r = std::lower_bound(roots.begin(), roots.end(), root_side[i]) - roots.begin();
+            root_slots[r].push_back(i);
+        }
+        
+        worker_pool().parallel_for(roots.size(), [&](unsigned, size_t r) {
+            int root = roots[r];
+            QueryWorkspace& ws = thread_workspace();
+            run_search(root, minimize_time, ws);
+            fill_tree_totals(ws);
+            
+            for (size_t j = 0; j < leaf_side.size(); ++j) {
+                int leaf = leaf_side[j];
+                float cost = 0.0f, distance = 0.0f, time = 0.0f;
+                uint8_t interchanges = 0;
+                
+                if (leaf != root) {
+                    int line = best_arrival_line(leaf, ws);
+                    if (line < 0) continue;
+                    size_t s = ws.slot(leaf, static_cast<LineId>(line));
+                    cost = static_cast<float>(ws.cost[s]);
+                    distance = static_cast<float>(ws.tree_distance[s]);
+                    time = static_cast<float>(ws.tree_time[s]);
+                    interchanges = static_cast<uint8_t>(std::min(ws.tree_interchanges[s], 255));
+                }
+                
+                for (size_t i : root_slots[r]) {
+                    size_t c = reverse ? matrix.cell(j, i) : matrix.cell(i, j);
+                    matrix.cost[c] = cost;
+                    matrix.distance[c] = distance;
+                    matrix.time[c] = time;
+                    matrix.interchanges[c] = interchanges;
+                }
+            }
+        });
+        return matrix;
+    }
+    
+    // Brandes' dependency accumulation with one route per pair. For each
+    // origin, trips_from(i, to) adds the trips from origins[i] to each
+    // station into `to` and returns a callable that clears them again.
+    // The trips to a station enter at the first of its states the search
+    // settles, the cheapest; walking the settled states backwards, each
+    // passes what it carries on to its parent state. Every worker adds
+    // into totals of its own, which are summed at the end.
+    template <typename TripsFrom>
+    NetworkLoad accumulate_load(const std::vector<int>& origins, bool minimize_time,
+                                TripsFrom&& trips_from) const {
+        size_t n = graph.station_count();
+        size_t states = n * graph.line_count;
+        WorkStealingPool& workers = worker_pool();
+        
+        struct Totals {
+            NetworkLoad load;
+            std::vector<double> to;
+            std::vector<double> flow;
+        };
+        std::vector<Totals> totals(workers.size());
+        
+        workers.parallel_for(origins.size(), [&](unsigned worker, size_t i) {
+            Totals& t = totals[worker];
+            if (t.to.empty()) {
+                t.load.through.assign(n, 0.0);
+                t.load.transfers.assign(n, 0.0);
+                t.load.segment.assign(graph.edge_count(), 0.0);
+                t.to.assign(n, 0.0);
+                t.flow.resize(states);
+            }
+            int origin = origins[i];
+            auto clear = trips_from(i, t.to);
+            QueryWorkspace& ws = thread_workspace();
+            run_search(origin, minimize_time, ws);
+            ++t.load.searches;
+            
+            double demand = std::accumulate(t.to.begin(), t.to.end(), 0.0);
+            double assigned = 0;
+            ws.reach(origin);
+            for (uint32_t s : ws.settled) {
+                int station = static_cast<int>(s / ws.lines);
+                t.flow[s] = ws.reach(station) ? t.to[station] : 0.0;
+                assigned += t.flow[s];
+            }
+            t.load.assigned += assigned;
+            t.load.unassigned += std::max(demand - assigned, 0.0);
+            clear(t.to);
+            
+            for (auto it = ws.settled.rbegin(); it != ws.settled.rend(); ++it) {
+                uint32_t s = *it;
+                double flow = t.flow[s];
+                if (flow == 0) continue;
+                int station = static_cast<int>(s / ws.lines);
+                auto line = static_cast<LineId>(s % ws.lines);
+                int from = ws.parent[s];
+                LineId from_line = ws.parent_line[s];
+                
+                int e = graph.find_edge(from, station, line);
+                if (e >= 0) t.load.segment[e] += flow;
+                size_t p = ws.slot(from, from_line);
+                if (ws.parent[p] < 0) continue;  // boarded at the origin
+                t.flow[p] += flow;
+                t.load.through[from] += flow;
+                if (from_line != line) t.load.transfers[from] += flow;
+            }
+        });
+        
+        NetworkLoad load;
+        load.through.assign(n, 0.0);
+        load.transfers.assign(n, 0.0);
+        load.segment.assign(graph.edge_count(), 0.0);
+        for (const Totals& t : totals) {
+            if (t.to.empty()) continue;
+            for (size_t v = 0; v < n; ++v) {
+                load.through[v] += t.load.through[v];
+                load.transfers[v] += t.load.transfers[v];
+            }
+            for (size_t e = 0; e < load.segment.size(); ++e) load.segment[e] += t.load.segment[e];
+            load.assigned += t.load.assigned;
+            load.unassigned += t.load.unassigned;
+            load.searches += t.load.searches;
+        }
+        return load;
+    }
+    
+    // Cheapest arrival line at end_idx in the search tree held by ws, or -1.
+    int best_arrival_line(int end_idx, const QueryWorkspace& ws) const {
+        double min_cost = INF;
+        int best_line = -1;
+        for (int i = 0; i < static_cast<int>(graph.line_count); ++i) {
+            double c = ws.cost_at(ws.slot(end_idx, static_cast<LineId>(i)));
+            if (c < min_cost) {
+                min_cost = c;
+                best_line = i;
+            }
+        }
+        return best_line;
+    }
+    
+    // Route distance, time and interchange count for every settled state of
+    // the search tree in ws, computed parent-first in settle order. A state
+    // whose parent state has no parent was labelled from an origin.
+    void fill_tree_totals(QueryWorkspace& ws) const {
+        size_t states = graph.station_count() * graph.line_count;
+        if (ws.tree_distance.size() < states) {
+            ws.tree_distance.resize(states);
+            ws.tree_time.resize(states);
+            ws.tree_interchanges.resize(states);
+        }
+        
+        for (uint32_t s : ws.settled) {
+            int station = static_cast<int>(s / ws.lines);
+            auto line = static_cast<LineId>(s % ws.lines);
+            int from = ws.parent[s];
+            LineId from_line = ws.parent_line[s];
+            
+            int e = graph.find_edge(from, station, line);
+            double distance = e >= 0 ? graph.edge_distance[e] : 0.0;
+            double time = e >= 0 ? graph.edge_time[e] : 0.0;
+            
+            size_t p = ws.slot(from, from_line);
+            if (ws.parent[p] < 0) {
+                ws.tree_distance[s] = distance;
+                ws.tree_time[s] = time;
+                ws.tree_interchanges[s] = 0;
+            } else {
+                int change = from_line != line ? 1 : 0;
+                ws.tree_distance[s] = ws.tree_distance[p] + distance;
+                ws.tree_time[s] = ws.tree_time[p] + time + change * INTERCHANGE_PENALTY;
+                ws.tree_interchanges[s] = ws.tree_interchanges[p] + change;
+            }
+        }
+    }
+    
+    // Rebuild the route ending at (end_idx, best_line) from a predecessor
+    // function. The parent chain is walked once to size the output and then
+    // written back to front, so no temporaries or reversals are needed.
+    template <typename ParentFn>
+    void unroll_path(int start_idx, int end_idx, LineId best_line, 
+                     ParentFn parent_of, PathResult& result) const {
+        size_t hops = 0;
+        for (int current = end_idx, line = static_cast<int>(best_line); current != start_idx; ) {
+            auto [next, next_line] = parent_of(current, static_cast<LineId>(line));
+            current = next;
+            line = static_cast<int>(next_line);
+            ++hops;
+        }
+        
+        result.path.resize(hops + 1);
+        result.path_lines.resize(hops);
+        
+        int current = end_idx;
+        LineId current_line = best_line;
+        
+        for (size_t i = hops; i > 0; --i) {
+            result.path[i] = current;
+            result.path_lines[i - 1] = current_line;
+            
+            auto [next, next_line] = parent_of(current, current_line);
+            current = next;
+            current_line = next_line;
+        }
+        
+        result.path[0] = start_idx;
+        result.found = true;
+    }
+    
+    // Fare for riding segment e after arriving on from_line (-1 at the
+    // start of a route).
+    float segment_fare(uint32_t e, int from_line) const {
+        if (graph.line_fares.empty()) return 0.0f;
+        const LineFare& fare = graph.line_fares[graph.edge_line[e]];
+        float price = fare.per_km * graph.edge_distance[e];
+        if (from_line < 0 || graph.line_fares[from_line].fare_group != fare.fare_group) {
+            price += fare.boarding;
+        }
+        return price;
+    }
+    
+    void compute_totals(PathResult& result) const {
+        const auto& path = result.path;
+        const auto& path_lines = result.path_lines;
+        double total_dist = 0, total_time = 0;
+        int interchanges = 0;
+        
+        for (size_t i = 0; i + 1 < path.size(); ++i) {
+            int e = graph.find_edge(path[i], path[i + 1], path_lines[i]);
+            
+            if (e >= 0) {
+                total_dist += graph.edge_distance[e];
+                total_time += graph.edge_time[e];
+                
+                if (i > 0 && path_lines[i-1] != path_lines[i]) {
+                    interchanges++;
+                }
+            }
+        }
+        
+        result.total_distance = total_dist;
+        result.total_time = total_time + (interchanges * INTERCHANGE_PENALTY);
+        result.interchanges = interchanges;
+    }
+    
+    // find_optimal_path by station index, for the engine's own callers.
+    // found == false for an index outside the network.
+    PathResult find_optimal_path(int start_idx, int end_idx, bool minimize_time,
+                                QueryWorkspace& ws) const {
+        if (!valid(StationId(start_idx)) || !valid(StationId(end_idx))) return PathResult();
+        if (!route_cache) {
+            return find_optimal_path(start_idx, end_idx, minimize_time, ws, search_algorithm);
+        }
+        
+        uint64_t key = RouteCache::route_key(start_idx, end_idx, minimize_time);
+        PathResult result;
+        EngineMetrics::Probe hit(
+            minimize_time ? EngineMetrics::ROUTE_TIME : EngineMetrics::ROUTE_DISTANCE);
+        if (route_cache->find(key, cache_generation, result)) return result;
+        hit.dismiss();
+        result = find_optimal_path(start_idx, end_idx, minimize_time, ws, search_algorithm);
+        route_cache->store(key, cache_generation, &result, 1);
+        return result;
+    }
+    
+    PathResult find_optimal_path(int start_idx, int end_idx, bool minimize_time,
+                                QueryWorkspace& ws, SearchAlgorithm algorithm) const {
+        EngineMetrics::Probe probe(
+            minimize_time ? EngineMetrics::ROUTE_TIME : EngineMetrics::ROUTE_DISTANCE, &ws.counters,
+            METRICS_ENABLED ? &thread_backward_workspace().counters : nullptr);
+        if (!valid(StationId(start_idx)) || !valid(StationId(end_idx))) return PathResult();
+        if (start_idx == end_idx) {
+            PathResult result;
+            result.path = {start_idx};
+            result.path_lines = {};
+            result.found = true;
+            return result;
+        }
+        
+        if (const RouteTable* table = precomputed_routes(minimize_time)) {
+            return lookup_route(*table, start_idx, end_idx);
+        }
+        
+        if (const ContractionHierarchy* ch = hierarchy(minimize_time)) {
+            return hierarchy_route(*ch, start_idx, end_idx, queue_kind(minimize_time), ws,
+                                   thread_backward_workspace());
+        }
+        
+        return search_route(start_idx, end_idx, minimize_time, ws, algorithm);
+    }
+    
+    PathResult search_route(int start_idx, int end_idx, bool minimize_time,
+                            QueryWorkspace& ws, SearchAlgorithm algorithm) const {
+        double per_km = graph.min_cost_per_km[minimize_time ? 0 : 1];
+        
+        if (algorithm == SearchAlgorithm::BIDIRECTIONAL) {
+            return run_bidirectional(start_idx, end_idx, minimize_time, ws, 
+                                     thread_backward_workspace());
+        } else if (algorithm == SearchAlgorithm::ASTAR && per_km > 0) {
+            run_search(start_idx, minimize_time, ws, end_idx, 
+                       GeoHeuristic{&graph, end_idx, per_km});
+        } else {
+            run_search(start_idx, minimize_time, ws, end_idx);
+        }
+        return route_in_search(start_idx, end_idx, ws);
+    }
+    
+    // The route to end_idx in the search tree held by ws, if it got there.
+    PathResult route_in_search(int start_idx, int end_idx, const QueryWorkspace& ws) const {
+        PathResult result;
+        int best_line = best_arrival_line(end_idx, ws);
+        if (best_line < 0) return result;
+        
+        unroll_path(start_idx, end_idx, static_cast<LineId>(best_line),
+            [&](int station, LineId line) {
+                size_t s = ws.slot(station, line);
+                return std::make_pair(ws.parent[s], ws.parent_line[s]);
+            }, result);
+        compute_totals(result);
+        return result;
+    }
+    
+    // Bidirectional search on a contraction hierarchy. Both searches start
+    // from every state of their station at cost zero and only follow arcs to
+    // higher-ranked nodes; a node is not expanded if it can be reached more
+    // cheaply from a node above it (stall-on-demand). Each direction stops
+    // once its queue minimum reaches the best meeting cost. The parents in
+    // the two workspaces are hierarchy nodes.
+    PathResult hierarchy_route(const ContractionHierarchy& ch, int start_idx, int end_idx,
+                               SearchQueue::Kind queue_kind, QueryWorkspace& fwd, 
+                               QueryWorkspace& bwd) const {
+        fwd.prepare(ch.node_count(), 1, queue_kind);
+        bwd.prepare(ch.node_count(), 1, queue_kind);
+        for (uint32_t v = ch.station_states[start_idx]; v < ch.station_states[start_idx + 1]; ++v) {
+            fwd.set(v, 0.0, -1, 0);
+            fwd.push(0.0, static_cast<int>(v), 0);
+        }
+        for (uint32_t v = ch.station_states[end_idx]; v < ch.station_states[end_idx + 1]; ++v) {
+            bwd.set(v, 0.0, -1, 0);
+            bwd.push(0.0, static_cast<int>(v), 0);
+        }
+        
+        double best = INF;
+        int meet = -1;
+        auto top = [](QueryWorkspace& ws) { return ws.queue.top_key(); };
+        
+        while (std::min(top(fwd), top(bwd)) < best) {
+            bool forward = top(fwd) <= top(bwd);
+            QueryWorkspace& ws = forward ? fwd : bwd;
+            const QueryWorkspace& other = forward ? bwd : fwd;
+            
+            auto [cost, node, unused] = ws.pop();
+            auto v = static_cast<uint32_t>(node);
+            if (cost > ws.cost_at(v)) {
+                ws.skip_stale();
+                continue;
+            }
+            ws.settled.push_back(v);
+            
+            double through = cost + other.cost_at(v);
+            if (through < best) {
+                best = through;
+                meet = node;
+            }
+            
+            const uint32_t arc_end = ch.up_offsets[v + 1];
+            bool stalled = false;
+            for (uint32_t e = ch.up_offsets[v]; e < arc_end && !stalled; ++e) {
+                stalled = ws.cost_at(ch.up_to[e]) + ch.up_cost[e] < cost;
+            }
+            if (stalled) continue;
+            
+            for (uint32_t e = ch.up_offsets[v]; e < arc_end; ++e) {
+                double next_cost = cost + ch.up_cost[e];
+                uint32_t next = ch.up_to[e];
+                ++ws.relaxations;
+                if constexpr (METRICS_ENABLED) ++ws.counters.relaxations;
+                if (next_cost < ws.cost_at(next) && next_cost < best) {
+                    ws.set(next, next_cost, node, 0);
+                    ws.push(next_cost, static_cast<int>(next), 0);
+                }
+            }
+        }
+        
+        PathResult result;
+        if (meet < 0) return result;
+        
+        // Hierarchy nodes from the source state up to the meeting node and
+        // down to the target state, then every arc unpacked into states.
+        std::vector<uint32_t> up_down;
+        for (int v = meet; v >= 0; v = fwd.parent[v]) up_down.push_back(static_cast<uint32_t>(v));
+        std::reverse(up_down.begin(), up_down.end());
+        for (int v = bwd.parent[meet]; v >= 0; v = bwd.parent[v]) {
+            up_down.push_back(static_cast<uint32_t>(v));
+        }
+        
+        std::vector<uint32_t> states = {up_down[0]};
+        for (size_t i = 0; i + 1 < up_down.size(); ++i) {
+            unpack_arc(ch, up_down[i], up_down[i + 1], states);
+        }
+        
+        result.path.push_back(start_idx);
+        for (size_t i = 1; i < states.size(); ++i) {
+            uint32_t station = ch.state_station[states[i]];
+            if (station == ch.state_station[states[i - 1]]) continue;
+            result.path.push_back(static_cast<int>(station));
+            result.path_lines.push_back(static_cast<LineId>(ch.state_line[states[i]]));
+        }
+        result.found = true;
+        compute_totals(result);
+        return result;
+    }
+    
+    // Append the states after `from` on the route that the arc between
+    // `from` and `to` stands for, ending with `to`.
+    void unpack_arc(const ContractionHierarchy& ch, uint32_t from, uint32_t to,
+                    std::vector<uint32_t>& states) const {
+        uint32_t middle = ch.up_middle[ch.find_arc(from, to)];
+        if (middle == ContractionHierarchy::NO_NODE) {
+            states.push_back(to);
+            return;
+        }
+        unpack_arc(ch, from, middle, states);
+        unpack_arc(ch, middle, to, states);
+    }
+    
+    PathResult lookup_route(const RouteTable& table, int start_idx, int end_idx) const {
+        PathResult result;
+        size_t pair = table.pair(start_idx, end_idx);
+        if (table.best_line[pair] == RouteTable::NO_LINE) return result;
+        
+        unroll_path(start_idx, end_idx, static_cast<LineId>(table.best_line[pair]),
+            [&](int station, LineId line) {
+                size_t s = table.state(start_idx, station, line);
+                return std::make_pair(static_cast<int>(table.parent[s]), 
+                                      static_cast<LineId>(table.parent_line[s]));
+            }, result);
+        if (network_version != 0) {
+            // A table kept or repaired for this mode may hold routes over
+            // segments whose other weight an update changed (delays leave
+            // distances alone), so their stored totals can be stale.
+            compute_totals(result);
+            return result;
+        }
+        result.total_distance = table.distance[pair];
+        result.total_time = table.time[pair];
+        result.interchanges = table.interchanges[pair];
+        return result;
+    }
+    
+    void fill_route_table(const RouteTable& table, RouteTableBuffers& out, int source,
+                          bool minimize_time, QueryWorkspace& ws, PathResult& route) const {
+        run_search(source, minimize_time, ws);
+        
+        for (size_t station = 0; station < table.stations; ++station) {
+            for (int line = 0; line < static_cast<int>(graph.line_count); ++line) {
+                size_t s = ws.slot(static_cast<int>(station), static_cast<LineId>(line));
+                if (ws.cost_at(s) == INF || ws.parent[s] < 0) continue;
+                
+                size_t t = table.state(source, static_cast<int>(station), 
+                                       static_cast<LineId>(line));
+                out.parent[t] = static_cast<uint16_t>(ws.parent[s]);
+                out.parent_line[t] = static_cast<uint8_t>(ws.parent_line[s]);
+            }
+        }
+        
+        for (size_t target = 0; target < table.stations; ++target) {
+            int end_idx = static_cast<int>(target);
+            if (end_idx == source) continue;
+            
+            int best_line = best_arrival_line(end_idx, ws);
+            if (best_line < 0) continue;
+            
+            unroll_path(source, end_idx, static_cast<LineId>(best_line),
+                [&](int station, LineId line) {
+                    size_t s = ws.slot(station, line);
+                    return std::make_pair(ws.parent[s], ws.parent_line[s]);
+                }, route);
+            compute_totals(route);
+            
+            size_t pair = table.pair(source, end_idx);
+            out.best_line[pair] = static_cast<uint8_t>(best_line);
+            out.distance[pair] = static_cast<float>(route.total_distance);
+            out.time[pair] = static_cast<float>(route.total_time);
+            out.interchanges[pair] = static_cast<uint8_t>(std::min(route.interchanges, 255));
+        }
+    }
+};
+
+// The current version of a network that changes while it serves queries
+// (see NetworkUpdate). Readers take a snapshot() and keep one consistent
+// version for as long as they hold it; apply() derives the next version
+// with MetroSystem::updated and publishes it with one atomic pointer swap,
+// so queries never wait for an update and an update never waits for
+// queries. Versions share everything an update leaves unchanged, and an
+// old version is freed when its last reader lets go. Updates are applied
+// one at a time.
+class LiveNetwork {
+public:
+    explicit LiveNetwork(std::shared_ptr<const MetroSystem> network)
+        : current(std::move(network)),
+          hierarchical(current->hierarchy(true) || current->hierarchy(false)) {}
+    
+    LiveNetwork(const LiveNetwork&) = delete;
+    LiveNetwork& operator=(const LiveNetwork&) = delete;
+    
+    std::shared_ptr<const MetroSystem> snapshot() const { return std::atomic_load(&current); }
+    
+    MetroSystem::UpdateReport apply(const NetworkUpdate& update) {
+        std::lock_guard<std::mutex> lock(writer);
+        MetroSystem::UpdateReport report;
+        std::atomic_store(&current, std::atomic_load(&current)->updated(update, &report));
+        return report;
+    }
+    
+    // Re-contract the hierarchies that updates dropped, if the network
+    // started out with them. Takes as long as building them did, so call
+    // it off the query path once a burst of updates has settled; updates
+    // wait for it, queries do not.
+    void rebuild_hierarchies() {
+        std::lock_guard<std::mutex> lock(writer);
+        auto network = std::atomic_load(&current);
+        if (!hierarchical || (network->hierarchy(true) && network->hierarchy(false))) return;
+        std::atomic_store(&current, network->with_hierarchies());
+    }
+
+private:
+    std::shared_ptr<const MetroSystem> current;
+    bool hierarchical;
+    std::mutex writer;
+};
+
+// Long-running front end. One event-loop thread multiplexes every client
+// connection with epoll; the route requests that arrive in one wakeup are
+// answered together as a batch on the system's worker pool. Each request
+// and response is a JSON object on one line, and a client may pipeline as
+// many requests as it likes; responses come back in request order.
+//
+//   {"id": 1, "from": "PCMC Bhavan", "to": "Ramwadi", "mode": "distance"}
+//   {"id": 1, "found": true, "total_time": ..., "stations": [...], ...}
+//   {"id": 2, "op": "stats"}
+//   {"id": 2, "requests": ..., "connections": ..., "p50_us": ..., "p99_us": ..., "version": ...}
+//   (plus "cache_hits", "cache_misses" and "cache_hit_rate" with a route cache)
+//   {"id": 3, "op": "metrics"}
+//   {"id": 3, "metrics": "# HELP pune_metro_query_seconds ..."}
+//
+// "metrics" returns EngineMetrics::prometheus() as one string, and is an
+// error unless metrics are compiled in. "id" is optional and echoed as
+// written; "mode" defaults to "time". Operators change the live network
+// with the same protocol:
+//
+//   {"op": "close", "from": "Swargate", "to": "Mandai"}
+//   {"op": "delay", "from": ..., "to": ..., "line": "Purple Line", "minutes": 5}
+//   {"op": "close", "station": "Civil Court"}
+//   {"op": "restore", "line": "Aqua Line"}
+//   {"version": 3, "changed": 2}
+//
+// A segment update covers every line between the two stations unless
+// "line" names one; "line" alone covers the whole line. Requests read
+// before an update are answered on the version before it.
+// Malformed requests get {"id": ..., "error": "..."}. Latency is measured
+// from reading a request to queueing its response.
+class QueryServer {
+public:
+    explicit QueryServer(LiveNetwork& network) : live(network), metro(live.snapshot()) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epoll_fd < 0 || wake_fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "cannot create event loop");
+        }
+        watch(wake_fd, EPOLLIN);
+    }
+    
+    ~QueryServer() {
+        for (auto& [fd, connection] : connections) ::close(fd);
+        for (int fd : listeners) ::close(fd);
+        if (!socket_path.empty()) ::unlink(socket_path.c_str());
+        ::close(wake_fd);
+        ::close(epoll_fd);
+    }
+    
+    QueryServer(const QueryServer&) = delete;
+    QueryServer& operator=(const QueryServer&) = delete;
+    
+    // Listen on a Unix domain socket, replacing a stale socket file.
+    void listen_unix(const std::string& path) {
+        sockaddr_un address{};
+        if (path.size() >= sizeof(address.sun_path)) {
+            throw std::runtime_error("socket path too long: " + path);
+        }
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        ::unlink(path.c_str());
+        add_listener(AF_UNIX, reinterpret_cast<sockaddr*>(&address), sizeof(address), path);
+        socket_path = path;
+    }
+    
+    // Listen on 127.0.0.1; port 0 picks a free port. Returns the port.
+    uint16_t listen_tcp(uint16_t port) {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        int fd = add_listener(AF_INET, reinterpret_cast<sockaddr*>(&address), sizeof(address),
+                              "127.0.0.1:" + std::to_string(port));
+        socklen_t length = sizeof(address);
+        getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length);
+        return ntohs(address.sin_port);
+    }
+    
+    // Serve until stop() is called.
+    void run() {
+        epoll_event events[MAX_EVENTS];
+        stopping = false;
+        while (!stopping) {
+            // Connections with requests left over don't wait; a listener out
+            // of descriptors is retried every second if no client leaves.
+            int timeout = !backlog.empty() ? 0 : accepting ? -1 : 1000;
+            int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+            if (ready < 0) {
+                if (errno == EINTR) continue;
+                throw std::system_error(errno, std::generic_category(), "epoll_wait");
+            }
+            if (ready == 0 && !accepting) listen_for_clients(true);
+            
+            auto now = Clock::now();
+            metro = live.snapshot();
+            for (int fd : std::exchange(backlog, {})) {
+                if (auto it = connections.find(fd); it != connections.end()) {
+                    read_some(it->second, now);
+                }
+            }
+            for (int i = 0; i < ready; ++i) {
+                int fd = events[i].data.fd;
+                uint32_t flags = events[i].events;
+                if (fd == wake_fd) {
+                    uint64_t count;
+                    while (::read(wake_fd, &count, sizeof(count)) > 0) {}
+                    stopping = true;
+                } else if (std::find(listeners.begin(), listeners.end(), fd) != listeners.end()) {
+                    accept_all(fd);
+                } else if (auto it = connections.find(fd); it != connections.end()) {
+                    Connection& connection = it->second;
+                    if (flags & (EPOLLIN | EPOLLHUP | EPOLLRDHUP | EPOLLERR)) read_some(connection, now);
+                    if (flags & EPOLLOUT) touched.push_back(fd);
+                }
+            }
+            answer_pending();
+            flush_touched();
+        }
+    }
+    
+    // Safe to call from any thread and from a signal handler.
+    void stop() {
+        uint64_t one = 1;
+        [[maybe_unused]] ssize_t written = ::write(wake_fd, &one, sizeof(one));
+    }
+    
+    // Stop the server on SIGINT and SIGTERM.
+    static void stop_on_signals(QueryServer& server) {
+        signalled_server = &server;
+        std::signal(SIGINT, [](int) { signalled_server->stop(); });
+        std::signal(SIGTERM, [](int) { signalled_server->stop(); });
+    }
+    
+    // Thousands of clients need more descriptors than the usual soft limit.
+    static void raise_descriptor_limit() {
+        rlimit limit{};
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+    }
+    
+    const LatencyHistogram& latency() const { return latencies; }
+    size_t connection_count() const { return connections.size(); }
+
+private:
+    using Clock = std::chrono::steady_clock;
+    
+    constexpr static int MAX_EVENTS = 256;
+    constexpr static size_t MAX_LINE = 64 * 1024;
+    constexpr static size_t OUTPUT_HIGH_WATER = 1 << 20;
+    constexpr static size_t MAX_OWED = 256;  // requests per connection per wakeup
+    
+    struct Connection {
+        int fd;
+        uint64_t serial;
+        std::string input;
+        std::string output;
+        size_t written = 0;
+        size_t owed = 0;  // requests read but not yet answered into `output`
+        uint32_t events = 0;
+        bool eof = false;
+        
+        bool has_request() const { return input.find('\n') != std::string::npos; }
+    };
+    
+    // One parsed request awaiting its response. Route requests are answered
+    // by queries[query]; the rest carry their response already.
+    struct Pending {
+        int fd;
+        uint64_t serial;
+        Clock::time_point received;
+        std::string response;
+        long query;
+    };
+    
+    inline static QueryServer* signalled_server = nullptr;
+    
+    LiveNetwork& live;
+    std::shared_ptr<const MetroSystem> metro;  // the version this wakeup's requests see
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    std::vector<int> listeners;
+    std::string socket_path;
+    std::unordered_map<int, Connection> connections;
+    uint64_t next_serial = 0;
+    std::vector<Pending> pending;
+    std::vector<MetroSystem::StationQuery> queries;
+    std::vector<int> touched;
+    std::vector<int> backlog;  // connections with whole requests still unread
+    bool accepting = true;
+    JsonFields request;
+    std::string update_error;
+    LatencyHistogram latencies;
+    std::atomic<bool> stopping{false};
+    char buffer[64 * 1024];
+    
+    void watch(int fd, uint32_t events) {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            throw std::system_error(errno, std::generic_category(), "epoll_ctl");
+        }
+    }
+    
+    int add_listener(int family, const sockaddr* address, socklen_t length, 
+                     const std::string& label) {
+        int fd = ::socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) throw std::system_error(errno, std::generic_category(), "socket");
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (::bind(fd, address, length) < 0 || ::listen(fd, SOMAXCONN) < 0) {
+            int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "cannot listen on " + label);
+        }
+        listeners.push_back(fd);
+        watch(fd, EPOLLIN);
+        return fd;
+    }
+    
+    void accept_all(int listener) {
+        while (true) {
+            int fd = ::accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                // Out of descriptors the listener stays readable, so it is
+                // disarmed until a client leaves rather than woken forever.
+                if (errno == EMFILE || errno == ENFILE) listen_for_clients(false);
+                return;
+            }
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));  // fails harmlessly on Unix sockets
+            Connection& connection = connections[fd];
+            connection.fd = fd;
+            connection.serial = next_serial++;
+            connection.events = EPOLLIN | EPOLLRDHUP;
+            watch(fd, connection.events);
+        }
+    }
+    
+    // Stop or resume waiting for clients on every listener.
+    void listen_for_clients(bool on) {
+        if (accepting == on) return;
+        for (int fd : listeners) {
+            epoll_event event{};
+            if (on) event.events = EPOLLIN;
+            event.data.fd = fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+        }
+        accepting = on;
+    }
+    
+    bool has_room(const Connection& connection) const {
+        return connection.output.size() - connection.written < OUTPUT_HIGH_WATER &&
+               connection.owed < MAX_OWED;
+    }
+    
+    // At most one buffer from the socket, and at most MAX_OWED requests,
+    // per wakeup, so that a client pipelining faster than it is answered
+    // neither starves the others nor piles up unanswered requests. Whole
+    // requests left in `input` are taken up again by flush_touched().
+    void read_some(Connection& connection, Clock::time_point now) {
+        while (!connection.eof && has_room(connection) && !connection.has_request()) {
+            ssize_t got = ::recv(connection.fd, buffer, sizeof(buffer), 0);
+            if (got < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) connection.eof = true;
+            } else if (got == 0) {
+                connection.eof = true;
+            } else {
+                connection.input.append(buffer, static_cast<size_t>(got));
+            }
+            break;
+        }
+        
+        size_t begin = 0, newline;
+        while (has_room(connection) && 
+               (newline = connection.input.find('\n', begin)) != std::string::npos) {
+            handle_line(connection, std::string_view(connection.input).substr(begin, newline - begin), now);
+            begin = newline + 1;
+        }
+        connection.input.erase(0, begin);
+        if (connection.input.size() > MAX_LINE && !connection.has_request()) {
+            connection.input.clear();
+            queue(connection, {connection.fd, connection.serial, now, 
+                               "{\"error\":\"request line too long\"}\n", -1});
+            connection.eof = true;
+        }
+        touched.push_back(connection.fd);
+    }
+    
+    void queue(Connection& connection, Pending reply) {
+        ++connection.owed;
+        pending.push_back(std::move(reply));
+    }
+    
+    void handle_line(Connection& connection, std::string_view line, Clock::time_point now) {
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        if (line.find_first_not_of(" \t") == std::string_view::npos) return;
+        
+        Pending reply{connection.fd, connection.serial, now, "{", -1};
+        auto fail = [&](const std::string& message) {
+            JsonFields::append_string(reply.response += "\"error\":", message);
+            reply.response += "}\n";
+            queue(connection, std::move(reply));
+        };
+        
+        if (!request.parse(line)) return fail("malformed JSON object");
+        if (const auto* id = request.find("id")) {
+            reply.response += "\"id\":";
+            reply.response += id->raw;
+            reply.response += ",";
+        }
+        
+        const auto* op = request.find("op");
+        if (op && op->value == "stats") {
+            reply.response += "\"requests\":" + std::to_string(latencies.count()) + 
+                              ",\"connections\":" + std::to_string(connections.size()) +
+                              ",\"p50_us\":" + std::to_string(latencies.percentile(0.5)) +
+                              ",\"p99_us\":" + std::to_string(latencies.percentile(0.99)) + 
+                              ",\"version\":" + std::to_string(metro->version());
+            if (const auto* cache = metro->cache()) {
+                auto cached = cache->stats();
+                char rate[32];
+                std::snprintf(rate, sizeof(rate), "%.4f", cached.hit_rate());
+                reply.response += ",\"cache_hits\":" + std::to_string(cached.hits) + 
+                                  ",\"cache_misses\":" + std::to_string(cached.misses) +
+                                  ",\"cache_hit_rate\":" + rate;
+            }
+            reply.response += "}\n";
+            queue(connection, std::move(reply));
+            return;
+        }
+        if (op && op->value == "metrics") {
+            if (!METRICS_ENABLED) return fail("metrics need a build with -DPUNE_METRO_METRICS=1");
+            answer_pending();  // count the requests before this one
+            JsonFields::append_string(reply.response += "\"metrics\":", 
+                EngineMetrics::prometheus() + (metro->cache() ? metro->cache()->prometheus() : ""));
+            reply.response += "}\n";
+            queue(connection, std::move(reply));
+            return;
+        }
+        if (op && (op->value == "close" || op->value == "delay" || op->value == "restore")) {
+            NetworkUpdate update;
+            try {
+                if (!parse_update(op->value, update)) return fail(update_error);
+            } catch (const std::invalid_argument& e) {
+                return fail(e.what());
+            }
+            answer_pending();  // earlier requests see the network before the update
+            auto report = live.apply(update);
+            metro = live.snapshot();
+            reply.response += "\"version\":" + std::to_string(report.version) + 
+                              ",\"changed\":" + std::to_string(report.changed_edges) + "}\n";
+            queue(connection, std::move(reply));
+            return;
+        }
+        if (op && op->value != "route") return fail("unknown op");
+        
+        const auto* from = request.find("from");
+        const auto* to = request.find("to");
+        if (!from || !to || !from->string || !to->string) {
+            return fail("route needs \"from\" and \"to\" station names");
+        }
+        bool minimize_time = true;
+        if (const auto* mode = request.find("mode")) {
+            if (mode->value == "distance") {
+                minimize_time = false;
+            } else if (mode->value != "time") {
+                return fail("mode must be \"time\" or \"distance\"");
+            }
+        }
+        StationId start = metro->station_id(from->value);
+        if (!start.valid()) return fail("unknown station: " + std::string(from->value));
+        StationId end = metro->station_id(to->value);
+        if (!end.valid()) return fail("unknown station: " + std::string(to->value));
+        
+        reply.query = static_cast<long>(queries.size());
+        queries.push_back({start, end, minimize_time});
+        queue(connection, std::move(reply));
+    }
+    
+    // Translate a close/delay/restore request into `update`; on false,
+    // update_error says what is wrong with it.
+    bool parse_update(std::string_view action, NetworkUpdate& update) {
+        auto station = [&](const char* key, StationId& id) {
+            const auto* field = request.find(key);
+            id = field && field->string ? metro->station_id(field->value) : StationId();
+            if (!id.valid()) update_error = field ? "unknown station: " + std::string(field->value) 
+                                                  : std::string("missing \"") + key + "\"";
+            return id.valid();
+        };
+        
+        int line = -1;
+        if (const auto* field = request.find("line")) {
+            line = field->string ? metro->find_line(field->value) : -1;
+            if (line < 0) {
+                update_error = "unknown line: " + std::string(field->value);
+                return false;
+            }
+        }
+        double minutes = 0;
+        if (action == "delay") {
+            const auto* field = request.find("minutes");
+            if (!field || field->string) {
+                update_error = "delay needs a number of \"minutes\"";
+                return false;
+            }
+            minutes = std::strtod(std::string(field->value).c_str(), nullptr);
+        }
+        
+        StationId from, to;
+        if (request.find("station")) {
+            if (!station("station", from)) return false;
+            if (action == "delay") {
+                update_error = "stations can be closed or restored, not delayed";
+                return false;
+            }
+            if (action == "close") update.close_station(from);
+            if (action == "restore") update.restore_station(from);
+        } else if (request.find("from") || request.find("to")) {
+            if (!station("from", from) || !station("to", to)) return false;
+            if (action == "close") update.close_segment(from, to, line);
+            if (action == "delay") update.delay_segment(from, to, minutes, line);
+            if (action == "restore") update.restore_segment(from, to, line);
+        } else if (line >= 0) {
+            auto id = static_cast<LineId>(line);
+            if (action == "close") update.close_line(id);
+            if (action == "delay") update.delay_line(id, minutes);
+            if (action == "restore") update.restore_line(id);
+        } else {
+            update_error = "an update needs \"from\" and \"to\", a \"station\" or a \"line\"";
+            return false;
+        }
+        return true;
+    }
+    
+    void answer_pending() {
+        if (pending.empty()) return;
+        auto routes = metro->find_paths_batch(ArrayView<MetroSystem::StationQuery>(queries));
+        
+        for (auto& reply : pending) {
+            auto it = connections.find(reply.fd);
+            if (it == connections.end() || it->second.serial != reply.serial) continue;
+            --it->second.owed;
+            if (reply.query >= 0) {
+                metro->append_json(reply.response, routes[static_cast<size_t>(reply.query)]);
+                reply.response += "}\n";
+            }
+            it->second.output += reply.response;
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                Clock::now() - reply.received);
+            latencies.record(static_cast<uint64_t>(elapsed.count()));
+        }
+        pending.clear();
+        queries.clear();
+    }
+    
+    // Write what each touched connection has queued, then close it or
+    // adjust what it waits for: more requests, or room to write. One with
+    // whole requests still unread and room for their answers goes on the
+    // backlog for the next wakeup.
+    void flush_touched() {
+        std::sort(touched.begin(), touched.end());
+        touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+        for (int fd : touched) {
+            auto it = connections.find(fd);
+            if (it == connections.end()) continue;
+            Connection& connection = it->second;
+            
+            bool broken = false;
+            while (connection.written < connection.output.size()) {
+                ssize_t sent = ::send(fd, connection.output.data() + connection.written,
+                                      connection.output.size() - connection.written, MSG_NOSIGNAL);
+                if (sent < 0) {
+                    if (errno == EINTR) continue;
+                    broken = errno != EAGAIN && errno != EWOULDBLOCK;
+                    break;
+                }
+                connection.written += static_cast<size_t>(sent);
+            }
+            if (connection.written == connection.output.size()) {
+                connection.output.clear();
+                connection.written = 0;
+            }
+            
+            size_t queued = connection.output.size() - connection.written;
+            bool unread = connection.has_request();
+            if (broken || (connection.eof && queued == 0 && !unread)) {
+                ::close(fd);
+                connections.erase(it);
+                listen_for_clients(true);
+                continue;
+            }
+            if (unread && queued < OUTPUT_HIGH_WATER) backlog.push_back(fd);
+            uint32_t events = 0;
+            if (queued > 0) events |= EPOLLOUT;
+            if (!connection.eof && queued < OUTPUT_HIGH_WATER) events |= EPOLLIN | EPOLLRDHUP;
+            if (events != connection.events) {
+                epoll_event event{};
+                event.events = events;
+                event.data.fd = fd;
+                epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+                connection.events = events;
+            }
+        }
+        touched.clear();
+    }
+};
+
+// Non-interactive front end for bulk jobs: reads one query per line and
+// writes one result per query, in input order. A query is either
+//
+//   <from station>,<to station>[,time|distance]
+//   {"id": ..., "from": "...", "to": "...", "mode": "time"|"distance"}
+//
+// and blank lines and lines starting with '#' are skipped. Input is read
+// and output written in large blocks with plain read()/write() calls, and
+// queries are solved a block at a time on the worker pool.
+//
+// JSON output is one object per line, as the query server answers (see
+// MetroSystem::append_json). Binary output, in host byte order, is
+//
+//   header  "PMRT", u32 version (1), u32 stations, u32 lines, then every
+//           station name and every line name as u16 length + bytes
+//   record  u8 status (0 found, 1 no route, 2 bad query), u8 mode
+//           (0 time, 1 distance), u16 interchanges, f32 minutes, f32 km,
+//           u32 n, n x u32 station index, max(n - 1, 0) x u8 line index
+class BatchRunner {
+public:
+    enum class Format { JSON, BINARY };
+    
+    struct Summary {
+        size_t queries = 0;
+        size_t failed = 0;  // malformed queries and unknown stations
+        size_t bytes = 0;
+    };
+    
+    BatchRunner(const MetroSystem& ms, Format output_format) 
+        : metro(ms), format(output_format), input(INPUT_BLOCK) {
+        output.reserve(OUTPUT_BLOCK + 64 * 1024);
+        slots.resize(QUERY_BLOCK);
+        queries.reserve(QUERY_BLOCK);
+    }
+    
+    Summary run(int in_fd, int out_fd) {
+        summary = Summary();
+        out = out_fd;
+        if (format == Format::BINARY) write_header();
+        
+        size_t filled = 0;
+        while (true) {
+            if (filled == input.size()) input.resize(input.size() * 2);  // a very long line
+            ssize_t got = ::read(in_fd, input.data() + filled, input.size() - filled);
+            if (got < 0) {
+                if (errno == EINTR) continue;
+                throw std::system_error(errno, std::generic_category(), "cannot read queries");
+            }
+            if (got == 0) break;
+            filled += static_cast<size_t>(got);
+            
+            size_t begin = 0;
+            for (size_t at = begin; at < filled; ++at) {
+                if (input[at] != '\n') continue;
+                add_query(std::string_view(input.data() + begin, at - begin));
+                begin = at + 1;
+            }
+            std::memmove(input.data(), input.data() + begin, filled - begin);
+            filled -= begin;
+        }
+        if (filled > 0) add_query(std::string_view(input.data(), filled));
+        
+        solve_block();
+        write_output();
+        return summary;
+    }
+
+private:
+    constexpr static size_t INPUT_BLOCK = 1 << 20;
+    constexpr static size_t OUTPUT_BLOCK = 1 << 20;
+    constexpr static size_t QUERY_BLOCK = 8192;
+    
+    enum Status : uint8_t { FOUND = 0, NO_ROUTE, BAD_QUERY };
+    
+    // One input query of the current block; `query` indexes `queries` once
+    // the stations are known, `error` explains a query that has none.
+    struct Slot {
+        std::string id;
+        bool has_id = false;
+        bool minimize_time = true;
+        long query = -1;
+        const char* error = nullptr;
+        std::string station;  // the unknown one, for the message
+    };
+    
+    const MetroSystem& metro;
+    Format format;
+    std::vector<char> input;
+    std::string output;
+    std::vector<Slot> slots;
+    size_t used = 0;
+    std::vector<MetroSystem::StationQuery> queries;
+    JsonFields request;
+    Summary summary;
+    int out = -1;
+    
+    static std::string_view trim(std::string_view text) {
+        while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) text.remove_prefix(1);
+        while (!text.empty() && (text.back() == ' ' || text.back() == '\t' || text.back() == '\r')) {
+            text.remove_suffix(1);
+        }
+        return text;
+    }
+    
+    void add_query(std::string_view line) {
+        line = trim(line);
+        if (line.empty() || line.front() == '#') return;
+        
+        Slot& slot = slots[used++];
+        slot.has_id = false;
+        slot.minimize_time = true;
+        slot.query = -1;
+        slot.error = nullptr;
+        slot.station.clear();
+        ++summary.queries;
+        
+        std::string_view from, to, mode;
+        if (line.front() == '{') {
+            if (!request.parse(line)) return reject(slot, "malformed query");
+            if (const auto* id = request.find("id")) {
+                slot.id.assign(id->raw);
+                slot.has_id = true;
+            }
+            const auto* start = request.find("from");
+            const auto* end = request.find("to");
+            if (!start || !end || !start->string || !end->string) {
+                return reject(slot, "malformed query");
+            }
+            from = start->value;
+            to = end->value;
+            if (const auto* m = request.find("mode")) mode = m->value;
+        } else {
+            size_t first = line.find(',');
+            if (first == std::string_view::npos) return reject(slot, "malformed query");
+            size_t second = line.find(',', first + 1);
+            from = trim(line.substr(0, first));
+            to = trim(line.substr(first + 1, second == std::string_view::npos ? second : second - first - 1));
+            if (second != std::string_view::npos) mode = trim(line.substr(second + 1));
+        }
+        
+        if (mode == "distance") {
+            slot.minimize_time = false;
+        } else if (!mode.empty() && mode != "time") {
+            return reject(slot, "mode must be time or distance");
+        }
+        StationId start = metro.station_id(from);
+        StationId end = start.valid() ? metro.station_id(to) : StationId();
+        if (!start.valid() || !end.valid()) {
+            slot.station.assign(!start.valid() ? from : to);
+            return reject(slot, "unknown station");
+        }
+        
+        slot.query = static_cast<long>(queries.size());
+        queries.push_back({start, end, slot.minimize_time});
+        if (used == slots.size()) solve_block();
+    }
+    
+    void reject(Slot& slot, const char* message) {
+        slot.error = message;
+        ++summary.failed;
+        if (used == slots.size()) solve_block();
+    }
+    
+    void solve_block() {
+        auto routes = metro.find_paths_batch(ArrayView<MetroSystem::StationQuery>(queries));
+        for (size_t i = 0; i < used; ++i) {
+            const Slot& slot = slots[i];
+            static const MetroSystem::PathResult no_route;
+            const auto& route = slot.query >= 0 ? routes[static_cast<size_t>(slot.query)] : no_route;
+            if (format == Format::JSON) {
+                append_json(slot, route);
+            } else {
+                append_binary(slot, route);
+            }
+            if (output.size() >= OUTPUT_BLOCK) write_output();
+        }
+        used = 0;
+        queries.clear();
+    }
+    
+    void append_json(const Slot& slot, const MetroSystem::PathResult& route) {
+        output.push_back('{');
+        if (slot.has_id) {
+            output += "\"id\":";
+            output += slot.id;
+            output.push_back(',');
+        }
+        if (slot.error) {
+            output += "\"error\":";
+            JsonFields::append_string(output, slot.station.empty() ? std::string(slot.error) 
+                                                                   : slot.error + (": " + slot.station));
+        } else {
+            metro.append_json(output, route);
+        }
+        output += "}\n";
+    }
+    
+    template <typename T>
+    void put(T value) {
+        output.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    
+    void put_name(std::string_view name) {
+        put(static_cast<uint16_t>(name.size()));
+        output.append(name);
+    }
+    
+    void write_header() {
+        const auto& graph = metro.network();
+        output.append("PMRT", 4);
+        put(uint32_t{1});
+        put(static_cast<uint32_t>(graph.station_count()));
+        put(static_cast<uint32_t>(graph.line_count));
+        for (size_t s = 0; s < graph.station_count(); ++s) put_name(graph.name(static_cast<int>(s)));
+        for (size_t l = 0; l < graph.line_count; ++l) put_name(graph.line_name(static_cast<LineId>(l)));
+    }
+    
+    void append_binary(const Slot& slot, const MetroSystem::PathResult& route) {
+        put(static_cast<uint8_t>(slot.error ? BAD_QUERY : route.found ? FOUND : NO_ROUTE));
+        put(static_cast<uint8_t>(slot.minimize_time ? 0 : 1));
+        put(static_cast<uint16_t>(route.interchanges));
+        put(static_cast<float>(route.total_time));
+        put(static_cast<float>(route.total_distance));
+        put(static_cast<uint32_t>(route.path.size()));
+        for (int station : route.path) put(static_cast<uint32_t>(station));
+        for (LineId line : route.path_lines) put(static_cast<uint8_t>(line));
+    }
+    
+    void write_output() {
+        size_t done = 0;
+        while (done < output.size()) {
+            ssize_t n = ::write(out, output.data() + done, output.size() - done);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                throw std::system_error(errno, std::generic_category(), "cannot write results");
+            }
+            done += static_cast<size_t>(n);
+        }
+        summary.bytes += output.size();
+        output.clear();
+    }
+};
+
+// Synthetic network description on a square grid of roughly `stations`
+// stations about a kilometre apart. Half the lines snake through
+// horizontal bands of rows, the other half through vertical bands of
+// columns, so every station is an interchange between two lines.
+// Segments are 1.0-1.6x longer than the straight line between stations.
+// A non-zero headway runs every line at that interval from 05:00 to 23:00.
+// With `parallel` > 1 each band is served by that many lines over the same
+// segments, so every station lies on 2 x parallel lines.
+inline std::string synthetic_network(int stations, int lines, unsigned seed, 
+                              int headway_minutes = 0, int parallel = 1) {
+    int side = std::max(2, static_cast<int>(std::sqrt(static_cast<double>(stations))));
+    parallel = std::max(1, parallel);
+    int bands = std::max(1, std::min(lines / (2 * parallel), side));
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> km(1.12, 1.8);
+    std::ostringstream out;
+    
+    out << std::fixed << std::setprecision(4);
+    for (int row = 0; row < side; ++row) {
+        for (int col = 0; col < side; ++col) {
+            out << "station,Synthetic " << row << "-" << col << "," 
+                << 18.0 + row * 0.01 << "," << 73.0 + col * 0.01 << "\n";
+        }
+    }
+    
+    auto name = [&](int row, int col) {
+        return "Synthetic " + std::to_string(row) + "-" + std::to_string(col);
+    };
+    
+    for (int axis = 0; axis < 2; ++axis) {
+        for (int band = 0; band < bands; ++band) {
+            int first = band * side / bands, last = (band + 1) * side / bands;
+            std::ostringstream segments;
+            std::string prev;
+            for (int major = first; major < last; ++major) {
+                for (int step = 0; step < side; ++step) {
+                    int minor = (major - first) % 2 == 0 ? step : side - 1 - step;
+                    std::string current = axis == 0 ? name(major, minor) : name(minor, major);
+                    if (!prev.empty()) {
+                        segments << "," << prev << "," << current << "," 
+                                 << std::fixed << std::setprecision(2) << km(rng) << "\n";
+                    }
+                    prev = std::move(current);
+                }
+            }
+            
+            for (int copy = 0; copy < parallel; ++copy) {
+                std::string line = (axis == 0 ? "H" : "V") + std::to_string(band);
+                if (parallel > 1) line += "." + std::to_string(copy);
+                out << "line," << line << "\n";
+                if (headway_minutes > 0) {
+                    out << "service," << line << ",05:00,23:00," << headway_minutes << "\n";
+                }
+                
+                std::istringstream rows(segments.str());
+                std::string row;
+                while (std::getline(rows, row)) out << "segment," << line << row << "\n";
+            }
+        }
+    }
+    return out.str();
+}
+
+// Synthetic skewed traffic: `count` station pairs drawn from `distinct`
+// random pairs (start != end) of a network with `stations` stations, the
+// pair of popularity rank r with probability proportional to 1 / r^exponent
+// (a Zipf distribution).
+inline std::vector<std::pair<int, int>> zipf_queries(int stations, size_t distinct, size_t count,
+                                                     double exponent, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> station(0, std::max(1, stations) - 1);
+    std::vector<std::pair<int, int>> pairs(std::max<size_t>(distinct, 1));
+    for (auto& pair : pairs) {
+        do {
+            pair = {station(rng), station(rng)};
+        } while (pair.first == pair.second && stations > 1);
+    }
+    
+    std::vector<double> cumulative(pairs.size());
+    double total = 0;
+    for (size_t rank = 0; rank < pairs.size(); ++rank) {
+        total += 1.0 / std::pow(static_cast<double>(rank + 1), exponent);
+        cumulative[rank] = total;
+    }
+    std::uniform_real_distribution<double> draw(0.0, total);
+    std::vector<std::pair<int, int>> queries(count);
+    for (auto& query : queries) {
+        size_t rank = static_cast<size_t>(
+            std::lower_bound(cumulative.begin(), cumulative.end(), draw(rng)) - cumulative.begin());
+        query = pairs[std::min(rank, pairs.size() - 1)];
+    }
+    return queries;
+}
@@ -0,0 +1,1083 @@
+// Equivalence and protocol tests for the route planner. Every search
+// engine is checked against a plain line-aware Dijkstra written here from
+// the definition, on the built-in network and on a synthetic grid; the
+// other cases cover the image format, batch mode, the query server and
+// the features built on the engines. Run through ctest, or directly with
+// an optional substring to select cases by name.
+//
+// Each case is a function registered in CASES below; add new ones there.
+#include <cstdio>
+
+#include "pune_metro.h"
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition)                                                              \
+    do {                                                                              \
+        if (!(condition)) {                                                           \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__,     \
+                         #condition);                                                 \
+            ++failures;                                                               \
+        }                                                                             \
+    } while (0)
+
+// Interchange penalties of the two cost modes (MetroSystem keeps them
+// private).
+constexpr double TIME_PENALTY = 4.0;
+constexpr double DISTANCE_PENALTY = 0.5;
+constexpr double TOLERANCE = 1e-3;  // segment weights are floats
+
+using PathResult = MetroSystem::PathResult;
+
+// The cost of the cheapest route from start to every station: boarding
+// any line at start is free, every segment costs its weight and every
+// change of line the mode's penalty. Closed segments are skipped.
+std::vector<double> reference_costs(const NetworkGraph& graph, int start, bool minimize_time) {
+    const size_t lines = graph.line_count;
+    const double penalty = minimize_time ? TIME_PENALTY : DISTANCE_PENALTY;
+    const auto& weight = minimize_time ? graph.edge_time : graph.edge_distance;
+    std::vector<double> cost(graph.station_count() * lines, INF);
+    std::priority_queue<std::pair<double, size_t>, std::vector<std::pair<double, size_t>>,
+                        std::greater<>> queue;
+
+    auto relax = [&](uint32_t e, double base, int from_line) {
+        if (weight[e] == INF) return;
+        size_t line = graph.edge_line[e];
+        double next = base + weight[e] + (from_line >= 0 && line != size_t(from_line) ? penalty : 0);
+        size_t state = graph.edge_to[e] * lines + line;
+        if (next < cost[state]) {
+            cost[state] = next;
+            queue.push({next, state});
+        }
+    };
+    for (uint32_t e = graph.offsets[start]; e < graph.offsets[start + 1]; ++e) relax(e, 0, -1);
+    while (!queue.empty()) {
+        auto [c, state] = queue.top();
+        queue.pop();
+        if (c > cost[state]) continue;
+        int station = static_cast<int>(state / lines);
+        for (uint32_t e = graph.offsets[station]; e < graph.offsets[station + 1]; ++e) {
+            relax(e, c, static_cast<int>(state % lines));
+        }
+    }
+
+    std::vector<double> best(graph.station_count(), INF);
+    for (size_t state = 0; state < cost.size(); ++state) {
+        best[state / lines] = std::min(best[state / lines], cost[state]);
+    }
+    best[start] = 0;
+    return best;
+}
+
+// Whether `route` runs from start to end over open segments of the lines
+// it names, and its totals are those of that ride.
+bool well_formed(const NetworkGraph& graph, const PathResult& route, int start, int end) {
+    if (!route.found || route.path.empty() || route.path.front() != start ||
+        route.path.back() != end || route.path_lines.size() + 1 != route.path.size()) {
+        return false;
+    }
+    double time = 0, distance = 0;
+    int interchanges = 0;
+    for (size_t i = 0; i + 1 < route.path.size(); ++i) {
+        int e = graph.find_edge(route.path[i], route.path[i + 1], route.path_lines[i]);
+        if (e < 0 || graph.edge_time[e] == INF) return false;
+        time += graph.edge_time[e];
+        distance += graph.edge_distance[e];
+        if (i > 0 && route.path_lines[i - 1] != route.path_lines[i]) ++interchanges;
+    }
+    return interchanges == route.interchanges &&
+           std::abs(distance - route.total_distance) < TOLERANCE &&
+           std::abs(time + interchanges * TIME_PENALTY - route.total_time) < TOLERANCE;
+}
+
+double route_cost(const PathResult& route, bool minimize_time) {
+    return minimize_time ? route.total_time
+                         : route.total_distance + DISTANCE_PENALTY * route.interchanges;
+}
+
+// Check find_optimal_path against reference_costs from each start in
+// `starts` to every station, in both cost modes.
+void check_routes(const MetroSystem& system, const std::vector<int>& starts,
+                  MetroSystem::SearchAlgorithm algorithm) {
+    const auto& graph = system.network();
+    auto& ws = MetroSystem::thread_workspace();
+    for (bool minimize_time : {true, false}) {
+        for (int start : starts) {
+            auto expected = reference_costs(graph, start, minimize_time);
+            for (int end = 0; end < static_cast<int>(graph.station_count()); ++end) {
+                auto route = system.find_optimal_path(StationId(start), StationId(end), minimize_time,
+                                                       ws, algorithm);
+                if (expected[end] == INF) {
+                    CHECK(!route.found);
+                    continue;
+                }
+                CHECK(well_formed(graph, route, start, end));
+                CHECK(std::abs(route_cost(route, minimize_time) - expected[end]) < TOLERANCE);
+            }
+        }
+    }
+}
+
+std::vector<int> every_station(const MetroSystem& system) {
+    std::vector<int> stations(system.network().station_count());
+    std::iota(stations.begin(), stations.end(), 0);
+    return stations;
+}
+
+std::vector<StationId> ids(const std::vector<int>& stations) {
+    return std::vector<StationId>(stations.begin(), stations.end());
+}
+
+std::vector<int> random_stations(const MetroSystem& system, size_t count, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> station(
+        0, static_cast<int>(system.network().station_count()) - 1);
+    std::vector<int> stations(count);
+    for (int& s : stations) s = station(rng);
+    return stations;
+}
+
+MetroSystem& synthetic() {
+    static std::unique_ptr<MetroSystem> system;
+    if (!system) {
+        std::istringstream csv(synthetic_network(900, 12, 7));
+        system = std::make_unique<MetroSystem>(csv);
+    }
+    return *system;
+}
+
+// Every search algorithm, priority queue and relaxation kernel.
+void check_searches(MetroSystem& system, const std::vector<int>& starts) {
+    using Algorithm = MetroSystem::SearchAlgorithm;
+    for (auto algorithm : {Algorithm::DIJKSTRA, Algorithm::BIDIRECTIONAL, Algorithm::ASTAR}) {
+        check_routes(system, starts, algorithm);
+    }
+    for (auto kind : {SearchQueue::Kind::BINARY_HEAP, SearchQueue::Kind::DARY_HEAP,
+                      SearchQueue::Kind::RADIX_HEAP}) {
+        system.set_queue_kind(kind);
+        check_routes(system, starts, Algorithm::DIJKSTRA);
+        check_routes(system, starts, Algorithm::BIDIRECTIONAL);
+    }
+    system.reset_queue_kind();
+
+    bool vector = system.uses_vector_relaxation();
+    for (bool enabled : {false, true}) {
+        system.set_vector_relaxation(enabled);
+        check_routes(system, starts, Algorithm::ASTAR);
+    }
+    system.set_vector_relaxation(vector);
+}
+
+void pune_searches() {
+    MetroSystem pune;
+    check_searches(pune, every_station(pune));
+}
+
+void synthetic_searches() {
+    MetroSystem& system = synthetic();
+    check_searches(system, random_stations(system, 4, 3));
+}
+
+void route_tables() {
+    MetroSystem pune;
+    pune.precompute_routes();
+    check_routes(pune, every_station(pune), MetroSystem::SearchAlgorithm::ASTAR);
+
+    std::istringstream csv(synthetic_network(400, 12, 7));
+    MetroSystem system(csv);
+    system.precompute_routes();
+    check_routes(system, random_stations(system, 8, 5), MetroSystem::SearchAlgorithm::ASTAR);
+}
+
+void hierarchies() {
+    MetroSystem pune;
+    pune.build_hierarchies();
+    check_routes(pune, every_station(pune), MetroSystem::SearchAlgorithm::ASTAR);
+
+    std::istringstream csv(synthetic_network(900, 12, 7));
+    MetroSystem system(csv);
+    system.build_hierarchies();
+    check_routes(system, random_stations(system, 6, 5), MetroSystem::SearchAlgorithm::ASTAR);
+}
+
+// Closures and delays, with and without route tables to repair.
+void live_updates() {
+    std::istringstream csv(synthetic_network(400, 12, 7));
+    auto base = std::make_shared<MetroSystem>(csv);
+    base->precompute_routes();
+
+    NetworkUpdate update;
+    update.close_station(base->station_id("Synthetic 10-10"))
+          .close_segment(base->station_id("Synthetic 3-4"), base->station_id("Synthetic 3-5"))
+          .delay_line(0, 2.5);
+    MetroSystem::UpdateReport report;
+    auto next = base->updated(update, &report);
+    CHECK(next->version() == 1);
+    CHECK(report.changed_edges > 0);
+    check_routes(*next, random_stations(*next, 8, 9), MetroSystem::SearchAlgorithm::ASTAR);
+
+    auto searched = std::make_shared<MetroSystem>();
+    auto closed = searched->updated(NetworkUpdate().close_line(0));
+    check_routes(*closed, every_station(*closed), MetroSystem::SearchAlgorithm::BIDIRECTIONAL);
+}
+
+// Route tables repaired after segments get cheaper again: restored after
+// a delay, or delayed less than before. Restoring U-V on B makes S-W
+// cheaper by changing to B at X rather than at V, though V itself is
+// still reached sooner on A.
+void route_table_repairs() {
+    std::istringstream small_csv(
+        "segment,A,S,X,3.5\n"
+        "segment,A,X,V,7\n"
+        "segment,B,X,U,1.75\n"
+        "segment,B,U,V,3.5\n"
+        "segment,B,V,W,3.5\n");
+    auto small = std::make_shared<MetroSystem>(small_csv);
+    small->precompute_routes();
+    StationId u = small->station_id("U"), v = small->station_id("V");
+    auto delayed = small->updated(NetworkUpdate().delay_segment(u, v, 10, small->find_line("B")));
+    check_routes(*delayed, every_station(*delayed), MetroSystem::SearchAlgorithm::ASTAR);
+    auto restored = delayed->updated(NetworkUpdate().restore_segment(u, v));
+    check_routes(*restored, every_station(*restored), MetroSystem::SearchAlgorithm::ASTAR);
+
+    std::istringstream csv(synthetic_network(400, 12, 7));
+    auto base = std::make_shared<MetroSystem>(csv);
+    base->precompute_routes();
+    StationId a = base->station_id("Synthetic 3-4"), b = base->station_id("Synthetic 3-5");
+    auto slow = base->updated(NetworkUpdate().delay_line(0, 6).delay_line(3, 4)
+                                             .close_segment(a, b));
+    auto faster = slow->updated(NetworkUpdate().delay_line(0, 1).restore_line(3)
+                                               .restore_segment(a, b));
+    check_routes(*faster, every_station(*faster), MetroSystem::SearchAlgorithm::ASTAR);
+}
+
+// A saved image answers every query as the system it was saved from with
+// any checks, and damaged images are rejected unless trusted.
+void image_round_trip() {
+    using Checks = NetworkImage::Checks;
+    MetroSystem pune;
+    pune.precompute_routes();
+    pune.build_hierarchies();
+    std::string path = (std::filesystem::temp_directory_path() /
+                        ("pune_metro_test_" + std::to_string(getpid()) + ".img")).string();
+    pune.save_network(path);
+
+    for (Checks checks : {Checks::TRUSTED, Checks::STRUCTURE, Checks::CHECKSUM}) {
+        MetroSystem loaded(path, checks);
+        CHECK(loaded.network().station_count() == pune.network().station_count());
+        check_routes(loaded, every_station(loaded), MetroSystem::SearchAlgorithm::ASTAR);
+        for (int s = 0; s < static_cast<int>(pune.network().station_count()); ++s) {
+            CHECK(loaded.network().name(s) == pune.network().name(s));
+        }
+    }
+
+    std::vector<char> bytes;
+    {
+        std::ifstream in(path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    auto rejected = [&](const std::vector<char>& image, Checks checks) {
+        std::ofstream(path, std::ios::binary | std::ios::trunc).write(image.data(), image.size());
+        try {
+            MetroSystem loaded(path, checks);
+        } catch (const std::runtime_error&) {
+            return true;
+        }
+        return false;
+    };
+    auto flipped = bytes;
+    flipped[flipped.size() / 2] ^= 0x5A;
+    CHECK(rejected(flipped, Checks::CHECKSUM));
+    CHECK(rejected(std::vector<char>(bytes.begin(), bytes.end() - 64), Checks::TRUSTED));
+
+    // A segment to a station past the end, with the checksum left stale.
+    NetworkImage::Header header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    auto out_of_bounds = bytes;
+    for (uint32_t i = 0; i < header.section_count; ++i) {
+        NetworkImage::Section section;
+        std::memcpy(&section, bytes.data() + sizeof(header) + i * sizeof(section), sizeof(section));
+        if (section.id != NetworkImage::EDGE_TO) continue;
+        uint32_t station = header.station_count + 5000;
+        std::memcpy(out_of_bounds.data() + section.offset, &station, sizeof(station));
+    }
+    CHECK(out_of_bounds != bytes);
+    CHECK(rejected(out_of_bounds, Checks::STRUCTURE));
+    CHECK(!rejected(bytes, Checks::CHECKSUM));
+    std::remove(path.c_str());
+}
+
+// find_paths_batch gives what single queries give, in input order.
+void batch_queries() {
+    MetroSystem& system = synthetic();
+    auto starts = random_stations(system, 500, 21), ends = random_stations(system, 500, 22);
+    std::vector<MetroSystem::StationQuery> queries;
+    for (size_t i = 0; i < starts.size(); ++i) {
+        queries.push_back({StationId(starts[i]), StationId(ends[i]), i % 3 != 0});
+    }
+    system.set_thread_count(4);
+    auto results = system.find_paths_batch(ArrayView<MetroSystem::StationQuery>(queries));
+    CHECK(results.size() == queries.size());
+    for (size_t i = 0; i < queries.size(); ++i) {
+        auto single = system.find_optimal_path(queries[i].start, queries[i].end,
+                                               queries[i].minimize_time);
+        CHECK(results[i].path == single.path);
+        CHECK(results[i].path_lines == single.path_lines);
+    }
+
+    // Stations outside the network are not found rather than read past the
+    // end of the arrays.
+    int n = static_cast<int>(system.network().station_count());
+    StationId first(0), last(n - 1), outside(n), far(n + 5000);
+    std::vector<MetroSystem::StationQuery> bad = {
+        {first, far}, {StationId(), first}, {outside, outside}, {first, last}};
+    results = system.find_paths_batch(ArrayView<MetroSystem::StationQuery>(bad));
+    CHECK(!results[0].found && !results[1].found && !results[2].found && results[3].found);
+    auto& ws = MetroSystem::thread_workspace();
+    CHECK(!system.find_optimal_path(far, first, true, ws).found);
+    CHECK(!system.find_optimal_path(first, StationId(-7), false, ws,
+                                    MetroSystem::SearchAlgorithm::ASTAR).found);
+}
+
+// Whether `call` throws std::out_of_range.
+template <typename Call>
+bool out_of_range(Call&& call) {
+    try {
+        call();
+    } catch (const std::out_of_range&) {
+        return true;
+    }
+    return false;
+}
+
+// one_to_all and many_to_many agree with the reference, and reject
+// stations outside the network.
+void shared_searches() {
+    MetroSystem& system = synthetic();
+    const auto& graph = system.network();
+    auto sources = random_stations(system, 5, 71), targets = random_stations(system, 40, 72);
+    for (bool minimize_time : {true, false}) {
+        auto matrix = system.many_to_many(ids(sources), ids(targets), minimize_time);
+        auto reversed = system.many_to_many(ids(targets), ids(sources), minimize_time);
+        for (size_t row = 0; row < sources.size(); ++row) {
+            auto expected = reference_costs(graph, sources[row], minimize_time);
+            auto tree = system.one_to_all(StationId(sources[row]), minimize_time);
+            for (size_t col = 0; col < targets.size(); ++col) {
+                int target = targets[col];
+                CHECK(std::abs(tree.cost[target] - expected[target]) < TOLERANCE);
+                CHECK(std::abs(matrix.cost[matrix.cell(row, col)] - expected[target]) < TOLERANCE);
+                CHECK(std::abs(reversed.cost[reversed.cell(col, row)] - expected[target]) <
+                      TOLERANCE);
+                auto route = system.route_in_tree(tree, StationId(target));
+                CHECK(well_formed(graph, route, sources[row], target));
+            }
+        }
+    }
+
+    int n = static_cast<int>(graph.station_count());
+    std::vector<StationId> bad = {StationId(0), StationId(n + 5000)};
+    CHECK(out_of_range([&] { system.one_to_all(StationId(n + 5000), true); }));
+    CHECK(out_of_range([&] { system.one_to_all(StationId(), false); }));
+    CHECK(out_of_range([&] { system.many_to_many(ids(sources), bad, true); }));
+    CHECK(out_of_range([&] { system.many_to_many(bad, ids(sources), true); }));
+    auto tree = system.one_to_all(StationId(0), true);
+    CHECK(out_of_range([&] { system.route_in_tree(tree, StationId(n)); }));
+}
+
+// Everything `fd` delivers until end of file.
+std::string read_all(int fd) {
+    std::string text;
+    char buffer[4096];
+    ssize_t got;
+    while ((got = ::read(fd, buffer, sizeof(buffer))) > 0) text.append(buffer, got);
+    return text;
+}
+
+std::vector<std::string> split_lines(const std::string& text) {
+    std::vector<std::string> lines;
+    std::istringstream in(text);
+    for (std::string line; std::getline(in, line);) lines.push_back(line);
+    return lines;
+}
+
+bool contains(const std::string& text, std::string_view part) {
+    return text.find(part) != std::string::npos;
+}
+
+// BatchRunner over a pipe, in both output formats.
+void batch_runner() {
+    MetroSystem pune;
+    const std::string input =
+        "# comment\n"
+        "PCMC Bhavan,Ramwadi\n"
+        "\n"
+        "{\"id\": 7, \"from\": \"Swargate\", \"to\": \"Civil Court\", \"mode\": \"distance\"}\n"
+        "Nowhere,Ramwadi\n"
+        "Swargate,Ramwadi,sideways\n";
+
+    auto run = [&](BatchRunner::Format format, BatchRunner::Summary& summary) {
+        int in[2], out[2];
+        CHECK(::pipe(in) == 0 && ::pipe(out) == 0);
+        CHECK(::write(in[1], input.data(), input.size()) == static_cast<ssize_t>(input.size()));
+        ::close(in[1]);
+        std::string output;
+        std::thread reader([&] { output = read_all(out[0]); });
+        BatchRunner runner(pune, format);
+        summary = runner.run(in[0], out[1]);
+        ::close(out[1]);
+        reader.join();
+        ::close(in[0]);
+        ::close(out[0]);
+        return output;
+    };
+
+    BatchRunner::Summary summary;
+    auto lines = split_lines(run(BatchRunner::Format::JSON, summary));
+    CHECK(summary.queries == 4);
+    CHECK(summary.failed == 2);
+    CHECK(lines.size() == 4);
+    if (lines.size() == 4) {
+        std::string expected = "{";
+        pune.append_json(expected, pune.find_optimal_path("PCMC Bhavan", "Ramwadi"));
+        CHECK(lines[0] == expected + "}");
+        CHECK(lines[1].rfind("{\"id\":7,\"found\":true", 0) == 0);
+        CHECK(contains(lines[2], "unknown station"));
+        CHECK(contains(lines[3], "mode"));
+    }
+
+    auto binary = run(BatchRunner::Format::BINARY, summary);
+    CHECK(binary.rfind("PMRT", 0) == 0);
+    CHECK(summary.queries == 4);
+    CHECK(summary.bytes == binary.size());
+}
+
+// The reply lines of a server on `live` to `requests`, sent over one
+// connection on a Unix socket.
+std::vector<std::string> serve(LiveNetwork& live, const std::string& requests) {
+    QueryServer server(live);
+    std::string path = (std::filesystem::temp_directory_path() /
+                        ("pune_metro_test_" + std::to_string(getpid()) + ".sock")).string();
+    server.listen_unix(path);
+    std::thread serving([&] { server.run(); });
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    CHECK(::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+    CHECK(::write(fd, requests.data(), requests.size()) == static_cast<ssize_t>(requests.size()));
+    ::shutdown(fd, SHUT_WR);
+    auto lines = split_lines(read_all(fd));
+    ::close(fd);
+    server.stop();
+    serving.join();
+    return lines;
+}
+
+// The JSON-lines protocol over a Unix socket: routes, stats, a closure
+// and the route after it.
+void server_protocol() {
+    LiveNetwork live(std::make_shared<MetroSystem>());
+    const std::string requests =
+        "{\"id\": 1, \"from\": \"Swargate\", \"to\": \"Shivaji Nagar\"}\n"
+        "{\"id\": \"two\", \"from\": \"Swargate\", \"to\": \"Atlantis\"}\n"
+        "not json\n"
+        "{\"op\": \"close\", \"from\": \"Swargate\", \"to\": \"Mandai\"}\n"
+        "{\"id\": 3, \"from\": \"Swargate\", \"to\": \"Shivaji Nagar\"}\n"
+        "{\"id\": 4, \"op\": \"stats\"}\n";
+    auto lines = serve(live, requests);
+    CHECK(lines.size() == 6);
+    if (lines.size() != 6) return;
+    auto planned = MetroSystem().find_optimal_path("Swargate", "Shivaji Nagar");
+    std::string expected = "{\"id\":1,";
+    MetroSystem().append_json(expected, planned);
+    CHECK(lines[0] == expected + "}");
+    CHECK(lines[1] == "{\"id\":\"two\",\"error\":\"unknown station: Atlantis\"}");
+    CHECK(contains(lines[2], "\"error\""));
+    CHECK(lines[3] == "{\"version\":1,\"changed\":2}");
+    CHECK(lines[4] == "{\"id\":3,\"found\":false}");  // the only way south is closed
+    CHECK(lines[5].rfind("{\"id\":4,\"requests\":", 0) == 0);
+    CHECK(contains(lines[5], "\"version\":1"));
+    CHECK(live.snapshot()->version() == 1);
+}
+
+// A connected Unix socket to the server listening on `path`.
+int connect_unix(const std::string& path) {
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    CHECK(::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+    return fd;
+}
+
+// The next line `fd` delivers, without its newline.
+std::string read_line(int fd) {
+    std::string line;
+    char c;
+    while (::read(fd, &c, 1) == 1 && c != '\n') line += c;
+    return line;
+}
+
+// A client pipelining requests faster than they are answered, and never
+// reading the answers, doesn't hold up another client. Out of descriptors
+// the server waits for a client to leave rather than spinning on its
+// listener.
+void server_limits() {
+    LiveNetwork live(std::make_shared<MetroSystem>());
+    const std::string request = "{\"from\": \"Swargate\", \"to\": \"Ramwadi\"}\n";
+    std::string path = (std::filesystem::temp_directory_path() /
+                        ("pune_metro_limits_" + std::to_string(getpid()) + ".sock")).string();
+    {
+        QueryServer server(live);
+        server.listen_unix(path);
+        std::thread serving([&] { server.run(); });
+        
+        std::atomic<bool> flooding = true;
+        int flood = connect_unix(path);
+        std::thread flooder([&] {
+            std::string block;
+            while (block.size() < 64 * 1024) block += request;
+            auto until = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+            while (std::chrono::steady_clock::now() < until) {
+                if (::send(flood, block.data(), block.size(), MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+            flooding = false;
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        
+        int fd = connect_unix(path);
+        CHECK(::write(fd, request.data(), request.size()) == static_cast<ssize_t>(request.size()));
+        CHECK(contains(read_line(fd), "\"found\":true"));
+        CHECK(flooding);  // answered while the flood went on
+        flooder.join();
+        ::close(fd);
+        ::close(flood);
+        server.stop();
+        serving.join();
+    }
+    
+    QueryServer server(live);
+    server.listen_unix(path);
+    double busy = 0;  // CPU seconds used by the event loop
+    std::thread serving([&] {
+        server.run();
+        timespec used{};
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &used);
+        busy = used.tv_sec + used.tv_nsec * 1e-9;
+    });
+    
+    // Room for the server to accept one client, and only one.
+    int first = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    int second = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    int lowest_free = ::dup(first);
+    ::close(lowest_free);
+    rlimit saved{};
+    CHECK(getrlimit(RLIMIT_NOFILE, &saved) == 0);
+    rlimit lowered = saved;
+    lowered.rlim_cur = static_cast<rlim_t>(lowest_free + 1);
+    CHECK(setrlimit(RLIMIT_NOFILE, &lowered) == 0);
+    
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    for (int fd : {first, second}) {
+        CHECK(::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+    }
+    CHECK(::write(second, request.data(), request.size()) == static_cast<ssize_t>(request.size()));
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    ::close(first);  // makes room for the second client
+    CHECK(contains(read_line(second), "\"found\":true"));
+    CHECK(setrlimit(RLIMIT_NOFILE, &saved) == 0);
+    ::close(second);
+    server.stop();
+    serving.join();
+    CHECK(busy < 0.15);
+}
+
+// Alternatives start with the optimal route and keep to the stretch and
+// overlap limits without revisiting a station. Stations outside the
+// network have none.
+void alternatives() {
+    MetroSystem& system = synthetic();
+    const auto& graph = system.network();
+    auto starts = random_stations(system, 60, 41), ends = random_stations(system, 60, 42);
+    auto& fwd = MetroSystem::thread_workspace();
+    MetroSystem::QueryWorkspace bwd;
+    size_t found = 0;
+    for (size_t i = 0; i < starts.size(); ++i) {
+        if (starts[i] == ends[i]) continue;
+        for (bool minimize_time : {true, false}) {
+            auto routes = system.find_alternative_routes(StationId(starts[i]), StationId(ends[i]),
+                                                         3, minimize_time, fwd, bwd);
+            auto optimal = reference_costs(graph, starts[i], minimize_time)[ends[i]];
+            CHECK(!routes.empty());
+            if (routes.empty()) continue;
+            found += routes.size();
+            CHECK(std::abs(route_cost(routes[0], minimize_time) - optimal) < TOLERANCE);
+            for (const auto& route : routes) {
+                CHECK(well_formed(graph, route, starts[i], ends[i]));
+                CHECK(route_cost(route, minimize_time) <= 1.25 * optimal + TOLERANCE);
+                auto stations = route.path;
+                std::sort(stations.begin(), stations.end());
+                CHECK(std::adjacent_find(stations.begin(), stations.end()) == stations.end());
+            }
+        }
+    }
+    CHECK(found > starts.size() * 2);  // a grid has plenty of alternatives
+
+    int n = static_cast<int>(graph.station_count());
+    StationId first(0), outside(n), far(n + 100000);
+    CHECK(system.find_alternative_routes(far, first, 3, true, fwd, bwd).empty());
+    CHECK(system.find_alternative_routes(first, StationId(), 3, false, fwd, bwd).empty());
+    CHECK(system.find_alternative_routes(outside, outside, 3, true, fwd, bwd).empty());
+
+    MetroSystem pune;  // a tree: only the optimal route
+    CHECK(pune.find_alternative_routes("PCMC Bhavan", "Ramwadi").size() == 1);
+}
+
+// No reported trade-off is matched or beaten on every criterion by
+// another, the fastest comes first and is the optimal time route.
+void pareto_routes() {
+    MetroSystem pune;
+    const auto& graph = pune.network();
+    auto& ws = MetroSystem::thread_pareto_workspace();
+    for (int start = 0; start < static_cast<int>(graph.station_count()); start += 3) {
+        auto fastest = reference_costs(graph, start, true);
+        for (int end = 0; end < static_cast<int>(graph.station_count()); ++end) {
+            if (start == end) continue;
+            auto routes = pune.find_pareto_routes(StationId(start), StationId(end), ws);
+            CHECK(!ws.truncated);
+            CHECK(!routes.empty());
+            if (routes.empty()) continue;
+            CHECK(std::abs(routes[0].route.total_time - fastest[end]) < TOLERANCE);
+            for (size_t i = 0; i < routes.size(); ++i) {
+                const auto& a = routes[i];
+                CHECK(well_formed(graph, a.route, start, end));
+                CHECK(std::abs(a.fare - pune.route_fare(a.route)) < TOLERANCE);
+                if (i > 0) CHECK(routes[i - 1].route.total_time <= a.route.total_time);
+                for (size_t j = 0; j < routes.size(); ++j) {
+                    const auto& b = routes[j];
+                    if (i == j) continue;
+                    CHECK(!(b.route.total_time <= a.route.total_time + 1e-6 &&
+                            b.route.total_distance <= a.route.total_distance + 1e-6 &&
+                            b.route.interchanges <= a.route.interchanges &&
+                            b.fare <= a.fare + 1e-6));
+                }
+            }
+        }
+    }
+
+    int n = static_cast<int>(graph.station_count());
+    CHECK(pune.find_pareto_routes(StationId(n + 100000), StationId(0), ws).empty());
+    CHECK(pune.find_pareto_routes(StationId(0), StationId(), ws).empty());
+
+    // Totals past 65536 minutes or kilometres: the longer route on one
+    // line is not mistaken for one that beats the shorter route with an
+    // interchange.
+    std::istringstream csv(
+        "segment,A,S,X,40000\n"
+        "segment,A,X,T,40000\n"
+        "segment,B,S,Y,30000\n"
+        "segment,C,Y,T,30000\n");
+    MetroSystem long_haul(csv);
+    StationId s = long_haul.station_id("S"), t = long_haul.station_id("T");
+    auto routes = long_haul.find_pareto_routes(s, t, ws);
+    CHECK(routes.size() == 2);
+    for (const auto& entry : routes) {
+        CHECK(well_formed(long_haul.network(), entry.route, s.index(), t.index()));
+    }
+}
+
+// Repeated queries come from the cache, which an update invalidates, and
+// two versions derived from the same one never share entries.
+void route_cache() {
+    auto base = std::make_shared<MetroSystem>();
+    base->enable_route_cache(64);
+    auto first = base->find_optimal_path("Swargate", "Shivaji Nagar");
+    auto again = base->find_optimal_path("Swargate", "Shivaji Nagar");
+    CHECK(again.path == first.path && again.path_lines == first.path_lines);
+    CHECK(base->cache()->stats().hits == 1);
+    CHECK(base->find_alternative_routes("Swargate", "Ramwadi").size() == 1);
+    CHECK(base->find_alternative_routes("Swargate", "Ramwadi").size() == 1);
+    CHECK(base->cache()->stats().hits == 2);
+
+    StationId swargate = base->station_id("Swargate"), mandai = base->station_id("Mandai");
+    auto closed = base->updated(NetworkUpdate().close_segment(swargate, mandai));
+    auto delayed = base->updated(NetworkUpdate().delay_segment(swargate, mandai, 3));
+    CHECK(closed->cache() == base->cache());
+    CHECK(!closed->find_optimal_path("Swargate", "Shivaji Nagar").found);
+    auto slower = delayed->find_optimal_path("Swargate", "Shivaji Nagar");
+    CHECK(slower.found);
+    CHECK(std::abs(slower.total_time - first.total_time - 3) < TOLERANCE);
+    CHECK(base->find_optimal_path("Swargate", "Shivaji Nagar").path == first.path);
+
+    // A cached set of alternatives never answers a request for fewer.
+    std::istringstream csv(synthetic_network(900, 12, 7));
+    MetroSystem grid(csv);
+    grid.enable_route_cache(64);
+    StationId corner(0), far_corner(899);
+    CHECK(grid.find_alternative_routes(corner, far_corner, 100).size() > 64);
+    for (size_t k : {64, 63, 100, 3}) {
+        CHECK(grid.find_alternative_routes(corner, far_corner, k).size() <= k);
+    }
+}
+
+// Isochrone rings hold exactly the stations the reference reaches within
+// each budget, nearest first.
+void isochrones() {
+    MetroSystem& system = synthetic();
+    const auto& graph = system.network();
+    const std::vector<double> budgets = {20, 5, 10};
+    for (int origin : random_stations(system, 10, 51)) {
+        auto expected = reference_costs(graph, origin, true);
+        auto isochrone = system.isochrone(StationId(origin), budgets);
+        CHECK(isochrone.budgets == std::vector<double>({5, 10, 20}));
+        CHECK(isochrone.rings.size() == 3);
+        CHECK(!isochrone.stations.empty() && isochrone.stations[0].station == origin);
+        for (size_t i = 0; i < isochrone.stations.size(); ++i) {
+            const auto& reach = isochrone.stations[i];
+            CHECK(std::abs(reach.time - expected[reach.station]) < TOLERANCE);
+            if (i > 0) CHECK(isochrone.stations[i - 1].time <= reach.time);
+        }
+        for (size_t ring = 0; ring < 3; ++ring) {
+            size_t within = std::count_if(expected.begin(), expected.end(),
+                [&](double cost) { return cost <= isochrone.budgets[ring]; });
+            CHECK(isochrone.rings[ring] == within);
+        }
+
+        auto counts = system.reach_counts(budgets);
+        for (size_t ring = 0; ring < 3; ++ring) {
+            CHECK(counts.at(StationId(origin), ring) == isochrone.rings[ring]);
+        }
+    }
+
+    CHECK(out_of_range([&] { system.isochrone(StationId(), budgets); }));
+}
+
+// A single trip loads exactly the stations, transfers and segments of
+// its route.
+void demand_assignment() {
+    MetroSystem pune;
+    const auto& graph = pune.network();
+    for (auto [from, to] : {std::pair<const char*, const char*>{"PCMC Bhavan", "Ramwadi"},
+                            {"Swargate", "Civil Court"}, {"Vanaz", "Shivaji Nagar"}}) {
+        auto route = pune.find_optimal_path(from, to);
+        CHECK(route.found);
+        std::vector<MetroSystem::Demand> trip = {{pune.station_id(from), pune.station_id(to), 2.0}};
+        auto load = pune.assign_demand(trip);
+        CHECK(load.assigned == 2.0 && load.unassigned == 0);
+        CHECK(std::accumulate(load.through.begin(), load.through.end(), 0.0) ==
+              2.0 * (route.path.size() - 2));
+        CHECK(std::accumulate(load.transfers.begin(), load.transfers.end(), 0.0) ==
+              2.0 * route.interchanges);
+        for (size_t i = 0; i + 1 < route.path.size(); ++i) {
+            CHECK(load.segment[graph.find_edge(route.path[i], route.path[i + 1],
+                                               route.path_lines[i])] == 2.0);
+        }
+    }
+
+    auto all = pune.betweenness();
+    size_t n = graph.station_count();
+    CHECK(all.assigned == static_cast<double>(n * (n - 1)));
+    CHECK(all.unassigned == 0);
+}
+
+// Station IDs resolve names, and IDs from outside the network are
+// rejected rather than read past the end.
+void station_ids() {
+    MetroSystem pune;
+    StationId swargate = pune.station_id("Swargate");
+    StationId court = pune.station_id("Civil Court");
+    CHECK(pune.valid(swargate) && pune.station_name(swargate) == "Swargate");
+    CHECK(!pune.station_id("Atlantis").valid());
+
+    StationId outside(static_cast<int>(pune.network().station_count()));
+    CHECK(outside.valid() && !pune.valid(outside));
+    CHECK(pune.station_name(outside).empty());
+    CHECK(!pune.find_optimal_path(swargate, outside).found);
+    CHECK(pune.find_alternative_routes(outside, court).empty());
+    CHECK(pune.find_pareto_routes(swargate, outside).empty());
+
+    auto route = pune.find_optimal_path(swargate, court);
+    CHECK(route.path == pune.find_optimal_path("Swargate", "Civil Court").path);
+    CHECK(pune.all_stations().size() == pune.network().station_count());
+    for (uint32_t line = 0; line < pune.network().line_count; ++line) {
+        for (StationId station : pune.stations_on_line(static_cast<LineId>(line))) {
+            CHECK(pune.network().station_lines[station.index()] & (LineMask(1) << line));
+        }
+    }
+}
+
+// Name search: the exact name first, then name prefixes, word prefixes,
+// substrings (short queries included) and typos, each tier in name order
+// and cut off at the limit.
+void station_names() {
+    MetroSystem pune;
+    using Tier = StationNameIndex::Tier;
+    std::vector<StationNameIndex::Match> matches;
+    auto name = [&](size_t i) { return pune.network().name(matches[i].station); };
+    auto contains = [](const std::vector<std::string>& found, std::string_view station) {
+        return std::find(found.begin(), found.end(), station) != found.end();
+    };
+
+    CHECK(pune.search_stations("SHIVAJI-nagar", 5, matches) >= 1);
+    CHECK(name(0) == "Shivaji Nagar" && matches[0].tier == Tier::EXACT);
+    CHECK(pune.search_stations("baner", 10, matches) == 2);
+    CHECK(name(0) == "Baner" && matches[0].tier == Tier::EXACT);
+    CHECK(name(1) == "Baner Gaon" && matches[1].tier == Tier::NAME_PREFIX);
+
+    size_t found = pune.search_stations("nagar", 50, matches);
+    CHECK(found >= 7);
+    for (size_t i = 1; i < found; ++i) {
+        CHECK(matches[i - 1].tier < matches[i].tier ||
+              (matches[i - 1].tier == matches[i].tier && name(i - 1) < name(i)));
+    }
+    CHECK(matches[0].tier == Tier::WORD_PREFIX && name(0) == "Anand Nagar");
+    CHECK(name(found - 1) == "Kamnagar" && matches[found - 1].tier == Tier::SUBSTRING);
+    auto top = pune.search_stations("nagar", 3);
+    CHECK(top.size() == 3 && top[0] == "Anand Nagar" && top[2] == name(2));
+    CHECK(pune.search_stations("nagar", 0).empty() && pune.search_stations("", 5).empty());
+
+    CHECK(contains(pune.search_stations("ga", 50), "Swargate"));
+    CHECK(contains(pune.search_stations("ga", 50), "Garware College"));
+    CHECK(contains(pune.search_stations("q", 50), "Quadron"));
+    CHECK(pune.search_stations("zx", 50).empty());
+    CHECK(contains(pune.search_stations("ruby hal", 5), "Ruby Hall Clinic"));
+
+    CHECK(pune.search_stations("swarrgate", 5, matches) == 1);
+    CHECK(name(0) == "Swargate" && matches[0].tier == Tier::FUZZY + 1);
+    CHECK(pune.search_stations("civl court", 5)[0] == "Civil Court");
+    CHECK(pune.search_stations("kasbah peth", 5)[0] == "Kasba Peth");
+    CHECK(pune.search_stations("xyzzy", 5).empty());
+
+    // On a grid whose names all share "synthetic", the matches for a part
+    // of a name are still the first by tier and name, and typos still find
+    // the name they garble.
+    std::istringstream csv(synthetic_network(2500, 12, 7));
+    MetroSystem grid(csv);
+    auto first_containing = [&](std::string_view part, size_t count) {
+        std::vector<std::pair<uint32_t, std::string>> found;
+        std::string normalised;
+        for (uint32_t s = 0; s < grid.network().station_count(); ++s) {
+            StationNameIndex::normalise(grid.network().name(s), normalised);
+            size_t at = normalised.find(part);
+            if (at == std::string::npos) continue;
+            uint32_t tier = Tier::SUBSTRING;
+            for (; at != std::string::npos; at = normalised.find(part, at + 1)) {
+                if (at == 0) {
+                    tier = normalised == part ? Tier::EXACT : Tier::NAME_PREFIX;
+                } else if (normalised[at - 1] == ' ') {
+                    tier = std::min<uint32_t>(tier, Tier::WORD_PREFIX);
+                }
+            }
+            found.emplace_back(tier, normalised);
+        }
+        std::sort(found.begin(), found.end());
+        std::vector<std::string> names;
+        for (size_t i = 0; i < found.size() && i < count; ++i) names.push_back(found[i].second);
+        return names;
+    };
+    for (std::string_view query : {"7", "ic 4", "9 1"}) {
+        std::vector<std::string> got;
+        std::string normalised;
+        for (const auto& station : grid.search_stations(query, 6)) {
+            StationNameIndex::normalise(station, normalised);
+            got.push_back(normalised);
+        }
+        CHECK(got == first_containing(query, 6));
+    }
+    CHECK(grid.search_stations("synthtic 5-7", 10, matches) == 10);
+    CHECK(grid.network().name(matches[0].station) == "Synthetic 5-7");
+    CHECK(matches[0].tier == Tier::FUZZY + 1);
+    for (const auto& match : matches) CHECK(match.tier <= Tier::FUZZY + 2);
+    CHECK(grid.search_stations("synthetik 12-3", 5)[0] == "Synthetic 12-3");
+    CHECK(grid.search_stations("synthetik", 5, matches) == 5);
+    for (const auto& match : matches) CHECK(match.tier == Tier::FUZZY + 1);
+}
+
+// Journeys with departure times on a timetabled grid: arrive_by never
+// leaves earlier than needed to make what depart_at makes. Stations
+// outside the network have no journey.
+void journeys() {
+    std::istringstream csv(synthetic_network(400, 12, 7, 6));
+    MetroSystem system(csv);
+    auto starts = random_stations(system, 30, 61), ends = random_stations(system, 30, 62);
+    for (size_t i = 0; i < starts.size(); ++i) {
+        StationId start(starts[i]), end(ends[i]);
+        auto journey = system.depart_at(start, end, 8 * 3600);
+        CHECK(journey.found);
+        if (!journey.found) continue;
+        CHECK(journey.departure >= 8 * 3600 && journey.arrival >= journey.departure);
+        auto latest = system.arrive_by(start, end, journey.arrival);
+        CHECK(latest.found && latest.arrival <= journey.arrival);
+        CHECK(latest.departure >= journey.departure);
+    }
+    CHECK(!system.depart_at(StationId(), StationId(0), 8 * 3600).found);
+
+    int n = static_cast<int>(system.network().station_count());
+    StationId first(0), outside(n), far(n + 100000);
+    auto& ws = MetroSystem::thread_journey_workspace();
+    CHECK(!system.depart_at(far, first, 8 * 3600, ws).found);
+    CHECK(!system.depart_at(first, StationId(-1), 8 * 3600, ws).found);
+    CHECK(!system.arrive_by(first, far, 9 * 3600, ws).found);
+    CHECK(!system.arrive_by(outside, outside, 9 * 3600).found);
+}
+
+// Journeys on updated versions follow the closures and delays: Swargate is
+// cut off by closing Mandai, the trains north of it still run, and a delay
+// on the way makes every train that rides it late.
+void disrupted_journeys() {
+    auto base = std::make_shared<MetroSystem>();
+    StationId swargate = base->station_id("Swargate"), mandai = base->station_id("Mandai");
+    StationId kasba = base->station_id("Kasba Peth"), shivaji = base->station_id("Shivaji Nagar");
+    const uint32_t eight = 8 * 3600;
+    CHECK(base->depart_at(kasba, swargate, eight).found);
+
+    auto closed = base->updated(NetworkUpdate().close_station(mandai));
+    for (const Connection& c : closed->timetable()->connections) {
+        CHECK(c.from != static_cast<uint32_t>(mandai.index()));
+        CHECK(c.to != static_cast<uint32_t>(mandai.index()));
+    }
+    CHECK(!closed->find_optimal_path(kasba, swargate, true).found);
+    CHECK(!closed->depart_at(kasba, swargate, eight).found);
+    CHECK(!closed->arrive_by(swargate, kasba, 10 * 3600).found);
+    auto north = closed->depart_at(kasba, shivaji, eight);
+    CHECK(north.found && north.arrival == base->depart_at(kasba, shivaji, eight).arrival);
+
+    auto planned = base->depart_at(shivaji, mandai, eight);
+    auto delayed = base->updated(NetworkUpdate().delay_segment(
+        base->station_id("Civil Court"), kasba, 5));
+    auto late = delayed->depart_at(shivaji, mandai, eight);
+    CHECK(planned.found && late.found);
+    CHECK(late.departure == planned.departure && late.arrival == planned.arrival + 300);
+
+    auto restored = delayed->updated(NetworkUpdate().restore_segment(
+        base->station_id("Civil Court"), kasba));
+    CHECK(restored->timetable() == base->timetable());
+}
+
+// The value of one sample, metric name and labels, in Prometheus text;
+// -1 if it is missing.
+double sample(const std::string& text, const std::string& series) {
+    size_t at = text.find("\n" + series + " ");
+    if (at == std::string::npos) return -1;
+    return std::strtod(text.c_str() + at + series.size() + 2, nullptr);
+}
+
+// LatencyHistogram percentiles and merges. With metrics compiled in, the
+// query counts, latencies and search counters of a few queries show up in
+// prometheus() and the server's "metrics" op; without them, both are off.
+void metrics() {
+    LatencyHistogram small, low, high;
+    for (uint64_t v = 0; v < 16; ++v) small.record(v);
+    CHECK(small.percentile(0.5) == 7 && small.percentile(1.0) == 15);
+    for (uint64_t v = 1; v <= 1000; ++v) low.record(v);
+    for (uint64_t v = 1001; v <= 2000; ++v) high.record(v);
+    CHECK(low.count() == 1000 && low.sum() == 500500);
+    for (double q : {0.5, 0.9, 0.99}) {
+        CHECK(low.percentile(q) >= q * 1000 && low.percentile(q) <= q * 1000 * 1.07);
+    }
+    low.merge(high);
+    CHECK(low.count() == 2000 && low.sum() == 2001000);
+    CHECK(low.percentile(0.5) >= 1000 && low.percentile(0.5) <= 1070);
+    CHECK(low.percentile(0.99) >= 1980 && low.percentile(0.99) <= 1980 * 1.07);
+    CHECK(LatencyHistogram().percentile(0.5) == 0);
+
+    LiveNetwork live(std::make_shared<MetroSystem>());
+    if (!METRICS_ENABLED) {
+        CHECK(EngineMetrics::prometheus().empty());
+        auto lines = serve(live, "{\"id\": 1, \"op\": \"metrics\"}\n");
+        CHECK(lines.size() == 1 && contains(lines[0], "\"error\""));
+        return;
+    }
+
+    // Other cases have run queries too, so only the growth is checked.
+    auto count = [](const std::string& text, const char* kind) {
+        return sample(text, std::string("pune_metro_query_seconds_count{kind=\"") + kind + "\"}");
+    };
+    const std::string relaxations = "pune_metro_search_relaxations_total{kind=\"route_time\"}";
+    std::string before = EngineMetrics::prometheus();
+    LatencyHistogram latency;
+    EngineMetrics::merge_latency(EngineMetrics::ROUTE_TIME, latency);
+    CHECK(count(before, "route_time") == static_cast<double>(latency.count()));
+
+    MetroSystem pune;
+    size_t queries = 0;
+    for (int s = 0; s < 6; ++s) {
+        for (int t = 0; t < 6; ++t) {
+            if (s == t) continue;
+            CHECK(pune.find_optimal_path(StationId(s), StationId(t)).found);
+            ++queries;
+        }
+    }
+    CHECK(!pune.find_pareto_routes(StationId(0), StationId(5)).empty());
+    std::string after = EngineMetrics::prometheus();
+    CHECK(count(after, "route_time") == count(before, "route_time") + queries);
+    CHECK(count(after, "pareto") == count(before, "pareto") + 1);
+    CHECK(sample(after, relaxations) > sample(before, relaxations));
+    LatencyHistogram grown;
+    EngineMetrics::merge_latency(EngineMetrics::ROUTE_TIME, grown);
+    CHECK(grown.count() == latency.count() + queries);
+    CHECK(grown.percentile(0.99) >= grown.percentile(0.5) && grown.percentile(0.5) > 0);
+
+    auto lines = serve(live, "{\"id\": 1, \"from\": \"Swargate\", \"to\": \"Shivaji Nagar\"}\n"
+                             "{\"id\": 2, \"op\": \"metrics\"}\n");
+    CHECK(lines.size() == 2);
+    if (lines.size() != 2) return;
+    CHECK(lines[1].rfind("{\"id\":2,\"metrics\":\"# HELP pune_metro_query_seconds ", 0) == 0);
+    CHECK(contains(lines[1], "pune_metro_query_seconds_count{kind=\\\"route_time\\\"} " +
+                             std::to_string(grown.count() + 1)));
+}
+
+struct Case {
+    const char* name;
+    void (*run)();
+};
+
+const Case CASES[] = {
+    {"pune_searches", pune_searches},
+    {"synthetic_searches", synthetic_searches},
+    {"route_tables", route_tables},
+    {"hierarchies", hierarchies},
+    {"live_updates", live_updates},
+    {"route_table_repairs", route_table_repairs},
+    {"image_round_trip", image_round_trip},
+    {"batch_queries", batch_queries},
+    {"shared_searches", shared_searches},
+    {"batch_runner", batch_runner},
+    {"server_protocol", server_protocol},
+    {"server_limits", server_limits},
+    {"alternatives", alternatives},
+    {"pareto_routes", pareto_routes},
+    {"route_cache", route_cache},
+    {"isochrones", isochrones},
+    {"demand_assignment", demand_assignment},
+    {"station_ids", station_ids},
+    {"station_names", station_names},
+    {"journeys", journeys},
+    {"disrupted_journeys", disrupted_journeys},
+    {"metrics", metrics},
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::string_view filter = argc > 1 ? argv[1] : "";
+    int failed_cases = 0, run = 0;
+    for (const Case& test : CASES) {
+        if (std::string_view(test.name).find(filter) == std::string_view::npos) continue;
+        int before = failures;
+        test.run();
+        ++run;
+        bool passed = failures == before;
+        if (!passed) ++failed_cases;
+        std::printf("%-20s %s\n", test.name, passed ? "ok" : "FAILED");
+    }
+    std::printf("%d of %d cases passed\n", run - failed_cases, run);
+    return failed_cases == 0 && run > 0 ? 0 : 1;
+}